@@ -0,0 +1,305 @@
+/*
+Time each BLAS/LAPACK kernel of LinearAlgebra.hh on the shapes the refit gives it, so that backends can be compared
+on the same node:  build with "make benchmark BLAS=<mkl|openblas|blis>" from the top directory, and run
+  Benchmark/LinearAlgebraBenchmark [NumChannels] [NumFreqs] [NumVectors] [NumSignals] [LowRank]
+Defaults are 200 channels, 64 frequencies (a slice of the noise matrix, but already far bigger than cache),
+NoiseMulTileColumns = 32 vectors per multiplication, 4 signals, and rank 64.
+
+The noise kernels stream through one block per frequency, with the vectors laid out as in the noise queue (columns of
+length 2*NumChannels*NumFreqs), as in EXORefitSignals::DoNoiseMultiplication_Frequency.  The solver kernels are the
+per-event ones of DoBlBiCGSTAB and the preconditioner, with columns of length 2*NumChannels*NumFreqs + NumSignals.
+Run it single-threaded (eg. OPENBLAS_NUM_THREADS=1), as the refit is.
+*/
+
+#include "../LinearAlgebra.hh"
+#include <time.h>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+
+static double Now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static void Fill(std::vector<double>& v, unsigned& seed)
+{
+  for(size_t i = 0; i < v.size(); i++) {
+    seed = 1664525*seed + 1013904223;
+    v[i] = double(seed)/4294967296.0 - 0.5;
+  }
+}
+
+struct Kernel
+{
+  virtual ~Kernel() {}
+  virtual const char* Name() const = 0;
+  virtual double Flops() const = 0; // Per call; zero if it's just data movement.
+  virtual void Run() = 0;
+};
+
+static void Time(Kernel& k)
+{
+  // Warm up, then repeat until at least half a second has gone by.
+  k.Run();
+  size_t NumCalls = 0;
+  double Start = Now(), Elapsed = 0;
+  while(Elapsed < 0.5) {
+    k.Run();
+    NumCalls++;
+    Elapsed = Now() - Start;
+  }
+  double PerCall = Elapsed/NumCalls;
+  std::cout<<std::setw(44)<<std::left<<k.Name()<<std::right
+           <<std::setw(12)<<std::setprecision(4)<<PerCall*1e6<<" us";
+  if(k.Flops() > 0) std::cout<<std::setw(10)<<std::setprecision(4)<<k.Flops()/PerCall*1e-9<<" GFLOP/s";
+  std::cout<<std::endl;
+}
+
+// Noise kernels:  out = block*in for every frequency, NumVectors columns at a time.
+struct NoiseShapes
+{
+  size_t C, NumFreqs, NumVectors, BlockSize, ColumnLength;
+  std::vector<double> in, out;
+  NoiseShapes(size_t c, size_t nf, size_t nv, unsigned& seed)
+  : C(c), NumFreqs(nf), NumVectors(nv), BlockSize(2*c), ColumnLength(2*c*nf),
+    in(ColumnLength*nv), out(ColumnLength*nv)
+  { Fill(in, seed); }
+};
+
+struct FullBlocks : Kernel
+{
+  NoiseShapes& s;
+  std::vector<double> blocks;
+  FullBlocks(NoiseShapes& S, unsigned& seed) : s(S), blocks(S.NumFreqs*S.BlockSize*S.BlockSize) { Fill(blocks, seed); }
+  const char* Name() const { return "dgemm  full noise blocks"; }
+  double Flops() const { return 2.0*s.NumFreqs*s.BlockSize*s.BlockSize*s.NumVectors; }
+  void Run() {
+    for(size_t f = 0; f < s.NumFreqs; f++) {
+      LinAlg::gemm('N', 'N', s.BlockSize, s.NumVectors, s.BlockSize,
+                   1, &blocks[f*s.BlockSize*s.BlockSize], s.BlockSize,
+                   &s.in[f*s.BlockSize], s.ColumnLength, 0, &s.out[f*s.BlockSize], s.ColumnLength);
+    }
+  }
+};
+
+struct SymmetricBlocks : Kernel
+{
+  NoiseShapes& s;
+  std::vector<double> blocks;
+  SymmetricBlocks(NoiseShapes& S, unsigned& seed) : s(S), blocks(S.NumFreqs*S.BlockSize*S.BlockSize) { Fill(blocks, seed); }
+  const char* Name() const { return "dsymm  noise blocks (upper)"; }
+  double Flops() const { return 2.0*s.NumFreqs*s.BlockSize*s.BlockSize*s.NumVectors; }
+  void Run() {
+    for(size_t f = 0; f < s.NumFreqs; f++) {
+      LinAlg::symm('L', 'U', s.BlockSize, s.NumVectors,
+                   1, &blocks[f*s.BlockSize*s.BlockSize], s.BlockSize,
+                   &s.in[f*s.BlockSize], s.ColumnLength, 0, &s.out[f*s.BlockSize], s.ColumnLength);
+    }
+  }
+};
+
+struct SingleBlocks : Kernel
+{
+  NoiseShapes& s;
+  std::vector<float> blocks, in, out;
+  SingleBlocks(NoiseShapes& S, unsigned& seed)
+  : s(S), blocks(S.NumFreqs*S.BlockSize*S.BlockSize), in(S.in.begin(), S.in.end()), out(S.out.size())
+  {
+    std::vector<double> Temp(blocks.size());
+    Fill(Temp, seed);
+    blocks.assign(Temp.begin(), Temp.end());
+  }
+  const char* Name() const { return "sgemm  full noise blocks, single"; }
+  double Flops() const { return 2.0*s.NumFreqs*s.BlockSize*s.BlockSize*s.NumVectors; }
+  void Run() {
+    for(size_t f = 0; f < s.NumFreqs; f++) {
+      LinAlg::gemm('N', 'N', s.BlockSize, s.NumVectors, s.BlockSize,
+                   1.f, &blocks[f*s.BlockSize*s.BlockSize], s.BlockSize,
+                   &in[f*s.BlockSize], s.ColumnLength, 0.f, &out[f*s.BlockSize], s.ColumnLength);
+    }
+  }
+};
+
+struct HermitianBlocks : Kernel
+{
+  // The complex C x C blocks of the Hermitian layout, against interleaved vectors (as in MultiplyHermitianBlock).
+  NoiseShapes& s;
+  std::vector<double> blocks, z, Kz;
+  HermitianBlocks(NoiseShapes& S, unsigned& seed)
+  : s(S), blocks(2*S.NumFreqs*S.C*S.C), z(2*S.C*S.NumVectors), Kz(z.size())
+  { Fill(blocks, seed); Fill(z, seed); }
+  const char* Name() const { return "zgemm  Hermitian noise blocks"; }
+  double Flops() const { return 8.0*s.NumFreqs*s.C*s.C*s.NumVectors; } // Counted as ordinary complex GEMM.
+  void Run() {
+    const double One[2] = {1, 0};
+    const double Zero[2] = {0, 0};
+    for(size_t f = 0; f < s.NumFreqs; f++) {
+      LinAlg::zgemm('N', 'N', s.C, s.NumVectors, s.C,
+                    One, &blocks[2*f*s.C*s.C], s.C, &z[0], s.C, Zero, &Kz[0], s.C);
+    }
+  }
+};
+
+struct LowRankBlocks : Kernel
+{
+  // Project onto Rank modes and expand again (as in MultiplyLowRankBlock).
+  NoiseShapes& s;
+  size_t Rank;
+  std::vector<double> modes, Coeffs;
+  LowRankBlocks(NoiseShapes& S, size_t rank, unsigned& seed)
+  : s(S), Rank(rank), modes(S.NumFreqs*S.BlockSize*rank), Coeffs(rank*S.NumVectors)
+  { Fill(modes, seed); }
+  const char* Name() const { return "dgemm  low-rank noise blocks"; }
+  double Flops() const { return 4.0*s.NumFreqs*s.BlockSize*Rank*s.NumVectors; }
+  void Run() {
+    for(size_t f = 0; f < s.NumFreqs; f++) {
+      const double* U = &modes[f*s.BlockSize*Rank];
+      LinAlg::gemm('T', 'N', Rank, s.NumVectors, s.BlockSize,
+                   1, U, s.BlockSize, &s.in[f*s.BlockSize], s.ColumnLength, 0, &Coeffs[0], Rank);
+      LinAlg::gemm('N', 'N', s.BlockSize, s.NumVectors, Rank,
+                   1, U, s.BlockSize, &Coeffs[0], Rank, 0, &s.out[f*s.BlockSize], s.ColumnLength);
+    }
+  }
+};
+
+// Solver kernels, on one event's columns.
+struct EventShapes
+{
+  size_t ColumnLength, NoiseColumnLength, NumSignals;
+  std::vector<double> R0hat, V, R, Small, Factors, SPD;
+  std::vector<lapack_int> Pivot;
+  EventShapes(size_t NoiseLength, size_t n, unsigned& seed)
+  : ColumnLength(NoiseLength + n), NoiseColumnLength(NoiseLength), NumSignals(n),
+    R0hat(ColumnLength*n), V(ColumnLength*n), R(ColumnLength*n), Small(n*n), Factors(n*n), SPD(n*n), Pivot(n)
+  {
+    Fill(R0hat, seed);
+    Fill(V, seed);
+    Fill(R, seed);
+    Fill(Small, seed);
+    // A well-conditioned triangular factor, and a positive-definite matrix to factor.
+    for(size_t i = 0; i < n; i++) Small[i + n*i] += n;
+    for(size_t col = 0; col < n; col++) {
+      for(size_t row = 0; row < n; row++) {
+        SPD[row + n*col] = (row == col ? n : 0);
+        for(size_t k = 0; k < n; k++) SPD[row + n*col] += Small[k + n*row]*Small[k + n*col];
+      }
+    }
+  }
+};
+
+struct SkinnySkinny : Kernel
+{
+  EventShapes& e;
+  explicit SkinnySkinny(EventShapes& E) : e(E) {}
+  const char* Name() const { return "dgemm  R0hat^T V"; }
+  double Flops() const { return 2.0*e.NumSignals*e.NumSignals*e.ColumnLength; }
+  void Run() {
+    LinAlg::gemm('T', 'N', e.NumSignals, e.NumSignals, e.ColumnLength,
+                 1, &e.R0hat[0], e.ColumnLength, &e.V[0], e.ColumnLength, 0, &e.Factors[0], e.NumSignals);
+  }
+};
+
+struct SkinnySmall : Kernel
+{
+  EventShapes& e;
+  explicit SkinnySmall(EventShapes& E) : e(E) {}
+  const char* Name() const { return "dgemm  R - V alpha"; }
+  double Flops() const { return 2.0*e.NumSignals*e.NumSignals*e.ColumnLength; }
+  void Run() {
+    LinAlg::gemm('N', 'N', e.ColumnLength, e.NumSignals, e.NumSignals,
+                 -1, &e.V[0], e.ColumnLength, &e.Small[0], e.NumSignals, 1, &e.R[0], e.ColumnLength);
+  }
+};
+
+struct FactorSolve : Kernel
+{
+  EventShapes& e;
+  std::vector<double> Alpha;
+  explicit FactorSolve(EventShapes& E) : e(E), Alpha(E.NumSignals*E.NumSignals) {}
+  const char* Name() const { return "dgetrf + 2 dgetrs  R0hat_V"; }
+  double Flops() const { double n = e.NumSignals; return 2*n*n*n/3 + 2*2*n*n*n; }
+  void Run() {
+    e.Factors = e.SPD;
+    if(LinAlg::getrf(e.NumSignals, e.NumSignals, &e.Factors[0], e.NumSignals, &e.Pivot[0]) != 0) std::exit(1);
+    for(size_t i = 0; i < 2; i++) {
+      Alpha = e.Small;
+      LinAlg::getrs('N', e.NumSignals, e.NumSignals, &e.Factors[0], e.NumSignals, &e.Pivot[0],
+                    &Alpha[0], e.NumSignals);
+    }
+  }
+};
+
+struct Cholesky : Kernel
+{
+  EventShapes& e;
+  std::vector<double> X;
+  explicit Cholesky(EventShapes& E) : e(E) {}
+  const char* Name() const { return "dpotrf preconditioner X"; }
+  double Flops() const { double n = e.NumSignals; return n*n*n/3; }
+  void Run() {
+    X = e.SPD;
+    if(LinAlg::potrf('U', e.NumSignals, &X[0], e.NumSignals) != 0) std::exit(1);
+  }
+};
+
+struct Triangular : Kernel
+{
+  // DoInvLPrecon and DoRPrecon:  the signal rows of a block of columns, scaled in place, then solved/multiplied by X.
+  EventShapes& e;
+  explicit Triangular(EventShapes& E) : e(E) {}
+  const char* Name() const { return "dimatcopy + dtrsm + dtrmm  precon"; }
+  double Flops() const { return 2.0*e.NumSignals*e.NumSignals*e.NumSignals; }
+  void Run() {
+    double* Rows = &e.R[e.NoiseColumnLength];
+    LinAlg::imatcopy('N', e.NumSignals, e.NumSignals, -1, Rows, e.ColumnLength, e.ColumnLength);
+    LinAlg::trsm('L', 'U', 'T', 'N', e.NumSignals, e.NumSignals, 1, &e.Small[0], e.NumSignals, Rows, e.ColumnLength);
+    LinAlg::trmm('L', 'U', 'T', 'N', e.NumSignals, e.NumSignals, 1, &e.Small[0], e.NumSignals, Rows, e.ColumnLength);
+  }
+};
+
+int main(int argc, char** argv)
+{
+  size_t NumChannels = argc > 1 ? std::atoi(argv[1]) : 200;
+  size_t NumFreqs = argc > 2 ? std::atoi(argv[2]) : 64;
+  size_t NumVectors = argc > 3 ? std::atoi(argv[3]) : 32;
+  size_t NumSignals = argc > 4 ? std::atoi(argv[4]) : 4;
+  size_t Rank = argc > 5 ? std::atoi(argv[5]) : 64;
+  if(NumChannels == 0 or NumFreqs == 0 or NumVectors == 0 or NumSignals == 0 or Rank > 2*NumChannels) {
+    std::cout<<"Usage: "<<argv[0]<<" [NumChannels] [NumFreqs] [NumVectors] [NumSignals] [LowRank]"<<std::endl;
+    return 1;
+  }
+  std::cout<<"Backend "<<LinAlg::BackendName()<<": "<<NumChannels<<" channels, "<<NumFreqs<<" frequencies, "
+           <<NumVectors<<" vectors per multiplication, "<<NumSignals<<" signals, rank "<<Rank<<"."<<std::endl;
+
+  unsigned seed = 12345;
+  NoiseShapes Noise(NumChannels, NumFreqs, NumVectors, seed);
+  {
+    FullBlocks k1(Noise, seed); Time(k1);
+  }
+  {
+    SymmetricBlocks k2(Noise, seed); Time(k2);
+  }
+  {
+    SingleBlocks k3(Noise, seed); Time(k3);
+  }
+  {
+    HermitianBlocks k4(Noise, seed); Time(k4);
+  }
+  if(Rank > 0) {
+    LowRankBlocks k5(Noise, Rank, seed); Time(k5);
+  }
+
+  EventShapes Event(Noise.ColumnLength, NumSignals, seed);
+  SkinnySkinny k6(Event); Time(k6);
+  SkinnySmall k7(Event); Time(k7);
+  FactorSolve k8(Event); Time(k8);
+  Cholesky k9(Event); Time(k9);
+  Triangular k10(Event); Time(k10);
+  return 0;
+}
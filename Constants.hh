@@ -5,4 +5,8 @@ const double THORIUM_ENERGY_KEV = 2615;
 const size_t MIN_F = 1;
 const size_t MAX_F = 1024;
 
+// Rows per channel of a column over f = MIN_F...MaxF:  a real and an imaginary part for each frequency,
+// except at MAX_F, whose imaginary part is identically zero.
+inline size_t RowsPerChannel(size_t MaxF) { return 2*(MaxF - MIN_F + 1) - (MaxF == MAX_F ? 1 : 0); }
+
 #endif
@@ -28,7 +28,6 @@
 #include "TArrayI.h"
 #include "TH3D.h"
 #include "TGraph.h"
-#include "mkl_trans.h"
 #include <boost/bind.hpp>
 #include <boost/ref.hpp>
 #include <iomanip>
@@ -36,7 +35,9 @@
 #include <sstream>
 #include <cstdlib>
 #include <algorithm>
+#include <numeric>
 #include <fstream>
+#include <iterator>
 #include <set>
 
 #ifdef ENABLE_CHARGE
@@ -48,19 +49,20 @@
 
 #ifdef USE_THREADS
 // We currently use the boost::threads library, if threading is enabled.
-#include <boost/thread/thread.hpp>
-#include <boost/thread/detail/thread_group.hpp>
 #include <boost/thread/mutex.hpp>
 
-// Create basic mutexes for two multiple-writer situations.
-boost::mutex RequestNoiseMulMutex; // Currently events are appended to the request queue.
-
-// And a mutex for writing debugging output from threaded parts of the code.
+// A mutex for writing debugging output from threaded parts of the code.
+// (Events reserve their slots in the request queues with atomic counters instead; see ReserveNoiseMul.)
 boost::mutex CoutMutex;
 
 #endif
 
 #include <boost/mpi/communicator.hpp>
+#include <boost/mpi/collectives.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/utility.hpp>
+#include <climits>
 static boost::mpi::communicator gMPIComm;
 
 EXORefitSignals::EXORefitSignals()
@@ -70,27 +72,47 @@ EXORefitSignals::EXORefitSignals()
   fUseWireAPDCorrelations(true),
 #endif
   fVerbose(false),
+  fNoiseCacheBudget_MB(0),
+  fIncrementalNoiseUpdate(true),
+  fPinThreads(true),
+  fNUMALocalNoise(false),
+  fPipelinePasses(false),
+  fSolver(kBlBiCGSTAB),
+  fBlockPrecon(false),
+  fPreconPoissonDiagonal(false),
+  fRecycleSize(0),
+  fRecycleHarvests(4),
+  fFreezeConvergedColumns(false),
   fDoRestarts(100),
   fNumMulsToAccumulate(100),
+  fNoiseMulTileColumns(32),
+  fAutotuneBatchSize(false),
+  fMaxBatchMemory_MB(1024),
   fGainCorrectionFactor(1),
+  fMaxF(MAX_F),
+  fBandLimitEnergyFraction(0),
+  fNoiseOperatorClock(0),
+  fPrefetchedOperator(NULL),
+  fPrefetchPending(false),
   fLightmapFilename("data/lightmap/LightMaps.root"),
   fRThreshold(0.1),
   fSaveToPushEH(0),
   fEventHandlerQueue(0), // The default lockfree constructor is not allowed.
+  fMultipliedEvents(0),
   fEventHandlerResults(0), // http://boost.2283326.n4.nabble.com/lockfree-Faulty-static-assert-td4635029.html
-  fNumVectorsInQueue(0)
+  fFillingBuffer(0),
+  fWorkerPool(NULL),
+  fNoiseMulItems(NULL),
+  fNoiseGroupSize(1)
 {
+  fNumVectorsInQueue[0] = fNumVectorsInQueue[1] = 0;
 }
 
-void EXORefitSignals::FillNoiseCorrelations(const EXOEventData& ED)
+NoiseOperator* EXORefitSignals::GetNoiseOperator(const EXOEventData& ED)
 {
-  // Reorganize the noise matrix entries for fast use in matrix-vector multiplication.
-  // This depends on the set of available waveforms; but we assume that this set doesn't
-  // change much.  Compare to the static set in this function.
-  // Note that we don't really expect it to change within a run; but the cost of protecting
-  // against that is small.
-  // For the future, might consider whether we can rearrange EXONoiseCorrelations to be
-  // more convenient for this.
+  // Return the noise operator for this event's set of available waveforms, making it if necessary.
+  // This set doesn't change much, so usually it is already cached; but when it does change
+  // (even back and forth), events with the old and new sets can stay in flight together.
 
   // Get the channel map.
   const EXOChannelMap& ChannelMap = GetChanMapForHeader(ED.fEventHeader);
@@ -108,186 +130,358 @@ void EXORefitSignals::FillNoiseCorrelations(const EXOEventData& ED)
     ChannelsToUse.push_back(i);
   }
 
-  // If the channel mapping is unchanged, do nothing.
-  if(ChannelsToUse == fChannels) return;
+  fNoiseOperatorClock++;
+  NoiseOperatorKey key(fNoiseFilename, ChannelsToUse);
+  NoiseOperator* op = NULL;
+  NoiseOperatorMap::iterator it = fNoiseOperators.find(key);
+  if(it != fNoiseOperators.end()) op = it->second;
+
+  // Else, if the noise file just changed, we may have loaded it in the background already.
+  // Then all that's left is to swap it in.
+  if(op == NULL and (fPrefetchedOperator or fNoiseLoaderThread.joinable()) and fPrefetchKey == key) {
+    static SafeStopwatch WaitForPrefetchWatch("Waiting for noise prefetch (sequential)");
+    SafeStopwatch::tag WaitForPrefetchTag = WaitForPrefetchWatch.Start();
+    if(fNoiseLoaderThread.joinable()) fNoiseLoaderThread.join();
+    WaitForPrefetchWatch.Stop(WaitForPrefetchTag);
+    op = fPrefetchedOperator;
+    fPrefetchedOperator = NULL;
+    ReserveNoiseMulQueues(*op);
+    EvictNoiseOperators(op->GetMemoryUsage());
+    if(fNUMALocalNoise) PlaceNoiseOperator(*op);
+    op = InsertNoiseOperator(key, op);
+  }
 
   // Else, we'll need to extract the noise information to match the new ordering.
-  // Start by flushing all currently-held events, since the noise information will change.
-  FlushEvents();
+  // Usually the set has just lost (or regained) a channel, so if we still have an operator for a similar set,
+  // derive the new one from it in memory -- then only the channels it lacks need to be read.
+  if(op == NULL) {
+    const NoiseOperator* Source = NULL;
+    if(fIncrementalNoiseUpdate) {
+      size_t FewestMissing = 0;
+      for(it = fNoiseOperators.begin(); it != fNoiseOperators.end(); it++) {
+        if(it->first.first != fNoiseFilename) continue;
+        if(not it->second->fStore->CanDerive(ChannelsToUse)) continue;
+        std::vector<unsigned char> Missing;
+        std::set_difference(ChannelsToUse.begin(), ChannelsToUse.end(),
+                            it->first.second.begin(), it->first.second.end(),
+                            std::back_inserter(Missing));
+        if(Source == NULL or Missing.size() < FewestMissing) {
+          Source = it->second;
+          FewestMissing = Missing.size();
+        }
+      }
+    }
 
-  // Build a map from channel index to where it can be found in the noise file.
-  // Regardless of ENABLE_CHARGE, we assume that the noise file was constructed with u-wires and APDs.
-  std::map<size_t, size_t> ChannelIndexMap;
-  for(size_t i = 0; i < ChannelsToUse.size(); i++) {
-    unsigned char software_channel = ChannelsToUse[i];
-    if(software_channel < NCHANNEL_PER_WIREPLANE) ChannelIndexMap[i] = software_channel;
-    else if(software_channel < 3*NCHANNEL_PER_WIREPLANE) ChannelIndexMap[i] = software_channel - NCHANNEL_PER_WIREPLANE;
-    else ChannelIndexMap[i] = software_channel - 2*NCHANNEL_PER_WIREPLANE;
+    if(Source) {
+      // The source has to stay until we're done with it; then make room.
+      op = MakeNoiseOperator(fNoiseFilename, ChannelsToUse, Source);
+      ReserveNoiseMulQueues(*op);
+      EvictNoiseOperators(op->GetMemoryUsage());
+    }
+    else {
+      // Make room first; assume it'll be about as big as the operators we already have.
+      size_t BytesNeeded = 0;
+      for(it = fNoiseOperators.begin(); it != fNoiseOperators.end(); it++) {
+        BytesNeeded = std::max(BytesNeeded, it->second->GetMemoryUsage());
+      }
+      EvictNoiseOperators(BytesNeeded);
+      op = MakeNoiseOperator(fNoiseFilename, ChannelsToUse, NULL);
+      ReserveNoiseMulQueues(*op);
+    }
+    if(fNUMALocalNoise) PlaceNoiseOperator(*op);
+    op = InsertNoiseOperator(key, op);
+  }
+  op->fLastUsed = fNoiseOperatorClock;
+
+  // Now that we know which channel set is in use, we can start on a prefetch we were asked for
+  // (unless it's for the noise file we're already using).
+  if(fPrefetchPending) {
+    fPrefetchPending = false;
+    if(fPrefetchKey.first != fNoiseFilename) {
+      fPrefetchKey.second = ChannelsToUse;
+      fNoiseLoaderThread = boost::thread(&EXORefitSignals::LoadPrefetchedOperator, this);
+    }
   }
+  return op;
+}
+
+void EXORefitSignals::PrefetchNoiseFile(std::string name)
+{
+  // Only one prefetch at a time; wait out any earlier one, and drop its operator if nobody took it.
+  if(fNoiseLoaderThread.joinable()) fNoiseLoaderThread.join();
+  delete fPrefetchedOperator;
+  fPrefetchedOperator = NULL;
+
+  // We can't start until we know which channel set to load it for -- that of the next event we see.
+  fPrefetchKey.first = name;
+  fPrefetchPending = true;
+}
+
+void EXORefitSignals::LoadPrefetchedOperator()
+{
+  // Runs in fNoiseLoaderThread, while the main thread carries on.  MakeNoiseOperator only reads settings which
+  // are fixed once we're initialized (like the noise store options); anything which may change between passes,
+  // like fNumMulsToAccumulate, is left to ReserveNoiseMulQueues, on the main thread, once the operator is in use.
+  // Nobody looks at fPrefetchedOperator until after a join.
+  static SafeStopwatch LoadWatch("LoadPrefetchedOperator (background)");
+  SafeStopwatch::tag LoadTag = LoadWatch.Start();
+  fPrefetchedOperator = MakeNoiseOperator(fPrefetchKey.first, fPrefetchKey.second, NULL);
+  LoadWatch.Stop(LoadTag);
+}
+
+NoiseOperator* EXORefitSignals::MakeNoiseOperator(const std::string& NoiseFilename,
+                                                   const std::vector<unsigned char>& Channels,
+                                                   const NoiseOperator* Source)
+{
+  // Make the noise matrix entries available in an order suited to fast matrix-vector multiplication.
+  // The reordering itself is done (once per channel set) by NoiseStore, which caches it on disk;
+  // or, if we're given a Source operator, derived from Source's store in memory.
+  NoiseOperator* op = new NoiseOperator;
 
   // For convenience, pre-store useful parameters.
-  fChannels = ChannelsToUse;
-  for(size_t i = 0; i < fChannels.size(); i++) {
-    if(EXOMiscUtil::TypeOfChannel(fChannels[i]) == EXOMiscUtil::kAPDGang) {
-      fFirstAPDChannelIndex = i;
+  op->fChannels = Channels;
+  for(size_t i = 0; i < op->fChannels.size(); i++) {
+    if(EXOMiscUtil::TypeOfChannel(op->fChannels[i]) == EXOMiscUtil::kAPDGang) {
+      op->fFirstAPDChannelIndex = i;
       break;
     }
   }
-  fNoiseColumnLength = fChannels.size() * (2*(MAX_F-MIN_F) + 1);
-  size_t FileNumChannels = NUMBER_READOUT_CHANNELS - 2*NCHANNEL_PER_WIREPLANE;
-
-  // Pre-allocate memory for noise multiplication, plus a little extra (in case of multiple signals per event).
-  // We don't pre-allocate fNoiseMulResult because that won't get allocated incrementally.
-  fNoiseMulQueue.reserve(fNoiseColumnLength*(fNumMulsToAccumulate+5));
+  op->fNoiseColumnLength = op->fChannels.size() * RowsPerChannel(fMaxF);
 
-  // Then fill fNoiseCorrelations.
-  // Note that we store the same-frequency blocks in column-major order,
-  // to simplify GEMM calls (if BLAS is provided).
+  // Then map the reordered, preconditioned noise blocks for this channel set (building them if needed).
+  // In shared-memory mode, only one process per node builds them; the others attach to the same copy.
   // We also extract the diagonal entries, for the purpose of preconditioning.
-  fNoiseCorrelations.resize(MAX_F - MIN_F + 1);
-
-  std::filebuf NoiseFile;
-  fNoiseDiag.clear();
-  fNoiseDiag.reserve(fNoiseColumnLength);
-  assert(NoiseFile.open(fNoiseFilename.c_str(), std::ios_base::in | std::ios_base::binary) != NULL);
-  assert(NoiseFile.pubseekoff(0, std::ios_base::beg, std::ios_base::in) == std::streampos(0));
-  assert(NoiseFile.pubseekoff(0, std::ios_base::end, std::ios_base::in) ==
-         std::streampos(FileNumChannels*FileNumChannels*(4*1023+1)*sizeof(double)));
-  assert(sizeof(double) == 8);
-  assert(MIN_F == 1); // Else I'll need to generalize the code that produces these files.
-  for(size_t f = MIN_F; f <= MAX_F; f++) {
-    bool IsFullBlock = (f != MAX_F);
-    std::vector<double>& block = fNoiseCorrelations[f-MIN_F];
-    block.clear();
-    block.reserve(fChannels.size()*fChannels.size()*(IsFullBlock ? 4 : 1));
-
-    std::streampos FreqFilePos = (f-MIN_F)*4*sizeof(double)*FileNumChannels*FileNumChannels;
-
-    // Go ahead and fetch the entire block from the file.
-    // A few rows/columns aren't needed (suppressed or bad channels),
-    // but this prevents individual small queries which don't scale well.
-    std::vector<double> FileBlock(FileNumChannels*FileNumChannels*(IsFullBlock ? 4 : 1), 0);
-    assert(NoiseFile.pubseekpos(FreqFilePos, std::ios_base::in) == FreqFilePos);
-    if(NoiseFile.sgetn((char*)&FileBlock[0], FileBlock.size()*sizeof(double)) !=
-       FileBlock.size()*sizeof(double)) {
-      std::cout<<"sgetn failed to read out block corresponding to f = "<<f<<std::endl;
-      std::exit(1);
-    }
-
-    // Iterate through columns (real).
-    for(size_t index1 = 0; index1 < fChannels.size(); index1++) {
-      size_t NoiseFileIndex1 = ChannelIndexMap[index1];
-      size_t ColumnPos = (IsFullBlock ? 2 : 1) * FileNumChannels * NoiseFileIndex1;
-
-      // Start with the real rows.
-      for(size_t index2 = 0; index2 < fChannels.size(); index2++) {
-#ifdef ENABLE_CHARGE
-        if(not fUseWireAPDCorrelations) {
-          if(EXOMiscUtil::TypeOfChannel(fChannels[index1]) !=
-             EXOMiscUtil::TypeOfChannel(fChannels[index2])) {
-            block.push_back(0);
-            continue;
-          }
-        }
-#endif
-        size_t NoiseFileIndex2 = ChannelIndexMap[index2];
-        size_t RowPos = ColumnPos + NoiseFileIndex2;
-        block.push_back(FileBlock[RowPos]);
-        if(index1 == index2) fNoiseDiag.push_back(FileBlock[RowPos]);
-      } // Done with real rows of real column.
-
-      // Now imaginary rows.
-      if(not IsFullBlock) continue;
-      ColumnPos += FileNumChannels;
-      for(size_t index2 = 0; index2 < fChannels.size(); index2++) {
-#ifdef ENABLE_CHARGE
-        if(not fUseWireAPDCorrelations) {
-          if(EXOMiscUtil::TypeOfChannel(fChannels[index1]) !=
-             EXOMiscUtil::TypeOfChannel(fChannels[index2])) {
-            block.push_back(0);
-            continue;
-          }
-        }
-#endif
-        size_t NoiseFileIndex2 = ChannelIndexMap[index2];
-        size_t RowPos = ColumnPos + NoiseFileIndex2;
-        block.push_back(FileBlock[RowPos]);
-      } // Done with imaginary rows of real column.
-    } // Done with real columns.
-
-    // Now the imaginary columns.
-    if(not IsFullBlock) continue;
-    for(size_t index1 = 0; index1 < fChannels.size(); index1++) {
-      size_t NoiseFileIndex1 = ChannelIndexMap[index1];
-      size_t ColumnPos = 2*FileNumChannels*(FileNumChannels+NoiseFileIndex1);
-
-      // Start with the real rows.
-      for(size_t index2 = 0; index2 < fChannels.size(); index2++) {
-#ifdef ENABLE_CHARGE
-        if(not fUseWireAPDCorrelations) {
-          if(EXOMiscUtil::TypeOfChannel(fChannels[index1]) !=
-             EXOMiscUtil::TypeOfChannel(fChannels[index2])) {
-            block.push_back(0);
-            continue;
-          }
-        }
-#endif
-        size_t NoiseFileIndex2 = ChannelIndexMap[index2];
-        size_t RowPos = ColumnPos + NoiseFileIndex2;
-        block.push_back(FileBlock[RowPos]);
-      } // Done with real rows of imag column.
-
-      // Now imaginary rows.
-      if(not IsFullBlock) continue;
-      ColumnPos += FileNumChannels;
-      for(size_t index2 = 0; index2 < fChannels.size(); index2++) {
+  static SafeStopwatch NoiseStoreWatch("MakeNoiseOperator::NoiseStore (sequential)");
+  static SafeStopwatch DeriveWatch("MakeNoiseOperator::Derive (sequential)");
+  if(Source) {
+    SafeStopwatch::tag DeriveTag = DeriveWatch.Start();
+    op->fStore = new NoiseStore(*Source->fStore, NoiseFilename, op->fChannels);
+    DeriveWatch.Stop(DeriveTag);
+  }
+  else {
+    SafeStopwatch::tag NoiseStoreTag = NoiseStoreWatch.Start();
 #ifdef ENABLE_CHARGE
-        if(not fUseWireAPDCorrelations) {
-          if(EXOMiscUtil::TypeOfChannel(fChannels[index1]) !=
-             EXOMiscUtil::TypeOfChannel(fChannels[index2])) {
-            block.push_back(0);
-            continue;
-          }
-        }
+    op->fStore = new NoiseStore(NoiseFilename, op->fChannels, fUseWireAPDCorrelations, fNoiseStoreOptions);
+#else
+    op->fStore = new NoiseStore(NoiseFilename, op->fChannels, true, fNoiseStoreOptions);
 #endif
-        size_t NoiseFileIndex2 = ChannelIndexMap[index2];
-        size_t RowPos = ColumnPos + NoiseFileIndex2;
-        block.push_back(FileBlock[RowPos]);
-        if(index1 == index2) fNoiseDiag.push_back(FileBlock[RowPos]);
-      } // Done with imaginary rows of imag column.
-    } // End loop over imag columns (index1).
-  } // End loop over frequencies.
-  assert(fNoiseDiag.size() == fNoiseColumnLength);
-  NoiseFile.close();
+    NoiseStoreWatch.Stop(NoiseStoreTag);
+  }
+  if(op->fStore->GetLayout() == NoiseStore::kLowRank) {
+    double MeanRank = 0;
+    size_t FirstF = op->fStore->GetFirstOwnedFreq(), EndF = op->fStore->GetEndOwnedFreq();
+    for(size_t f = FirstF; f < EndF; f++) MeanRank += op->fStore->GetRank(f);
+    MeanRank /= std::max<size_t>(1, EndF - FirstF);
+    std::cout<<"Low-rank noise blocks keep "<<MeanRank<<" modes on average."<<std::endl;
+  }
+  if(op->fStore->GetPrecision() == NoiseStore::kSingle or
+     op->fStore->GetLayout() == NoiseStore::kLowRank or
+     op->fStore->GetLayout() == NoiseStore::kHermitian) {
+    std::cout<<"Approximate noise blocks: worst relative multiplication error is "
+             <<op->fStore->GetApproximationError()<<std::endl;
+  }
+  op->fNoiseDiag = op->fStore->GetNoiseDiag();
+  assert(op->fNoiseDiag.size() == op->fNoiseColumnLength);
 
   // Precompute useful transformations of the noise diagonal.
-  fInvSqrtNoiseDiag.resize(fNoiseDiag.size());
-  for(size_t i = 0; i < fNoiseDiag.size(); i++) fInvSqrtNoiseDiag[i] = double(1)/std::sqrt(fNoiseDiag[i]);
-
-  // Go ahead and precondition the noise matrices.  This should improve the accuracy of multiplications.
-  // So, N -> D^(-1/2) N D^(-1/2).
-  for(size_t f = MIN_F; f <= MAX_F; f++) {
-    size_t BlockSize = fChannels.size()*(f < MAX_F ? 2 : 1);
-    size_t DiagIndex = 2*fChannels.size()*(f-MIN_F);
-    for(size_t row = 0; row < BlockSize; row++) {
-      for(size_t col = 0; col < BlockSize; col++) {
-        fNoiseCorrelations[f-MIN_F][row + BlockSize*col] *= fInvSqrtNoiseDiag[DiagIndex + row];
-        fNoiseCorrelations[f-MIN_F][row + BlockSize*col] *= fInvSqrtNoiseDiag[DiagIndex + col];
-      }
+  op->fInvSqrtNoiseDiag.resize(op->fNoiseDiag.size());
+  for(size_t i = 0; i < op->fNoiseDiag.size(); i++) {
+    op->fInvSqrtNoiseDiag[i] = double(1)/std::sqrt(op->fNoiseDiag[i]);
+  }
+  return op;
+}
+
+void EXORefitSignals::ReserveNoiseMulQueues(NoiseOperator& op)
+{
+  // Pre-allocate memory for noise multiplication, plus a little extra (in case of multiple signals per event).
+  // Nothing is touched yet, so PlaceNoiseOperator can still decide where the pages go.
+  // The second buffer is only used when passes are pipelined.
+  // Only call this from the main thread (fNumMulsToAccumulate may be retuned between passes), once op is in use;
+  // a prefetched operator which never gets used shouldn't hold queue memory.
+  size_t NumBuffers = (fPipelinePasses ? 2 : 1);
+  size_t Length = op.fNoiseColumnLength*(fNumMulsToAccumulate+5);
+  for(size_t b = 0; b < NumBuffers; b++) {
+    if(op.IsSingle()) {
+      op.fNoiseMulQueueSingle[b].reserve(Length);
+      op.fNoiseMulResultSingle[b].reserve(Length);
+    }
+    else {
+      op.fNoiseMulQueue[b].reserve(Length);
+      op.fNoiseMulResult[b].reserve(Length);
     }
   }
 }
 
+template<typename T>
+static void CopyOwnRows(const WorkerPool& Pool, const NoiseOperator& op, const QueueBuffer<T>& From, QueueBuffer<T>& To)
+{
+  // Runs in each thread, for PlaceQueue:  copy this thread's rows of each vector from From to To, or just touch them
+  // if From doesn't have that vector, so that they are placed on this thread's NUMA node.
+  // (In a noise group, only the rows for our own frequencies are multiplied here, and the thread shares are of those.)
+  size_t Begin, End;
+  Pool.GetShare(op.fStore->GetEndOwnedFreq() - op.fStore->GetFirstOwnedFreq(), Begin, End);
+  if(Begin == End) return;
+  size_t FirstRow, NumRows;
+  op.GetRowsForFreqs(op.fStore->GetFirstOwnedFreq() + Begin, op.fStore->GetFirstOwnedFreq() + End, FirstRow, NumRows);
+  for(size_t Index = FirstRow; Index < To.capacity(); Index += op.fNoiseColumnLength) {
+    if(Index < From.size()) std::copy(&From[Index], &From[Index] + NumRows, &To[Index]);
+    else std::fill(&To[Index], &To[Index] + NumRows, T(0));
+  }
+}
+
+template<typename T>
+static void PlaceQueue(WorkerPool& Pool, const NoiseOperator& op, QueueBuffer<T>& Queue, size_t Capacity)
+{
+  // Move Queue into fresh memory with room for Capacity elements, keeping its contents, and with the rows which
+  // each thread multiplies first touched by that thread.  Must be called while the worker pool is idle.
+  if(Capacity == 0) return;
+  QueueBuffer<T> Fresh;
+  Fresh.reserve(Capacity);
+  Fresh.resize(Queue.size()); // Nothing is touched yet.
+  Pool.RunOnAll(boost::bind(&CopyOwnRows<T>, boost::cref(Pool), boost::cref(op),
+                            boost::cref(Queue), boost::ref(Fresh)));
+
+  // In a noise group, the rows for the other members' frequencies belong to no thread here.
+  size_t FirstRow, NumRows;
+  op.GetRowsForFreqs(op.fStore->GetFirstOwnedFreq(), op.fStore->GetEndOwnedFreq(), FirstRow, NumRows);
+  size_t EndRow = FirstRow + NumRows;
+  for(size_t Index = 0; Index < Queue.size(); Index += op.fNoiseColumnLength) {
+    std::copy(&Queue[Index], &Queue[Index] + FirstRow, &Fresh[Index]);
+    std::copy(&Queue[Index] + EndRow, &Queue[Index] + op.fNoiseColumnLength, &Fresh[Index] + EndRow);
+  }
+  Queue.swap(Fresh);
+}
+
+void EXORefitSignals::PlaceNoiseOperator(NoiseOperator& op)
+{
+  // Put op's blocks, and the rows of its queues, on the NUMA node of the thread which will multiply them
+  // (see DoNoiseMultiplication_OwnShare).  Must be called while the worker pool is idle.
+  static SafeStopwatch PlaceWatch("PlaceNoiseOperator (sequential)");
+  SafeStopwatch::tag PlaceTag = PlaceWatch.Start();
+  op.fStore->Localize(*fWorkerPool);
+
+  // Let the owner of each row of the buffers (as reserved by ReserveNoiseMulQueues) first-touch it.
+  // GrowNoiseMulQueue does the same again whenever a buffer has to grow.
+  for(size_t b = 0; b < 2; b++) {
+    PlaceQueue(*fWorkerPool, op, op.fNoiseMulQueue[b], op.fNoiseMulQueue[b].capacity());
+    PlaceQueue(*fWorkerPool, op, op.fNoiseMulResult[b], op.fNoiseMulResult[b].capacity());
+    PlaceQueue(*fWorkerPool, op, op.fNoiseMulQueueSingle[b], op.fNoiseMulQueueSingle[b].capacity());
+    PlaceQueue(*fWorkerPool, op, op.fNoiseMulResultSingle[b], op.fNoiseMulResultSingle[b].capacity());
+  }
+  PlaceWatch.Stop(PlaceTag);
+}
+
+NoiseOperator* EXORefitSignals::InsertNoiseOperator(const NoiseOperatorKey& key, NoiseOperator* op)
+{
+  // Cache op under key, and return the operator to use.
+  // Making room may have finished the events in flight, and PlanNoiseGroupPass may then have made an operator
+  // for this same key (for another member of the noise group); if so, keep that one, which may already be queued.
+  NoiseOperatorMap::iterator it = fNoiseOperators.find(key);
+  if(it == fNoiseOperators.end()) {
+    fNoiseOperators.insert(std::make_pair(key, op));
+    return op;
+  }
+  delete op;
+  return it->second;
+}
+
+size_t EXORefitSignals::GetNoiseCacheUsage() const
+{
+  size_t Total = 0;
+  NoiseOperatorMap::const_iterator it;
+  for(it = fNoiseOperators.begin(); it != fNoiseOperators.end(); it++) Total += it->second->GetMemoryUsage();
+  return Total;
+}
+
+void EXORefitSignals::EvictNoiseOperators(size_t BytesNeeded)
+{
+  // Drop least-recently-used noise operators until another BytesNeeded bytes fit in the budget.
+  // Operators which events in flight still refer to can't go; if nothing else is left to evict,
+  // finish all of the events in flight (as we always used to when the channel set changed).
+  // With no budget set, leave room for two operators (the new one and the one we're switching from).
+  size_t Budget = fNoiseCacheBudget_MB << 20;
+  if(Budget == 0) {
+    size_t Largest = BytesNeeded;
+    NoiseOperatorMap::const_iterator it;
+    for(it = fNoiseOperators.begin(); it != fNoiseOperators.end(); it++) {
+      Largest = std::max(Largest, it->second->GetMemoryUsage());
+    }
+    Budget = 2*Largest;
+  }
+  while(not fNoiseOperators.empty() and GetNoiseCacheUsage() + BytesNeeded > Budget) {
+    NoiseOperatorMap::iterator LRU = fNoiseOperators.end();
+    NoiseOperatorMap::iterator it;
+    for(it = fNoiseOperators.begin(); it != fNoiseOperators.end(); it++) {
+      if(it->second->fNumEventsInFlight != 0) continue;
+      if(LRU == fNoiseOperators.end() or it->second->fLastUsed < LRU->second->fLastUsed) LRU = it;
+    }
+    if(LRU == fNoiseOperators.end()) {
+      FinishEventsInFlight();
+      continue;
+    }
+    assert(LRU->second->fNumVectorsInQueue[0] == 0 and LRU->second->fNumVectorsInQueue[1] == 0);
+    delete LRU->second;
+    fNoiseOperators.erase(LRU);
+  }
+}
+
 int EXORefitSignals::Initialize()
 {
   // Open the lightmap file, and extract their information.
   // Create unshaped wire drift waveforms.
   // Also initialize our various timers.
 
+  // Start the threads which will share the work of each pass; they stay until we're done.
+#ifdef USE_THREADS
+  fWorkerPool = new WorkerPool(NUM_THREADS-1, fPinThreads);
+#else
+  fWorkerPool = new WorkerPool(0, false);
+#endif
+  fNoiseMulItems = new WorkStealingRanges(fWorkerPool->GetNumThreads());
+
+  // Settle the band of frequencies to refit over, before any noise operator is made.
+  ChooseBandLimit();
+
+  // In a noise group, each member keeps (and multiplies) just its own share of those frequencies,
+  // so the members had better agree on what they are.
+  if(fNoiseGroupSize > 1) {
+    if(boost::mpi::all_reduce(fNoiseGroup, fMaxF, boost::mpi::minimum<size_t>()) !=
+       boost::mpi::all_reduce(fNoiseGroup, fMaxF, boost::mpi::maximum<size_t>())) {
+      std::cout<<"Members of a noise group must all refit up to the same frequency."<<std::endl;
+      std::exit(1);
+    }
+    fNoiseStoreOptions.fShareIndex = fNoiseGroup.rank();
+    fNoiseStoreOptions.fNumShares = fNoiseGroupSize;
+    std::cout<<"Sharing noise multiplication with a group of "<<fNoiseGroupSize<<" processes, as member "
+             <<fNoiseGroup.rank()<<"."<<std::endl;
+  }
+  if(fSolver == kDirect and fNoiseGroupSize > 1) {
+    std::cout<<"The direct solver needs every noise block, so it can't be used in a noise group."<<std::endl;
+    std::exit(1);
+  }
+  if(fBlockPrecon and fNoiseGroupSize > 1) {
+    std::cout<<"The block preconditioner needs every noise block, so it can't be used in a noise group."<<std::endl;
+    std::exit(1);
+  }
+  if(fBlockPrecon and fRecycleSize > 0) {
+    std::cout<<"The block preconditioner already deflates the whole noise matrix; don't recycle with it."<<std::endl;
+    std::exit(1);
+  }
+
   // Initialize counters.
   fNumEventsHandled = 0;
   fNumSignalsHandled = 0;
   fTotalIterationsDone = 0;
+  fNoiseMulFlops = 0;
+  fNoiseMulSeconds = 0;
+
+  // And the batch-size tuner.
+  fTunePasses = 0;
+  fTuneVectors = fTuneFlops = fTuneSeconds = 0;
+  fTuneBestBatch = 0;
+  fTuneBestSecondsPerVector = fTuneBestGFLOPS = 0;
+  fTuneStep = 2;
+  fTuneDone = false;
 
   std::string FullLightmapFilename = EXOMiscUtil::SearchForFile(fLightmapFilename);
   if(FullLightmapFilename == "") {
@@ -361,6 +555,16 @@ EXORefitSignals::~EXORefitSignals()
   std::cout<<fNumEventsHandled<<" events were handled by signal refitting."<<std::endl;
   std::cout<<"Those events contained a total of "<<fNumSignalsHandled<<" signals to refit."<<std::endl;
   std::cout<<fTotalIterationsDone<<" iterations were required."<<std::endl;
+  if(fNoiseMulSeconds > 0) {
+    std::cout<<"Noise multiplication averaged "<<fNoiseMulFlops/fNoiseMulSeconds/1e9<<" GFLOP/s"
+             <<(fPipelinePasses ? " (timed with the event handling it overlaps)." : ".")<<std::endl;
+  }
+  NoiseOperatorMap::iterator it;
+  for(it = fNoiseOperators.begin(); it != fNoiseOperators.end(); it++) delete it->second;
+  if(fNoiseLoaderThread.joinable()) fNoiseLoaderThread.join();
+  delete fPrefetchedOperator;
+  delete fNoiseMulItems;
+  delete fWorkerPool;
 }
 
 EXOWaveformFT EXORefitSignals::GetModelForTime(double time) const
@@ -539,17 +743,54 @@ std::vector<double> EXORefitSignals::MakeWireModel(EXODoubleWaveform& in,
 
   EXOWaveformFT fwf;
   EXOFastFourierTransformFFTW::GetFFT(2048).PerformFFT(wf, fwf);
+  return GetRealImagInBand(fwf);
+}
+#endif
 
-  std::vector<double> out;
-  out.resize(2*1024-1);
-  for(size_t f = 1; f <= 1024; f++) {
-    out[2*(f-1)] = fwf[f].real();
-    if(f != 1024) out[2*(f-1)+1] = fwf[f].imag();
+std::vector<double> EXORefitSignals::GetRealImagInBand(const EXOWaveformFT& fwf) const
+{
+  // Alternate between real and imaginary parts, mimicking the variable ordering we use throughout.
+  // Keep only f = MIN_F...fMaxF:  so drop the zero-frequency component (which isn't used),
+  // and the imaginary component at MAX_F (identically zero).
+  assert(fwf.GetLength() == MAX_F + 1);
+  std::vector<double> out(RowsPerChannel(fMaxF));
+  for(size_t f = MIN_F; f <= fMaxF; f++) {
+    out[2*(f-MIN_F)] = fwf[f].real();
+    if(f != MAX_F) out[2*(f-MIN_F)+1] = fwf[f].imag();
   }
-
   return out;
 }
-#endif
+
+void EXORefitSignals::ChooseBandLimit()
+{
+  // The shaped light model has almost no power at high frequencies, so we can leave those out of the refit:
+  // columns get shorter, and the noise stores (and their multiplication) lose those blocks.
+  // With fBandLimitEnergyFraction, take the lowest fMaxF for which the model loses at most that fraction
+  // of its spectral energy (summed over the real and imaginary parts we solve for).
+  // Either way, report what is lost, and what that should cost in resolution.
+  // (The light model is all we look at; with wire signals, it may be wiser to set fMaxF by hand.)
+  EXOWaveformFT modelFT = GetModelForTime(1024*CLHEP::microsecond); // Mid-trace, like a typical trigger.
+  std::vector<double> EnergyFrom(MAX_F + 2, 0); // EnergyFrom[f]:  spectral energy at frequencies f...MAX_F.
+  for(size_t f = MAX_F + 1; f > MIN_F; f--) EnergyFrom[f-1] = EnergyFrom[f] + std::norm(modelFT[f-1]);
+  double TotalEnergy = EnergyFrom[MIN_F];
+  if(fBandLimitEnergyFraction > 0) {
+    fMaxF = MAX_F;
+    while(fMaxF > MIN_F and EnergyFrom[fMaxF] <= fBandLimitEnergyFraction*TotalEnergy) fMaxF--;
+  }
+  if(fMaxF < MIN_F or fMaxF > MAX_F) {
+    std::cout<<"MaxFrequency must be in "<<MIN_F<<"..."<<MAX_F<<std::endl;
+    std::exit(1);
+  }
+  fNoiseStoreOptions.fMaxF = fMaxF;
+  if(fMaxF == MAX_F) return;
+
+  // A denoised energy is a fit of the model's amplitude, whose variance goes inversely with the model's
+  // (noise-weighted) energy.  Taking the noise to be white across the band, that's the change to expect.
+  double LostFraction = EnergyFrom[fMaxF+1]/TotalEnergy;
+  std::cout<<"Refitting over f = "<<MIN_F<<"..."<<fMaxF<<" of "<<MAX_F<<"; the light model loses "
+           <<LostFraction<<" of its spectral energy, so denoised energies should be about "
+           <<100*(1/std::sqrt(1 - LostFraction) - 1)<<"% noisier (for white noise)."<<std::endl;
+}
 
 void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
 {
@@ -564,7 +805,9 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
   event->fNumIterations = 0;
   event->fNumIterSinceReset = 0;
   event->fNumSignals = 0;
-  event->fChannels = fChannels;
+  event->fNoiseOperator = NULL;
+  event->fUseRecycled = false;
+  event->fHarvestRecycled = false;
   event->fStatusCode = -2;
 
   // If we don't have previously-established scintillation times, we can't do anything -- skip.
@@ -583,8 +826,15 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
     return;
   }
 
-  // If necessary, extract the noise correlations object with a proper ordering.
-  FillNoiseCorrelations(*ED);
+  // Get the noise correlations object with a proper ordering (extracting it, if necessary).
+  // From here on, the event holds a reference to it until it is sent off.
+  NoiseOperator* op = GetNoiseOperator(*ED);
+  op->fNumEventsInFlight++;
+  event->fNoiseOperator = op;
+  event->fUseRecycled = op->fRecycleReady and op->GetNumRecycled() > 0;
+  event->fNoiseBuffer = fFillingBuffer; // Its requests join the ones waiting for the next pass.
+  event->fChannels = op->fChannels;
+  event->fNoiseColumnLength = op->fNoiseColumnLength;
 
   // Save the unix time of the event (as a double, since ROOT will convert it anyway).
   event->fUnixTimeOfEvent = double(ED->fEventHeader.fTriggerSeconds);
@@ -616,15 +866,15 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
     // ExpectedYieldPerGang will be the expected peak-baseline (ADC counts) of a 2615 keV event.
     std::map<unsigned char, double> ExpectedYieldPerGang;
     event->fExpectedEnergy_keV = 0;
-    for(size_t i = fFirstAPDChannelIndex; i < fChannels.size(); i++) {
+    for(size_t i = op->fFirstAPDChannelIndex; i < op->fChannels.size(); i++) {
       ExpectedYieldPerGang[i] = 0;
-      event->fAPDGainMapEval[fChannels[i]] = fGainMaps[fChannels[i]]->Eval(event->fUnixTimeOfEvent);
+      event->fAPDGainMapEval[op->fChannels[i]] = fGainMaps[op->fChannels[i]]->Eval(event->fUnixTimeOfEvent);
     }
     for(size_t i = 0; i < FullClusters.size(); i++) {
       EXOChargeCluster* clu = FullClusters[i];
       event->fExpectedEnergy_keV += clu->fPurityCorrectedEnergy;
-      for(size_t j = fFirstAPDChannelIndex; j < fChannels.size(); j++) {
-        unsigned char gang = fChannels[j];
+      for(size_t j = op->fFirstAPDChannelIndex; j < op->fChannels.size(); j++) {
+        unsigned char gang = op->fChannels[j];
         Double_t GainFuncVal = event->fAPDGainMapEval[gang];
 
         // Make sure cluster is in the proper range for interpolation -- else return 0.
@@ -647,7 +897,7 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
     }
     // We just want to weight the clusters appropriately when we guess where light should be collected.
     // Divide out to ensure that at the end, a result of 1 corresponds to a 2615 keV event (roughly).
-    for(size_t i = fFirstAPDChannelIndex; i < fChannels.size(); i++) {
+    for(size_t i = op->fFirstAPDChannelIndex; i < op->fChannels.size(); i++) {
       ExpectedYieldPerGang[i] /= event->fExpectedEnergy_keV;
     }
 
@@ -655,7 +905,7 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
     // So, instead drop such events.
     // (Specifically, if a 2615 keV event would produce less than 1ADC on every gang, drop it.)
     bool HasYield = false;
-    for(size_t i = fFirstAPDChannelIndex; i < fChannels.size(); i++) {
+    for(size_t i = op->fFirstAPDChannelIndex; i < op->fChannels.size(); i++) {
       if(ExpectedYieldPerGang[i] > 1) HasYield = true;
     }
     if(not HasYield) {
@@ -666,18 +916,10 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
     }
 
     // Generate the expected light signal shape (normalized), given the time of the scintillation.
-    // Alternate between real and imaginary parts, mimicking the variable ordering we use throughout.
-    // Also drop the zero-frequency component (which isn't used)
-    // and the last imaginary component (which is identically zero).
-    EXOWaveformFT modelFT = GetModelForTime(scint->fTime);
-    std::vector<double> model_realimag(2*modelFT.GetLength() - 3);
-    for(size_t i = 1; i < modelFT.GetLength(); i++) {
-      model_realimag[2*i - 2] = modelFT[i].real();
-      if(i != modelFT.GetLength()-1) model_realimag[2*i - 1] = modelFT[i].imag();
-    }
+    std::vector<double> model_realimag = GetRealImagInBand(GetModelForTime(scint->fTime));
 
     // Compute the expected signals, and load them into event.
-    ModelManager modelManager(fNoiseColumnLength, fChannels.size());
+    ModelManager modelManager(op->fNoiseColumnLength, op->fChannels.size());
     modelManager.fSignalNumber = iscint;
     for(std::map<unsigned char, double>::iterator it = ExpectedYieldPerGang.begin();
         it != ExpectedYieldPerGang.end();
@@ -688,7 +930,7 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
       for(size_t j = 0; j < model_realimag.size(); j++) model.push_back(it->second * model_realimag[j]);
       modelManager.AddChannelHit(ChannelIndex, model);
     }
-    modelManager.Finalize(fInvSqrtNoiseDiag);
+    modelManager.Finalize(op->fInvSqrtNoiseDiag);
     modelManager.fExpectedYieldPerGang = ExpectedYieldPerGang;
     event->fAPDModel.push_back(modelManager);
     event->fNumSignals += 1;
@@ -740,7 +982,7 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
       EXOUWireSignal* sig = ED->GetUWireSignal(*sigIt);
       unsigned char channelIndex;
 
-      ModelManager modelManager(fNoiseColumnLength, fChannels.size());
+      ModelManager modelManager(op->fNoiseColumnLength, op->fChannels.size());
       //std::map<unsigned char, std::vector<double> >& ModelForThisSignal = modelManager.fModelMap;
 
       // Deposit channel.
@@ -748,7 +990,7 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
         electronicsShapers->GetTransferFunctionForChannel(sig->fChannel);
       double Gain = transferDep.GetGain();
       double DepChanGain = GainsFromDatabase->GetGainOnChannel(sig->fChannel);
-      channelIndex = *std::find(fChannels.begin(), fChannels.end(), sig->fChannel);
+      channelIndex = *std::find(op->fChannels.begin(), op->fChannels.end(), sig->fChannel);
       modelManager.AddChannelHit(channelIndex, MakeWireModel(fWireDeposit,
                                                              transferDep,
                                                              Gain,
@@ -758,7 +1000,7 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
         const EXOTransferFunction& transferInd =
           electronicsShapers->GetTransferFunctionForChannel(sig->fChannel-1);
         double ThisChanGain = Gain * GainsFromDatabase->GetGainOnChannel(sig->fChannel-1)/DepChanGain;
-        channelIndex = *std::find(fChannels.begin(), fChannels.end(), sig->fChannel-1);
+        channelIndex = *std::find(op->fChannels.begin(), op->fChannels.end(), sig->fChannel-1);
         modelManager.AddChannelHit(channelIndex, MakeWireModel(fWireInduction,
                                                                transferInd,
                                                                ThisChanGain,
@@ -769,7 +1011,7 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
         const EXOTransferFunction& transferInd =
           electronicsShapers->GetTransferFunctionForChannel(sig->fChannel+1);
         double ThisChanGain = Gain * GainsFromDatabase->GetGainOnChannel(sig->fChannel+1)/DepChanGain;
-        channelIndex = *std::find(fChannels.begin(), fChannels.end(), sig->fChannel+1);
+        channelIndex = *std::find(op->fChannels.begin(), op->fChannels.end(), sig->fChannel+1);
         modelManager.AddChannelHit(channelIndex, MakeWireModel(fWireInduction,
                                                                transferInd,
                                                                ThisChanGain,
@@ -777,7 +1019,7 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
       }
 
       modelManager.fSignalNumber = *sigIt;
-      modelManager.Finalize(fInvSqrtNoiseDiag);
+      modelManager.Finalize(op->fInvSqrtNoiseDiag);
       event->fWireModel.push_back(modelManager);
     } // End loop over u-wire signals.
   } // (which we only did if we're handling wire signals.
@@ -785,7 +1027,10 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
 #endif
 
   // For convenience, store the column length we'll be dealing with.
-  event->fColumnLength = 2*fChannels.size()*(MAX_F-MIN_F) + fChannels.size() + event->fNumSignals;
+  event->fColumnLength = op->fNoiseColumnLength + event->fNumSignals;
+  event->fNumColumns = event->fNumSignals; // Every column is in play to start with.
+  event->fColumnSignals.resize(event->fNumSignals);
+  for(size_t i = 0; i < event->fNumSignals; i++) event->fColumnSignals[i] = i;
 
   // Also for convenience, make a vector which maintains the relative ordering of APD and wire models.
   for(size_t i = 0; i < event->fAPDModel.size(); i++) event->fModels.push_back(&event->fAPDModel.at(i));
@@ -800,20 +1045,34 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
   // Poisson noise terms.
   // Haven't decided yet whether it's important to include Poisson terms on the diagonal; currently I don't.
   // Find X using trans(X)X = trans(L) D^(-1) L.
+  // With fBlockPrecon, D is instead the whole noise matrix; with recycling, the diagonal corrected in the recycled
+  // directions; and with fPreconPoissonDiagonal, the diagonal of the Poisson terms is added.
+  // Then D = C trans(C); see DoNoiseFactorMul.
+  PrepareNoiseBlocks(*op); // Nothing to do unless this operator is new, and we need its whole blocks.
   std::vector<double> Temp1(event->fColumnLength*event->fNumSignals, 0);
   std::vector<double> Temp2(event->fColumnLength*event->fNumSignals, 0);
   for(size_t i = 0; i < event->fNumSignals; i++) {
-    Temp1[i*event->fColumnLength + fNoiseColumnLength + i] = 1;
+    Temp1[i*event->fColumnLength + op->fNoiseColumnLength + i] = 1;
   } // Temp1 = {{0}{I}}
   DoLagrangeAndConstraintMul<'L', true>(Temp1, Temp2, *event); // Temp2 = {{D^(-1/2)L} {0}}
   Temp1.assign(event->fColumnLength*event->fNumSignals, 0);
-  DoLagrangeAndConstraintMul<'C', true>(Temp2, Temp1, *event); // Temp1 = {{0} {trans(L)D^(-1)L}}
+  if(HasNoiseFactor()) {
+    if(fPreconPoissonDiagonal) SetPoissonDiagonal(*event);
+    DoNoiseFactorMul(Temp2, *event, false, true); // Temp2 = {{C_inv D^(-1/2)L} {0}}
+    LinAlg::gemm('T', 'N',
+                 event->fNumSignals, event->fNumSignals, op->fNoiseColumnLength,
+                 1, &Temp2[0], event->fColumnLength, &Temp2[0], event->fColumnLength,
+                 0, &Temp1[op->fNoiseColumnLength], event->fColumnLength); // Temp1 = {{0} {trans(L)D^(-1)L}}
+    event->fPreconG.swap(Temp2);
+  }
+  else {
+    DoLagrangeAndConstraintMul<'C', true>(Temp2, Temp1, *event); // Temp1 = {{0} {trans(L)D^(-1)L}}
+  }
   // Here I could produce a packed version; but I don't think the performance boost will be significant.
   // Remember X is a small matrix.
   // Produce the Cholesky decomposition, and store it in event->fPreconX.
   lapack_int ret;
-  ret = LAPACKE_dpotrf(LAPACK_COL_MAJOR, 'U', event->fNumSignals,
-                       &Temp1[fNoiseColumnLength], event->fColumnLength);
+  ret = LinAlg::potrf('U', event->fNumSignals, &Temp1[op->fNoiseColumnLength], event->fColumnLength);
   if(ret != 0) {
     std::cout<<"Factorization to find H failed on entry "<<event->fEntryNumber<<
                " with ret = "<<ret<<std::endl;
@@ -823,26 +1082,41 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
   for(size_t i = 0; i < event->fNumSignals; i++) {
     for(size_t j = 0; j <= i; j++) {
       event->fPreconX[i*event->fNumSignals + j] =
-        Temp1[i*event->fColumnLength + fNoiseColumnLength + j];
+        Temp1[i*event->fColumnLength + op->fNoiseColumnLength + j];
     }
   }
 
-  // Give a really nice initial guess for X, obtained by solving exactly
-  // with the approximate version of the matrix used for preconditioning.
-  // Since the RHS only has non-zero entries in the lower square, simplifications are used.
-  event->fX.assign(event->fColumnLength*event->fNumSignals, 0);
-  for(size_t i = 0; i < event->fNumSignals; i++) {
-    size_t Index = (i+1)*event->fColumnLength; // Next column; then subtract.
-    Index -= event->fNumSignals; // Step backward.
-    Index += i; // Go forward to the right entry.
-    event->fX[Index] = 1; // All models are normalized to 1.
+  if(fSolver == kDirect) {
+    // There's nothing to multiply; the event is just solved during the next pass, with the others in its batch.
+    // Its signals still count toward the batch, so that events are solved in parallel.
+    fNumVectorsInQueue[fFillingBuffer] += event->fNumSignals;
   }
-  DoInvLPrecon(event->fX, *event);
-  event->fprecon_tmp = event->fX;
-  DoInvRPrecon(event->fprecon_tmp, *event); // Beginning of multiplying by matrix.
+  else {
+    // Give a really nice initial guess for X, obtained by solving exactly
+    // with the approximate version of the matrix used for preconditioning.
+    // Since the RHS only has non-zero entries in the lower square, simplifications are used.
+    event->fX.assign(event->fColumnLength*event->fNumSignals, 0);
+    for(size_t i = 0; i < event->fNumSignals; i++) {
+      size_t Index = (i+1)*event->fColumnLength; // Next column; then subtract.
+      Index -= event->fNumSignals; // Step backward.
+      Index += i; // Go forward to the right entry.
+      event->fX[Index] = 1; // All models are normalized to 1.
+    }
+    DoInvLPrecon(event->fX, *event);
+    event->fprecon_tmp = event->fX;
+    DoInvRPrecon(event->fprecon_tmp, *event); // Beginning of multiplying by matrix.
+
+    // Only now is the event sure to iterate, so only now may it be one of the first few to harvest directions.
+    if(fRecycleSize > 0 and op->fNumRecycleHarvesters < fRecycleHarvests) {
+      event->fHarvestRecycled = true;
+      op->fNumRecycleHarvesters++;
+    }
 
-  // Request a matrix multiplication of X.
-  event->fResultIndex = RequestNoiseMul(event->fprecon_tmp, event->fColumnLength);
+    // Request a matrix multiplication of X.
+    // Events can only make room in their buffer here; from now on, they reuse the room they've got.
+    GrowNoiseMulQueue(*event);
+    RequestNoiseMul(event->fprecon_tmp, *event);
+  }
   fNumEventsHandled++; // One more event that will be actually handled.
   fNumSignalsHandled += event->fNumSignals;
 
@@ -854,6 +1128,8 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
   // Since fEventHandlerQueue's size *must* be <= fNumMulsToAccumulate (with equality only
   // possible when events have just one signal, eg light-only denoising),
   // we can reserve fNumMulsToAccumulate entries and be safe.
+  // (With pipelined passes, the events handled in one pass are the ones which filled the other buffer,
+  // so the same bound holds.)
   // If we ever violate this reasoning, an assertion will fail.
   assert(fEventHandlerResults.empty());
   fEventHandlerResults.reserve_unsafe(fNumMulsToAccumulate);
@@ -861,14 +1137,17 @@ void EXORefitSignals::AcceptEvent(EXOEventData* ED, Long64_t entryNum)
   BeginAcceptEventWatch.Stop(BeginAcceptEventTag);
 
   // Now, while there are enough requests in the queue, satisfy those requests.
-  while(fNumVectorsInQueue >= fNumMulsToAccumulate) DoPassThroughEvents();
+  while(fNumVectorsInQueue[fFillingBuffer] >= fNumMulsToAccumulate) DoPassThroughEvents();
 }
 
 void EXORefitSignals::FlushEvents()
 {
   // Finish processing for all events in the event handler list,
   // regardless of how many pending multiplication requests are queued.
-  while(not fEventHandlerQueue.empty()) DoPassThroughEvents();
+  FinishEventsInFlight();
+
+  // In a noise group, the others may still have events of their own, and need us for their passes.
+  while(DoPassThroughEvents()) {}
 
   // Don't return until asynchronous sends have also completed.
   while(not fPendingSends.empty()) {
@@ -879,6 +1158,46 @@ void EXORefitSignals::FlushEvents()
   }
 }
 
+void EXORefitSignals::FinishEventsInFlight()
+{
+  // Do passes until every event we've accepted is done.
+  while(not fEventHandlerQueue.empty() or not fMultipliedEvents.empty()) DoPassThroughEvents();
+}
+
+bool EXORefitSignals::DoSolverStep(EventHandler& event)
+{
+  // Every solver has the same contract:  it's called once at the start (after the multiplication of the
+  // initial guess requested by AcceptEvent, except for the direct solver), and again after each
+  // multiplication it requests.  The solver's state lives in the EventHandler, so events are independent.
+  bool Result = false;
+  if(event.fHarvestRecycled) HarvestRecycleVectors(event);
+  switch(fSolver) {
+    case kBlBiCGSTAB: {
+      static SafeStopwatch DoBlBiCGSTABWatch("DoBlBiCGSTAB (threaded)");
+      SafeStopwatch::tag DoBlBiCGSTABTag = DoBlBiCGSTABWatch.Start();
+      Result = DoBlBiCGSTAB(event);
+      DoBlBiCGSTABWatch.Stop(DoBlBiCGSTABTag);
+      break;
+    }
+    case kBlMINRES: {
+      static SafeStopwatch DoBlMINRESWatch("DoBlMINRES (threaded)");
+      SafeStopwatch::tag DoBlMINRESTag = DoBlMINRESWatch.Start();
+      Result = DoBlMINRES(event);
+      DoBlMINRESWatch.Stop(DoBlMINRESTag);
+      break;
+    }
+    case kDirect: {
+      static SafeStopwatch DoDirectSolveWatch("DoDirectSolve (threaded)");
+      SafeStopwatch::tag DoDirectSolveTag = DoDirectSolveWatch.Start();
+      Result = DoDirectSolve(event);
+      DoDirectSolveWatch.Stop(DoDirectSolveTag);
+      break;
+    }
+  }
+  if(Result) RestoreFrozenColumns(event);
+  return Result;
+}
+
 bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
 {
   // Pick up wherever we left off.
@@ -907,7 +1226,7 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
 
     // Start by copying result into R.
     SafeStopwatch::tag FillFromNoiseTag = FillFromNoiseWatch.Start();
-    FillFromNoise(event.fR, event.fNumSignals, event.fColumnLength, event.fResultIndex);
+    FillFromNoise(event.fR, event);
     FillFromNoiseWatch.Stop(FillFromNoiseTag);
 
     // Now need to finish multiplying by A, accounting for the other terms.
@@ -917,8 +1236,8 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
 
     // Now, R <-- B - R = B - AX.
     for(size_t i = 0; i < event.fR.size(); i++) event.fR[i] = -event.fR[i];
-    for(size_t i = 0; i < event.fNumSignals; i++) {
-      event.fR[i*event.fColumnLength + fNoiseColumnLength + i] += 1;
+    for(size_t i = 0; i < event.fNumColumns; i++) {
+      event.fR[i*event.fColumnLength + event.fNoiseColumnLength + event.fColumnSignals[i]] += 1;
     }
 
     // Now precondition R appropriately.
@@ -937,6 +1256,9 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
       }
     }
 
+    // Drop any columns which have converged already; nothing else has been built from R yet.
+    FreezeConvergedColumns(event);
+
     // Set up other pieces of the handler.
     event.fP = event.fR;
     event.fR0hat = event.fR;
@@ -950,7 +1272,7 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
 
     // Now we want V <- AP, so request a multiplication by P.
     SafeStopwatch::tag RequestNoiseMulTag = RequestNoiseMulWatch.Start();
-    event.fResultIndex = RequestNoiseMul(event.fprecon_tmp, event.fColumnLength);
+    RequestNoiseMul(event.fprecon_tmp, event);
     RequestNoiseMulWatch.Stop(RequestNoiseMulTag);
     return false;
   }
@@ -958,7 +1280,7 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
     // At the beginning of the iteration, we just computed V = AP.
     fTotalIterationsDone++;
     SafeStopwatch::tag FillFromNoiseTag = FillFromNoiseWatch.Start();
-    FillFromNoise(event.fV, event.fNumSignals, event.fColumnLength, event.fResultIndex);
+    FillFromNoise(event.fV, event);
     FillFromNoiseWatch.Stop(FillFromNoiseTag);
 
     // Now need to finish multiplying by A, accounting for the other terms.
@@ -970,35 +1292,35 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
     DoPreconWatch.Stop(DoPreconTag);
 
     // Factorize fR0hat*V, so that we can solve equations using it twice.
-    event.fR0hat_V_factors.assign(event.fNumSignals*event.fNumSignals, 0);
+    event.fR0hat_V_factors.assign(event.fNumColumns*event.fNumColumns, 0);
     SafeStopwatch::tag MulSkinnySkinnyTag = MulSkinnySkinnyWatch.Start();
-    cblas_dgemm(CblasColMajor, CblasTrans, CblasNoTrans,
-                event.fNumSignals, event.fNumSignals, event.fColumnLength,
-                1, &event.fR0hat[0], event.fColumnLength, &event.fV[0], event.fColumnLength,
-                0, &event.fR0hat_V_factors[0], event.fNumSignals);
+    LinAlg::gemm('T', 'N',
+                 event.fNumColumns, event.fNumColumns, event.fColumnLength,
+                 1, &event.fR0hat[0], event.fColumnLength, &event.fV[0], event.fColumnLength,
+                 0, &event.fR0hat_V_factors[0], event.fNumColumns);
     MulSkinnySkinnyWatch.Stop(MulSkinnySkinnyTag);
-    event.fR0hat_V_pivot.resize(event.fNumSignals);
-    ret = LAPACKE_dgetrf(LAPACK_COL_MAJOR, event.fNumSignals, event.fNumSignals,
-                         &event.fR0hat_V_factors[0], event.fNumSignals,
-                         &event.fR0hat_V_pivot[0]);
+    event.fR0hat_V_pivot.resize(event.fNumColumns);
+    ret = LinAlg::getrf(event.fNumColumns, event.fNumColumns,
+                        &event.fR0hat_V_factors[0], event.fNumColumns,
+                        &event.fR0hat_V_pivot[0]);
     if(ret != 0) {
       std::cout<<"Factorization of fR0hat.V failed on entry "<<event.fEntryNumber<<
                  " with ret = "<<ret<<std::endl;
       std::exit(1);
     }
     // Now compute alpha.
-    event.fAlpha.assign(event.fNumSignals*event.fNumSignals, 0);
+    event.fAlpha.assign(event.fNumColumns*event.fNumColumns, 0);
     MulSkinnySkinnyTag = MulSkinnySkinnyWatch.Start();
-    cblas_dgemm(CblasColMajor, CblasTrans, CblasNoTrans,
-                event.fNumSignals, event.fNumSignals, event.fColumnLength,
-                1, &event.fR0hat[0], event.fColumnLength, &event.fR[0], event.fColumnLength,
-                0, &event.fAlpha[0], event.fNumSignals);
+    LinAlg::gemm('T', 'N',
+                 event.fNumColumns, event.fNumColumns, event.fColumnLength,
+                 1, &event.fR0hat[0], event.fColumnLength, &event.fR[0], event.fColumnLength,
+                 0, &event.fAlpha[0], event.fNumColumns);
     MulSkinnySkinnyWatch.Stop(MulSkinnySkinnyTag);
-    ret = LAPACKE_dgetrs(LAPACK_COL_MAJOR, 'N',
-                         event.fNumSignals, event.fNumSignals,
-                         &event.fR0hat_V_factors[0], event.fNumSignals,
-                         &event.fR0hat_V_pivot[0],
-                         &event.fAlpha[0], event.fNumSignals);
+    ret = LinAlg::getrs('N',
+                        event.fNumColumns, event.fNumColumns,
+                        &event.fR0hat_V_factors[0], event.fNumColumns,
+                        &event.fR0hat_V_pivot[0],
+                        &event.fAlpha[0], event.fNumColumns);
     if(ret != 0) {
       std::cout<<"Solving for alpha failed on entry "<<event.fEntryNumber<<
                  " with ret = "<<ret<<std::endl;
@@ -1006,10 +1328,10 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
     }
     // Update R <-- R - V*alpha.
     SafeStopwatch::tag MulSkinnySmallTag = MulSkinnySmallWatch.Start();
-    cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
-                event.fColumnLength, event.fNumSignals, event.fNumSignals,
-                -1, &event.fV[0], event.fColumnLength, &event.fAlpha[0], event.fNumSignals,
-                1, &event.fR[0], event.fColumnLength);
+    LinAlg::gemm('N', 'N',
+                 event.fColumnLength, event.fNumColumns, event.fNumColumns,
+                 -1, &event.fV[0], event.fColumnLength, &event.fAlpha[0], event.fNumColumns,
+                 1, &event.fR[0], event.fColumnLength);
     MulSkinnySmallWatch.Stop(MulSkinnySmallTag);
     // Now we desire T = AR (AS in paper).  Request a matrix multiplication, and return.
     // Remember to apply preconditioner here too.
@@ -1019,7 +1341,7 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
     DoPreconWatch.Stop(DoPreconTag);
 
     SafeStopwatch::tag RequestNoiseMulTag = RequestNoiseMulWatch.Start();
-    event.fResultIndex = RequestNoiseMul(event.fprecon_tmp, event.fColumnLength);
+    RequestNoiseMul(event.fprecon_tmp, event);
     RequestNoiseMulWatch.Stop(RequestNoiseMulTag);
     return false;
   }
@@ -1027,7 +1349,7 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
     // We're in the second half of the iteration, where T was just computed.
     std::vector<double> T;
     SafeStopwatch::tag FillFromNoiseTag = FillFromNoiseWatch.Start();
-    FillFromNoise(T, event.fNumSignals, event.fColumnLength, event.fResultIndex);
+    FillFromNoise(T, event);
     FillFromNoiseWatch.Stop(FillFromNoiseTag);
 
     // Now need to finish multiplying by A, accounting for the other terms.
@@ -1052,10 +1374,10 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
 
     // Modify X and R.
     SafeStopwatch::tag MulSkinnySmallTag = MulSkinnySmallWatch.Start();
-    cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
-                event.fColumnLength, event.fNumSignals, event.fNumSignals,
-                1, &event.fP[0], event.fColumnLength, &event.fAlpha[0], event.fNumSignals,
-                1, &event.fX[0], event.fColumnLength);
+    LinAlg::gemm('N', 'N',
+                 event.fColumnLength, event.fNumColumns, event.fNumColumns,
+                 1, &event.fP[0], event.fColumnLength, &event.fAlpha[0], event.fNumColumns,
+                 1, &event.fX[0], event.fColumnLength);
     MulSkinnySmallWatch.Stop(MulSkinnySmallTag);
     for(size_t i = 0; i < event.fX.size(); i++) {
       // Do both together -- reduces the number of calls to memory.
@@ -1068,6 +1390,13 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
       SafeStopwatch::tag CanTerminateTag = CanTerminateWatch.Start();
       bool CanTerminateRet = CanTerminate(event);
       CanTerminateWatch.Stop(CanTerminateTag);
+      if(CanTerminateRet and event.fNoiseOperator->fStore->GetPrecision() == NoiseStore::kSingle) {
+        // With single-precision noise, R has drifted from B - AX by rounding in every iteration.
+        // So, don't trust it; restart, which recomputes R from X and only terminates if that one passes.
+        // X itself is accumulated in double precision, so this is iterative refinement.
+        DoRestart(event, true);
+        return false;
+      }
       if(CanTerminateRet) {
         event.fStatusCode = 0;
         return true;
@@ -1089,35 +1418,43 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
       }
     }
 
-    // Now compute beta, solving R0hat_V beta = -R0hat_T
-    std::vector<double> Beta(event.fNumSignals*event.fNumSignals, 0);
-    SafeStopwatch::tag MulSkinnySkinnyTag = MulSkinnySkinnyWatch.Start();
-    cblas_dgemm(CblasColMajor, CblasTrans, CblasNoTrans,
-                event.fNumSignals, event.fNumSignals, event.fColumnLength,
-                -1, &event.fR0hat[0], event.fColumnLength, &T[0], event.fColumnLength,
-                0, &Beta[0], event.fNumSignals);
-    MulSkinnySkinnyWatch.Stop(MulSkinnySkinnyTag);
-    ret = LAPACKE_dgetrs(LAPACK_COL_MAJOR, 'N',
-                         event.fNumSignals, event.fNumSignals,
-                         &event.fR0hat_V_factors[0], event.fNumSignals,
-                         &event.fR0hat_V_pivot[0],
-                         &Beta[0], event.fNumSignals);
-    if(ret != 0) {
-      std::cout<<"Solving for beta failed on entry "<<event.fEntryNumber<<
-                 " with ret = "<<ret<<std::endl;
-      std::exit(1);
+    // If some columns have converged, drop them, and carry on with the rest from their residuals, as in setup.
+    // (Not with single-precision noise, where R can't be trusted until a restart has recomputed it.)
+    if(event.fNoiseOperator->fStore->GetPrecision() != NoiseStore::kSingle and FreezeConvergedColumns(event)) {
+      event.fP = event.fR;
+      event.fR0hat = event.fR;
     }
+    else {
+      // Now compute beta, solving R0hat_V beta = -R0hat_T
+      std::vector<double> Beta(event.fNumColumns*event.fNumColumns, 0);
+      SafeStopwatch::tag MulSkinnySkinnyTag = MulSkinnySkinnyWatch.Start();
+      LinAlg::gemm('T', 'N',
+                   event.fNumColumns, event.fNumColumns, event.fColumnLength,
+                   -1, &event.fR0hat[0], event.fColumnLength, &T[0], event.fColumnLength,
+                   0, &Beta[0], event.fNumColumns);
+      MulSkinnySkinnyWatch.Stop(MulSkinnySkinnyTag);
+      ret = LinAlg::getrs('N',
+                          event.fNumColumns, event.fNumColumns,
+                          &event.fR0hat_V_factors[0], event.fNumColumns,
+                          &event.fR0hat_V_pivot[0],
+                          &Beta[0], event.fNumColumns);
+      if(ret != 0) {
+        std::cout<<"Solving for beta failed on entry "<<event.fEntryNumber<<
+                   " with ret = "<<ret<<std::endl;
+        std::exit(1);
+      }
 
-    // Update P.  Overwrite T for temporary work.
-    T = event.fR;
-    for(size_t i = 0; i < event.fP.size(); i++) event.fP[i] -= omega*event.fV[i];
-    MulSkinnySmallTag = MulSkinnySmallWatch.Start();
-    cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
-                event.fColumnLength, event.fNumSignals, event.fNumSignals,
-                1, &event.fP[0], event.fColumnLength, &Beta[0], event.fNumSignals,
-                1, &T[0], event.fColumnLength);
-    MulSkinnySmallWatch.Stop(MulSkinnySmallTag);
-    std::swap(T, event.fP);
+      // Update P.  Overwrite T for temporary work.
+      T = event.fR;
+      for(size_t i = 0; i < event.fP.size(); i++) event.fP[i] -= omega*event.fV[i];
+      MulSkinnySmallTag = MulSkinnySmallWatch.Start();
+      LinAlg::gemm('N', 'N',
+                   event.fColumnLength, event.fNumColumns, event.fNumColumns,
+                   1, &event.fP[0], event.fColumnLength, &Beta[0], event.fNumColumns,
+                   1, &T[0], event.fColumnLength);
+      MulSkinnySmallWatch.Stop(MulSkinnySmallTag);
+      std::swap(T, event.fP);
+    }
 
     // Clear vectors in event which are no longer needed -- this helps us keep track of where we are.
     event.fV.clear();
@@ -1130,12 +1467,576 @@ bool EXORefitSignals::DoBlBiCGSTAB(EventHandler& event)
     DoInvRPrecon(event.fprecon_tmp, event);
     DoPreconWatch.Stop(DoPreconTag);
     SafeStopwatch::tag RequestNoiseMulTag = RequestNoiseMulWatch.Start();
-    event.fResultIndex = RequestNoiseMul(event.fprecon_tmp, event.fColumnLength);
+    RequestNoiseMul(event.fprecon_tmp, event);
     RequestNoiseMulWatch.Stop(RequestNoiseMulTag);
     return false;
   }
 }
 
+static void NegateConstraintRows(std::vector<double>& in, const EventHandler& event)
+{
+  // in <-- J in, with J = {{I 0} {0 -I}}.
+  LinAlg::imatcopy('N', event.fNumSignals, event.fNumColumns,
+                   -1, &in[event.fNoiseColumnLength], event.fColumnLength, event.fColumnLength);
+}
+
+static void FactorQR(size_t Rows, size_t Cols, size_t QCols, double* A, size_t lda, double* R, const EventHandler& event)
+{
+  // A = Q R, where A is Rows x Cols.  A is overwritten by the first QCols columns of Q (so it needs room for them),
+  // and R (Cols x Cols, upper-triangular) is written to R.
+  std::vector<double> Tau(Cols);
+  lapack_int ret = LinAlg::geqrf(Rows, Cols, A, lda, &Tau[0]);
+  if(ret == 0) {
+    for(size_t col = 0; col < Cols; col++) {
+      for(size_t row = 0; row < Cols; row++) R[row + Cols*col] = (row <= col ? A[row + lda*col] : 0);
+    }
+    ret = LinAlg::orgqr(Rows, QCols, Cols, A, lda, &Tau[0]);
+  }
+  if(ret != 0) {
+    std::cout<<"QR factorization failed on entry "<<event.fEntryNumber<<" with ret = "<<ret<<std::endl;
+    std::exit(1);
+  }
+}
+
+bool EXORefitSignals::DoBlMINRES(EventHandler& event)
+{
+  // Pick up wherever we left off, like DoBlBiCGSTAB; but there is only one multiplication per iteration.
+  // Before preconditioning, the matrix A is symmetric.  Our preconditioners have K1 = trans(K2) J, with
+  // J = {{I 0} {0 -I}}; so K2_inv^T A K2_inv = J K1_inv A K2_inv is symmetric too (and close to J itself),
+  // and we solve that system for the same preconditioned X, with right-hand side J K1_inv B.
+  // This is MINRES (C. C. Paige and M. A. Saunders, SIAM J. Numer. Anal. 12, 617-629 (1975)) in block form:
+  // a block Lanczos process builds V_1, V_2, ..., and the block tridiagonal matrix it produces is QR-factored
+  // one block column at a time, each with a 2s x 2s orthogonal factor, s = fNumColumns.
+  // R is kept as K1_inv (B - A K2_inv X), as in DoBlBiCGSTAB, so termination is judged the same way;
+  // it is updated alongside X rather than recomputed, so the single-precision caveat there applies here too.
+  static SafeStopwatch FillFromNoiseWatch("DoBlMINRES::FillFromNoise (threaded)");
+  static SafeStopwatch RequestNoiseMulWatch("DoBlMINRES::RequestNoiseMul (threaded)");
+  static SafeStopwatch DoRestOfMulWatch("DoBlMINRES::DoRestOfMul (threaded)");
+  static SafeStopwatch DoPreconWatch("DoBlMINRES::Do*Precon (threaded)");
+  static SafeStopwatch CanTerminateWatch("DoBlMINRES::CanTerminate (threaded)");
+  static SafeStopwatch LanczosWatch("DoBlMINRES: Lanczos step (threaded)");
+  static SafeStopwatch UpdateWatch("DoBlMINRES: update X and R (threaded)");
+  const size_t s = event.fNumColumns;
+  const size_t n = event.fColumnLength;
+
+  // Either way, we just multiplied something by K1_inv A K2_inv; finish that.
+  bool StartLanczos = false;
+  std::vector<double> AV;
+  SafeStopwatch::tag FillFromNoiseTag = FillFromNoiseWatch.Start();
+  FillFromNoise(AV, event);
+  FillFromNoiseWatch.Stop(FillFromNoiseTag);
+  SafeStopwatch::tag DoRestOfMulTag = DoRestOfMulWatch.Start();
+  DoRestOfMultiplication(event.fprecon_tmp, AV, event);
+  DoRestOfMulWatch.Stop(DoRestOfMulTag);
+
+  if(event.fR.size() == 0) {
+    // We're in the setup phase, having multiplied X; so R <-- K1_inv (B - AX).
+    event.fR.swap(AV);
+    for(size_t i = 0; i < event.fR.size(); i++) event.fR[i] = -event.fR[i];
+    for(size_t i = 0; i < s; i++) event.fR[i*n + event.fNoiseColumnLength + event.fColumnSignals[i]] += 1;
+    SafeStopwatch::tag DoPreconTag = DoPreconWatch.Start();
+    DoInvLPrecon(event.fR, event);
+    DoPreconWatch.Stop(DoPreconTag);
+
+    SafeStopwatch::tag CanTerminateTag = CanTerminateWatch.Start();
+    bool CanTerminateRet = CanTerminate(event);
+    CanTerminateWatch.Stop(CanTerminateTag);
+    if(CanTerminateRet) {
+      event.fStatusCode = 0;
+      return true;
+    }
+    FreezeConvergedColumns(event);
+    StartLanczos = true;
+  }
+  else {
+    // We just multiplied V_j.
+    fTotalIterationsDone++;
+    SafeStopwatch::tag DoPreconTag = DoPreconWatch.Start();
+    DoInvLPrecon(AV, event); // AV = J (K2_inv^T A K2_inv) V_j.
+    DoPreconWatch.Stop(DoPreconTag);
+
+    // Lanczos step:  V_(j+1) beta_(j+1) = W = (K2_inv^T A K2_inv) V_j - V_j alpha_j - V_(j-1) trans(beta_j).
+    SafeStopwatch::tag LanczosTag = LanczosWatch.Start();
+    const std::vector<double>& V = event.fLanczosV[0];
+    std::vector<double> W = AV;
+    NegateConstraintRows(W, event);
+    if(not event.fLanczosV[1].empty()) {
+      LinAlg::gemm('N', 'T', n, s, s,
+                   -1, &event.fLanczosV[1][0], n, &event.fLanczosBeta[0], s,
+                   1, &W[0], n);
+    }
+    std::vector<double> Alpha(s*s);
+    LinAlg::gemm('T', 'N', s, s, n,
+                 1, &V[0], n, &W[0], n,
+                 0, &Alpha[0], s);
+    LinAlg::gemm('N', 'N', n, s, s,
+                 -1, &V[0], n, &Alpha[0], s,
+                 1, &W[0], n);
+    std::vector<double> NextBeta(s*s);
+    FactorQR(n, s, s, &W[0], n, &NextBeta[0], event); // W is now V_(j+1).
+
+    // The new block column of the tridiagonal matrix is (trans(beta_j), alpha_j, beta_(j+1)), in block rows j-1 to j+1.
+    // Apply the earlier factors Q_(j-2) (to block rows j-2 and j-1) and Q_(j-1) (to j-1 and j); then factor the
+    // last two block rows, Q_j {{R_jj} {0}} = {{alpha_j} {beta_(j+1)}}.  Col holds block rows j-2 to j.
+    std::vector<double> Col(3*s*s, 0);
+    for(size_t col = 0; col < s; col++) {
+      for(size_t row = 0; row < s; row++) {
+        if(not event.fLanczosBeta.empty()) Col[s + row + 3*s*col] = event.fLanczosBeta[col + s*row];
+        Col[2*s + row + 3*s*col] = Alpha[row + s*col];
+      }
+    }
+    std::vector<double> Rotated(2*s*s);
+    for(size_t i = 0; i < 2; i++) {
+      // Q_(j-1) acts on rows [s, 3s) of Col, and Q_(j-2) on rows [0, 2s).  Apply the older one first.
+      const std::vector<double>& Q = event.fMINRESQ[1-i];
+      if(Q.empty()) continue;
+      LinAlg::gemm('T', 'N', 2*s, s, 2*s,
+                   1, &Q[0], 2*s, &Col[i*s], 3*s,
+                   0, &Rotated[0], 2*s);
+      for(size_t col = 0; col < s; col++) {
+        std::copy(Rotated.begin() + 2*s*col, Rotated.begin() + 2*s*(col+1), Col.begin() + i*s + 3*s*col);
+      }
+    }
+    std::vector<double> Q(4*s*s, 0);
+    for(size_t col = 0; col < s; col++) {
+      std::copy(Col.begin() + 2*s + 3*s*col, Col.begin() + 3*s*(col+1), Q.begin() + 2*s*col);
+      std::copy(NextBeta.begin() + s*col, NextBeta.begin() + s*(col+1), Q.begin() + s + 2*s*col);
+    }
+    std::vector<double> Rjj(s*s);
+    FactorQR(2*s, s, 2*s, &Q[0], 2*s, &Rjj[0], event);
+
+    // {{tau_j} {Tau_(j+1)}} = trans(Q_j) {{Tau_j} {0}}.
+    std::vector<double> Tau(2*s*s);
+    LinAlg::gemm('T', 'N', 2*s, s, s,
+                 1, &Q[0], 2*s, &event.fMINRESTau[0], s,
+                 0, &Tau[0], 2*s);
+    LanczosWatch.Stop(LanczosTag);
+
+    // Search direction M_j = (V_j - M_(j-1) R_(j-1,j) - M_(j-2) R_(j-2,j)) R_jj_inv, and likewise for its product.
+    // Then X <-- X + M_j tau_j, and R <-- R - K1_inv A K2_inv M_j tau_j.
+    SafeStopwatch::tag UpdateTag = UpdateWatch.Start();
+    std::vector<double> Dir = V;
+    for(size_t i = 0; i < 2; i++) {
+      if(event.fMINRESDir[i].empty()) continue;
+      LinAlg::gemm('N', 'N', n, s, s,
+                   -1, &event.fMINRESDir[i][0], n, &Col[(1-i)*s], 3*s,
+                   1, &Dir[0], n);
+      LinAlg::gemm('N', 'N', n, s, s,
+                   -1, &event.fMINRESADir[i][0], n, &Col[(1-i)*s], 3*s,
+                   1, &AV[0], n);
+    }
+    LinAlg::trsm('R', 'U', 'N', 'N', n, s, 1, &Rjj[0], s, &Dir[0], n);
+    LinAlg::trsm('R', 'U', 'N', 'N', n, s, 1, &Rjj[0], s, &AV[0], n);
+    LinAlg::gemm('N', 'N', n, s, s,
+                 1, &Dir[0], n, &Tau[0], 2*s,
+                 1, &event.fX[0], n);
+    LinAlg::gemm('N', 'N', n, s, s,
+                 -1, &AV[0], n, &Tau[0], 2*s,
+                 1, &event.fR[0], n);
+    UpdateWatch.Stop(UpdateTag);
+
+    // Shift everything along by one block.
+    for(size_t col = 0; col < s; col++) {
+      std::copy(Tau.begin() + s + 2*s*col, Tau.begin() + 2*s*(col+1), event.fMINRESTau.begin() + s*col);
+    }
+    event.fMINRESDir[1].swap(event.fMINRESDir[0]);
+    event.fMINRESDir[0].swap(Dir);
+    event.fMINRESADir[1].swap(event.fMINRESADir[0]);
+    event.fMINRESADir[0].swap(AV);
+    event.fMINRESQ[1].swap(event.fMINRESQ[0]);
+    event.fMINRESQ[0].swap(Q);
+    event.fLanczosV[1].swap(event.fLanczosV[0]);
+    event.fLanczosV[0].swap(W);
+    event.fLanczosBeta.swap(NextBeta);
+
+    // Check if we should conclude here; just as in DoBlBiCGSTAB.
+    SafeStopwatch::tag CanTerminateTag = CanTerminateWatch.Start();
+    bool CanTerminateRet = CanTerminate(event);
+    CanTerminateWatch.Stop(CanTerminateTag);
+    if(CanTerminateRet and event.fNoiseOperator->fStore->GetPrecision() == NoiseStore::kSingle) {
+      DoRestart(event, true);
+      return false;
+    }
+    if(CanTerminateRet) {
+      event.fStatusCode = 0;
+      return true;
+    }
+    if(event.fNumIterations >= 2000) {
+      event.fX.clear();
+      std::cout<<"Giving up on entry "<<event.fEntryNumber<<std::endl;
+      event.fStatusCode = 5;
+      return true;
+    }
+    if(fDoRestarts > 0) {
+      if(event.fNumIterSinceReset >= fDoRestarts) {
+        DoRestart(event);
+        return false;
+      }
+    }
+    // Drop any columns which have converged, and start again from the residuals of the rest; as in DoBlBiCGSTAB.
+    if(event.fNoiseOperator->fStore->GetPrecision() != NoiseStore::kSingle) {
+      StartLanczos = FreezeConvergedColumns(event);
+    }
+  }
+
+  if(StartLanczos) {
+    // Start the Lanczos process from the residual of the symmetric system:  V_1 Tau = J R.
+    // (There may be fewer columns than s now.)
+    const size_t NumCols = event.fNumColumns;
+    event.fLanczosV[0] = event.fR;
+    NegateConstraintRows(event.fLanczosV[0], event);
+    event.fMINRESTau.assign(NumCols*NumCols, 0);
+    FactorQR(n, NumCols, NumCols, &event.fLanczosV[0][0], n, &event.fMINRESTau[0], event);
+    event.fLanczosV[1].clear();
+    event.fLanczosBeta.clear();
+    for(size_t i = 0; i < 2; i++) {
+      event.fMINRESDir[i].clear();
+      event.fMINRESADir[i].clear();
+      event.fMINRESQ[i].clear();
+    }
+  }
+
+  // Request a multiplication of the newest Lanczos block.
+  event.fprecon_tmp = event.fLanczosV[0];
+  SafeStopwatch::tag DoPreconTag = DoPreconWatch.Start();
+  DoInvRPrecon(event.fprecon_tmp, event);
+  DoPreconWatch.Stop(DoPreconTag);
+  SafeStopwatch::tag RequestNoiseMulTag = RequestNoiseMulWatch.Start();
+  RequestNoiseMul(event.fprecon_tmp, event);
+  RequestNoiseMulWatch.Stop(RequestNoiseMulTag);
+  return false;
+}
+
+static void KeepExtremeRitzVectors(std::vector<double>& Y, std::vector<double>& NY, std::vector<double>& Ritz,
+                                   size_t L, size_t NumKept)
+{
+  // Y holds noise columns (L rows each), and NY = N Y.  Replace them by NumKept orthonormal Ritz vectors of N from
+  // the span of Y (and N times those), choosing the ones whose Ritz values (returned in Ritz) are furthest from 1,
+  // on a log scale.
+  // Y needn't be orthonormal or even independent (eg. consecutive Krylov vectors), so first find an orthonormal basis
+  // Y B of its span from trans(Y) Y = Q diag(lambda) trans(Q), with B = Q diag(lambda)^(-1/2) for the lambda which
+  // aren't negligible.  We get N Y B = NY B for free; and doing it in one step, rather than a column at a time,
+  // keeps NY from drifting away from N Y.  Then, with trans(B) trans(Y) N Y B = V diag(theta) trans(V),
+  // Y <-- Y B V, for the columns of V we want.
+  const size_t k = Y.size()/L;
+  std::vector<double> Q(k*k);
+  std::vector<double> Lambda(k);
+  LinAlg::gemm('T', 'N', k, k, L, 1, &Y[0], L, &Y[0], L, 0, &Q[0], k);
+  lapack_int ret = LinAlg::syev('V', 'U', k, &Q[0], k, &Lambda[0]);
+  if(ret == 0) {
+    size_t FirstKept = 0; // Lambda is ascending.
+    while(FirstKept < k and Lambda[FirstKept] <= 1e-8*Lambda[k-1]) FirstKept++;
+    const size_t Rank = k - FirstKept;
+    if(Rank == 0) {
+      // Nothing but zeros.
+      Y.clear();
+      NY.clear();
+      Ritz.clear();
+      return;
+    }
+    std::vector<double> B(k*Rank);
+    for(size_t i = 0; i < Rank; i++) {
+      for(size_t j = 0; j < k; j++) B[i*k + j] = Q[(FirstKept + i)*k + j]/std::sqrt(Lambda[FirstKept + i]);
+    }
+    std::vector<double> YtNY(k*k);
+    LinAlg::gemm('T', 'N', k, k, L, 1, &Y[0], L, &NY[0], L, 0, &YtNY[0], k);
+    std::vector<double> Temp(k*Rank);
+    LinAlg::gemm('N', 'N', k, Rank, k, 1, &YtNY[0], k, &B[0], k, 0, &Temp[0], k);
+    std::vector<double> H(Rank*Rank);
+    LinAlg::gemm('T', 'N', Rank, Rank, k, 1, &B[0], k, &Temp[0], k, 0, &H[0], Rank);
+    for(size_t i = 0; i < Rank; i++) {
+      for(size_t j = 0; j < i; j++) H[i*Rank + j] = H[j*Rank + i] = (H[i*Rank + j] + H[j*Rank + i])/2;
+    }
+    std::vector<double> Theta(Rank);
+    ret = LinAlg::syev('V', 'U', Rank, &H[0], Rank, &Theta[0]);
+    if(ret == 0) {
+      std::vector<std::pair<double, size_t> > Order;
+      for(size_t i = 0; i < Rank; i++) {
+        if(Theta[i] > 0) Order.push_back(std::make_pair(-std::fabs(std::log(Theta[i])), i)); // N is positive-definite.
+      }
+      std::sort(Order.begin(), Order.end());
+      NumKept = std::min(NumKept, Order.size());
+      std::vector<double> V(Rank*NumKept);
+      Ritz.resize(NumKept);
+      for(size_t i = 0; i < NumKept; i++) {
+        std::copy(H.begin() + Order[i].second*Rank, H.begin() + (Order[i].second + 1)*Rank, V.begin() + i*Rank);
+        Ritz[i] = Theta[Order[i].second];
+      }
+      std::vector<double> Z(k*NumKept); // B V
+      LinAlg::gemm('N', 'N', k, NumKept, Rank, 1, &B[0], k, &V[0], Rank, 0, &Z[0], k);
+      std::vector<double> NewY(L*NumKept);
+      std::vector<double> NewNY(L*NumKept);
+      LinAlg::gemm('N', 'N', L, NumKept, k, 1, &Y[0], L, &Z[0], k, 0, &NewY[0], L);
+      LinAlg::gemm('N', 'N', L, NumKept, k, 1, &NY[0], L, &Z[0], k, 0, &NewNY[0], L);
+      Y.swap(NewY);
+      NY.swap(NewNY);
+    }
+  }
+  if(ret != 0) {
+    std::cout<<"Finding Ritz vectors for recycling failed with ret = "<<ret<<std::endl;
+    std::exit(1);
+  }
+}
+
+void EXORefitSignals::HarvestRecycleVectors(EventHandler& event)
+{
+  // Every multiplication by the noise gives us noise columns v and N v for free:  the noise rows of
+  // event.fprecon_tmp, and the result of multiplying them, which we're about to read.  Collect those, compressed
+  // to the Ritz vectors we'd keep whenever there are twice as many; when the event is finished, AddRecycleVectors
+  // does the same with the noise operator's.
+  static SafeStopwatch HarvestWatch("HarvestRecycleVectors (threaded)");
+  SafeStopwatch::tag HarvestTag = HarvestWatch.Start();
+  const NoiseOperator& op = *event.fNoiseOperator;
+  const size_t L = event.fNoiseColumnLength;
+  for(size_t col = 0; col < event.fNumColumns; col++) {
+    event.fHarvestY.insert(event.fHarvestY.end(),
+                           event.fprecon_tmp.begin() + col*event.fColumnLength,
+                           event.fprecon_tmp.begin() + col*event.fColumnLength + L);
+    size_t Index = event.fResultIndex + col*L;
+    if(op.IsSingle()) {
+      const float* Product = &op.fNoiseMulResultSingle[event.fNoiseBuffer][Index];
+      event.fHarvestNY.insert(event.fHarvestNY.end(), Product, Product + L);
+    }
+    else {
+      const double* Product = &op.fNoiseMulResult[event.fNoiseBuffer][Index];
+      event.fHarvestNY.insert(event.fHarvestNY.end(), Product, Product + L);
+    }
+  }
+  if(event.fHarvestY.size() >= 2*fRecycleSize*L) {
+    std::vector<double> Ritz;
+    KeepExtremeRitzVectors(event.fHarvestY, event.fHarvestNY, Ritz, L, fRecycleSize);
+  }
+  HarvestWatch.Stop(HarvestTag);
+}
+
+void EXORefitSignals::AddRecycleVectors(EventHandler& event)
+{
+  // Add the directions harvested from event to its noise operator's, between passes, keeping the fRecycleSize
+  // Ritz vectors of N whose Ritz values are furthest from 1:  the preconditioner otherwise takes N to be I
+  // (see DoNoiseFactorMul), so those are the directions it gets most wrong.
+  // Once every event harvesting for the operator has been added, they're fixed, and used by new events.
+  static SafeStopwatch AddWatch("AddRecycleVectors (sequential)");
+  SafeStopwatch::tag AddTag = AddWatch.Start();
+  NoiseOperator& op = *event.fNoiseOperator;
+  const size_t L = op.fNoiseColumnLength;
+  if(not event.fHarvestY.empty()) {
+    op.fRecycleY.insert(op.fRecycleY.end(), event.fHarvestY.begin(), event.fHarvestY.end());
+    op.fRecycleNY.insert(op.fRecycleNY.end(), event.fHarvestNY.begin(), event.fHarvestNY.end());
+    KeepExtremeRitzVectors(op.fRecycleY, op.fRecycleNY, op.fRecycleRitz, L, fRecycleSize);
+  }
+  std::vector<double>().swap(event.fHarvestY);
+  std::vector<double>().swap(event.fHarvestNY);
+  op.fNumRecycleHarvests++;
+  if(op.fNumRecycleHarvests == fRecycleHarvests) op.fRecycleReady = true;
+  AddWatch.Stop(AddTag);
+}
+
+static void MultiplyByInverseNoise(const NoiseOperator& op, const std::vector<double>& in,
+                                   std::vector<double>& out, size_t NumCols)
+{
+  // out = N^(-1) in, for NumCols columns of just the noise rows, using the inverted blocks (see PrepareNoiseBlocks).
+  const size_t ColLength = op.fNoiseColumnLength;
+  assert(in.size() == NumCols*ColLength);
+  out.resize(in.size());
+  for(size_t f = 0; f < op.fStore->GetNumFreqs(); f++) {
+    size_t BlockSize = op.fStore->GetBlockSize(f);
+    size_t FirstRow = 2*op.fChannels.size()*f;
+    LinAlg::gemm('N', 'N', BlockSize, NumCols, BlockSize,
+                 1, &op.fInvNoiseBlocks[op.fNoiseBlockOffsets[f]], BlockSize,
+                 &in[FirstRow], ColLength, 0, &out[FirstRow], ColLength);
+  }
+}
+
+bool EXORefitSignals::DoDirectSolve(EventHandler& event)
+{
+  // Solve for X outright, rather than iterating.  In the coordinates the noise store works in, A X = B is
+  //   {{N + P, M} {trans(M) 0}} X = {{0} {I}},
+  // where N is the noise, block-diagonal by frequency; M holds the models, one column per signal; and
+  // P = sum_k s_k w_k trans(w_k) holds the Poisson terms (see DoPoissonMultiplication), one for each APD model
+  // and gang it hits, with w_k the model on just that gang's rows.  Then, with Z = (N + P)^(-1) M and the Schur
+  // complement S = trans(M) Z (NumSignals square), X = {{Z S^(-1)} {-S^(-1)}}.
+  // Z comes from the Woodbury identity:  writing W for the w_k, and s for diag(s_k),
+  //   (N + P)^(-1) = N^(-1) - N^(-1) W (I + s trans(W) N^(-1) W)^(-1) s trans(W) N^(-1),
+  // with N^(-1) from the inverted noise blocks; the matrix to solve in the middle is only K square, for K terms.
+  // Since each w_k has just one row per run, trans(W) N^(-1) W is read off the inverted blocks directly.
+  // So the cost is fixed:  two products of N^(-1) with NumSignals vectors, and O(K^2) per frequency.
+  // The solution is left in fX, preconditioned as DoBlBiCGSTAB would leave it; so this always returns true.
+  const NoiseOperator& op = *event.fNoiseOperator;
+  const size_t NumChannels = event.fChannels.size();
+  const size_t NoiseLength = event.fNoiseColumnLength;
+  const size_t NumSignals = event.fNumSignals;
+  const size_t NumRuns = NoiseLength/NumChannels; // Runs of rows, one per channel.
+  assert(not op.fInvNoiseBlocks.empty());
+  lapack_int ret;
+
+  // N^(-1) M.
+  std::vector<double> M;
+  M.reserve(NoiseLength*NumSignals);
+  for(size_t m = 0; m < NumSignals; m++) {
+    M.insert(M.end(), event.fModels[m]->fModel.begin(), event.fModels[m]->fModel.end());
+  }
+  std::vector<double> InvN_M;
+  MultiplyByInverseNoise(op, M, InvN_M, NumSignals);
+
+  // The Poisson terms, scaled just as in DoPoissonMultiplication.
+  std::vector<const double*> TermModel;
+  std::vector<size_t> TermChannel;
+  std::vector<double> TermScale;
+  for(size_t m = 0; m < event.fAPDModel.size(); m++) {
+    const ModelManager& modelManager = event.fAPDModel[m];
+    for(std::set<unsigned char>::const_iterator it = modelManager.fHitChannels.begin();
+        it != modelManager.fHitChannels.end();
+        it++) {
+      TermModel.push_back(&modelManager.fModel[0]);
+      TermChannel.push_back(*it);
+      TermScale.push_back(GetPoissonScale(modelManager, *it, event));
+    }
+  }
+  const size_t K = TermScale.size();
+
+  // Inner = I + s trans(W) N^(-1) W, and T = s trans(W) N^(-1) M; then T <-- Inner^(-1) T.
+  // Within a block, term k has a real and an imaginary row (just a real one at MAX_F).
+  std::vector<double> Inner(K*K, 0);
+  for(size_t f = 0; f < op.fStore->GetNumFreqs(); f++) {
+    const size_t BlockSize = op.fStore->GetBlockSize(f);
+    const size_t NumParts = BlockSize/NumChannels;
+    const size_t FirstRow = 2*NumChannels*f;
+    const double* InvBlock = &op.fInvNoiseBlocks[op.fNoiseBlockOffsets[f]];
+    for(size_t l = 0; l < K; l++) {
+      for(size_t b = 0; b < NumParts; b++) {
+        size_t col = b*NumChannels + TermChannel[l];
+        double wl = TermModel[l][FirstRow + col];
+        if(wl == 0) continue;
+        for(size_t k = 0; k < K; k++) {
+          for(size_t a = 0; a < NumParts; a++) {
+            size_t row = a*NumChannels + TermChannel[k];
+            Inner[k + K*l] += TermModel[k][FirstRow + row]*InvBlock[row + BlockSize*col]*wl;
+          }
+        }
+      }
+    }
+  }
+  std::vector<double> T(K*NumSignals, 0);
+  for(size_t j = 0; j < NumSignals; j++) {
+    for(size_t k = 0; k < K; k++) {
+      for(size_t run = 0; run < NumRuns; run++) {
+        size_t row = run*NumChannels + TermChannel[k];
+        T[k + K*j] += TermModel[k][row]*InvN_M[row + NoiseLength*j];
+      }
+    }
+  }
+  for(size_t k = 0; k < K; k++) {
+    for(size_t l = 0; l < K; l++) Inner[k + K*l] *= TermScale[k];
+    Inner[k + K*k] += 1;
+    for(size_t j = 0; j < NumSignals; j++) T[k + K*j] *= TermScale[k];
+  }
+  if(K > 0) {
+    std::vector<lapack_int> Pivot(K);
+    ret = LinAlg::getrf(K, K, &Inner[0], K, &Pivot[0]);
+    if(ret == 0) ret = LinAlg::getrs('N', K, NumSignals, &Inner[0], K, &Pivot[0], &T[0], K);
+    if(ret != 0) {
+      std::cout<<"Solving for the Poisson terms failed on entry "<<event.fEntryNumber<<
+                 " with ret = "<<ret<<std::endl;
+      std::exit(1);
+    }
+  }
+
+  // Z = N^(-1) (M - W T).
+  for(size_t j = 0; j < NumSignals; j++) {
+    for(size_t k = 0; k < K; k++) {
+      for(size_t run = 0; run < NumRuns; run++) {
+        size_t row = run*NumChannels + TermChannel[k];
+        M[row + NoiseLength*j] -= TermModel[k][row]*T[k + K*j];
+      }
+    }
+  }
+  std::vector<double> Z;
+  MultiplyByInverseNoise(op, M, Z, NumSignals);
+
+  // S^(-1), from S = trans(M) Z.  (M must be the models again, so take them from the event.)
+  std::vector<double> S(NumSignals*NumSignals, 0);
+  for(size_t m = 0; m < NumSignals; m++) {
+    LinAlg::gemm('T', 'N', 1, NumSignals, NoiseLength,
+                 1, &event.fModels[m]->fModel[0], NoiseLength, &Z[0], NoiseLength, 0, &S[m], NumSignals);
+  }
+  std::vector<double> InvS(NumSignals*NumSignals, 0);
+  for(size_t i = 0; i < NumSignals; i++) InvS[i + NumSignals*i] = 1;
+  std::vector<lapack_int> Pivot(NumSignals);
+  ret = LinAlg::getrf(NumSignals, NumSignals, &S[0], NumSignals, &Pivot[0]);
+  if(ret == 0) ret = LinAlg::getrs('N', NumSignals, NumSignals, &S[0], NumSignals, &Pivot[0], &InvS[0], NumSignals);
+  if(ret != 0) {
+    std::cout<<"Solving the Schur complement failed on entry "<<event.fEntryNumber<<
+               " with ret = "<<ret<<std::endl;
+    std::exit(1);
+  }
+
+  // X = {{Z S^(-1)} {-S^(-1)}}; then apply K2, since PushFinishedEvent will undo it.
+  event.fX.assign(event.fColumnLength*NumSignals, 0);
+  LinAlg::gemm('N', 'N', NoiseLength, NumSignals, NumSignals,
+               1, &Z[0], NoiseLength, &InvS[0], NumSignals, 0, &event.fX[0], event.fColumnLength);
+  for(size_t j = 0; j < NumSignals; j++) {
+    for(size_t i = 0; i < NumSignals; i++) event.fX[NoiseLength + i + event.fColumnLength*j] = -InvS[i + NumSignals*j];
+  }
+  DoRPrecon(event.fX, event);
+  event.fStatusCode = 0;
+  return true;
+}
+
+void EXORefitSignals::PrepareNoiseBlocks(NoiseOperator& op)
+{
+  // Derive whatever we need from the whole noise blocks of op:  inverses for the direct solver, and Cholesky factors
+  // for the block preconditioner.  The threads share the blocks out by frequency.
+  // This is done once per noise operator.  Must be called while the worker pool is idle.
+  bool NeedInverses = (fSolver == kDirect and op.fInvNoiseBlocks.empty());
+  bool NeedFactors = (fBlockPrecon and op.fNoiseBlockFactors.empty());
+  if(not NeedInverses and not NeedFactors) return;
+  static SafeStopwatch PrepareWatch("PrepareNoiseBlocks (sequential)");
+  SafeStopwatch::tag PrepareTag = PrepareWatch.Start();
+  op.fNoiseBlockOffsets.assign(1, 0);
+  for(size_t f = 0; f < op.fStore->GetNumFreqs(); f++) {
+    size_t BlockSize = op.fStore->GetBlockSize(f);
+    op.fNoiseBlockOffsets.push_back(op.fNoiseBlockOffsets.back() + BlockSize*BlockSize);
+  }
+  if(NeedInverses) op.fInvNoiseBlocks.resize(op.fNoiseBlockOffsets.back());
+  if(NeedFactors) op.fNoiseBlockFactors.resize(op.fNoiseBlockOffsets.back());
+  fWorkerPool->RunOnAll(boost::bind(&EXORefitSignals::PrepareNoiseBlocks_Share, this,
+                                    boost::ref(op), NeedInverses, NeedFactors));
+  PrepareWatch.Stop(PrepareTag);
+}
+
+void EXORefitSignals::PrepareNoiseBlocks_Share(NoiseOperator& op, bool NeedInverses, bool NeedFactors)
+{
+  // This thread's share of the blocks:  factor each with Cholesky; for the inverse, invert the factor, and fill in the
+  // lower triangle too, so the inverse can be applied with a plain GEMM.
+  size_t Begin, End;
+  fWorkerPool->GetShare(op.fStore->GetNumFreqs(), Begin, End);
+  std::vector<double> Block;
+  for(size_t f = Begin; f < End; f++) {
+    size_t BlockSize = op.fStore->GetBlockSize(f);
+    op.fStore->UnpackBlock(f, Block);
+    lapack_int ret = LinAlg::potrf('U', BlockSize, &Block[0], BlockSize);
+    if(ret != 0) {
+      std::cout<<"Factoring the noise block at frequency index "<<f<<" failed with ret = "<<ret<<std::endl;
+      std::exit(1);
+    }
+    for(size_t col = 0; col < BlockSize; col++) {
+      for(size_t row = col+1; row < BlockSize; row++) Block[row + BlockSize*col] = 0;
+    }
+    if(NeedFactors) std::copy(Block.begin(), Block.end(), op.fNoiseBlockFactors.begin() + op.fNoiseBlockOffsets[f]);
+    if(not NeedInverses) continue;
+
+    ret = LinAlg::potri('U', BlockSize, &Block[0], BlockSize);
+    if(ret != 0) {
+      std::cout<<"Inverting the noise block at frequency index "<<f<<" failed with ret = "<<ret<<std::endl;
+      std::exit(1);
+    }
+    for(size_t col = 0; col < BlockSize; col++) {
+      for(size_t row = col+1; row < BlockSize; row++) Block[row + BlockSize*col] = Block[col + BlockSize*row];
+    }
+    std::copy(Block.begin(), Block.end(), op.fInvNoiseBlocks.begin() + op.fNoiseBlockOffsets[f]);
+  }
+}
+
 void EXORefitSignals::DoRestOfMultiplication(const std::vector<double>& in,
                                              std::vector<double>& out,
                                              EventHandler& event)
@@ -1153,15 +2054,27 @@ void EXORefitSignals::DoRestOfMultiplication(const std::vector<double>& in,
   LandCMulWatch.Stop(LandCMulTag);
 }
 
+double EXORefitSignals::GetPoissonScale(const ModelManager& modelManager,
+                                        unsigned char ChannelIndex,
+                                        EventHandler& event) const
+{
+  // The Poisson noise of a hit gang (event.fChannels[ChannelIndex]) is this times the outer product of its model.
+  double Scale = event.fExpectedEnergy_keV/THORIUM_ENERGY_KEV;
+  Scale *= GetGain(event.fChannels[ChannelIndex], event);
+  Scale /= modelManager.fExpectedYieldPerGang.at(ChannelIndex);
+  return Scale;
+}
+
 void EXORefitSignals::DoPoissonMultiplication(const std::vector<double>& in,
                                               std::vector<double>& out,
                                               EventHandler& event)
 {
   // Poisson terms for APD channels.
+  const size_t NumRuns = event.fNoiseColumnLength/event.fChannels.size(); // Runs of rows, one per channel.
   for(size_t m = 0; m < event.fAPDModel.size(); m++) {
     const ModelManager& modelManager = event.fAPDModel.at(m);
-    assert(modelManager.fNumChannels == fChannels.size());
-    for(size_t n = 0; n < event.fNumSignals; n++) {
+    assert(modelManager.fNumChannels == event.fChannels.size());
+    for(size_t n = 0; n < event.fNumColumns; n++) {
 
       // Exploit ranges of contiguous channels which are hit by this signal.
       const std::set<std::pair<unsigned char, unsigned char> >& contigChannels =
@@ -1171,21 +2084,19 @@ void EXORefitSignals::DoPoissonMultiplication(const std::vector<double>& in,
           it++) {
         std::vector<double> CommonFactors(it->second - it->first, 0);
 
-        for(size_t f = 0; f < 2*(MAX_F-MIN_F)+1; f++) {
-          size_t StartIndex = f*fChannels.size() + it->first;
+        for(size_t f = 0; f < NumRuns; f++) {
+          size_t StartIndex = f*event.fChannels.size() + it->first;
           for(unsigned char i = 0; i < CommonFactors.size(); i++) {
             CommonFactors[i] += in[event.fColumnLength*n+StartIndex+i] * modelManager.fModel[StartIndex+i];
           }
         }
 
         for(size_t i = 0; i < CommonFactors.size(); i++) {
-          CommonFactors[i] *= event.fExpectedEnergy_keV/THORIUM_ENERGY_KEV;
-          CommonFactors[i] *= GetGain(fChannels[it->first + i], event);
-          CommonFactors[i] /= modelManager.fExpectedYieldPerGang.at(it->first + i);
+          CommonFactors[i] *= GetPoissonScale(modelManager, it->first + i, event);
         }
 
-        for(size_t f = 0; f < 2*(MAX_F-MIN_F)+1; f++) {
-          size_t StartIndex = f*fChannels.size() + it->first;
+        for(size_t f = 0; f < NumRuns; f++) {
+          size_t StartIndex = f*event.fChannels.size() + it->first;
           for(unsigned char i = 0; i < CommonFactors.size(); i++) {
             out[event.fColumnLength*n+StartIndex+i] += CommonFactors[i] * modelManager.fModel[StartIndex+i];
           }
@@ -1195,160 +2106,608 @@ void EXORefitSignals::DoPoissonMultiplication(const std::vector<double>& in,
   }
 }
 
-void EXORefitSignals::DoNoiseMultiplication()
+void EXORefitSignals::StartNoiseMultiplication(size_t Buffer)
 {
-  // Multiply everything in fNoiseMulQueue by the noise.
+  // Get ready to multiply everything in each noise operator's fNoiseMulQueue[Buffer] by that operator.
   // Note that we expect columns in the input to contain only the noise portion, not the constraint rows;
   // otherwise, the vector lengths would not match.
-  // The result is placed in fNoiseMulResult.
-  assert(fNoiseMulQueue.size() == fNoiseColumnLength * fNumVectorsInQueue);
-  fNoiseMulResult.resize(fNoiseMulQueue.size()); // Do not initialize.
-
-  // Do the multiplication -- one call for every frequency.
+  // The results are placed in the operators' fNoiseMulResult[Buffer].
+  // In a noise group, PlanNoiseGroupPass has already chosen the operators; we swap rows with the other members,
+  // so that each multiplies its own frequencies for all of them (and FinishNoiseMultiplication swaps them back).
   if(fVerbose) std::cout<<"Starting DoNoiseMultiplication."<<std::endl;
+  if(fNoiseGroupSize > 1) ExchangeNoiseRows(Buffer);
+  else {
+    fOperatorsToMultiply.clear();
+    NoiseOperatorMap::iterator it;
+    for(it = fNoiseOperators.begin(); it != fNoiseOperators.end(); it++) {
+      NoiseOperator& op = *it->second;
+      if(op.fNumVectorsInQueue[Buffer] == 0) continue;
+      size_t Length = op.fNoiseColumnLength * op.fNumVectorsInQueue[Buffer];
+      assert(op.GetQueueLength(Buffer) >= Length); // The queue may have room for more.
+      if(op.IsSingle()) {
+        op.fNoiseMulResultSingle[Buffer].resize(Length); // Do not initialize.
+        op.fMulInSingle = &op.fNoiseMulQueueSingle[Buffer][0];
+        op.fMulOutSingle = &op.fNoiseMulResultSingle[Buffer][0];
+      }
+      else {
+        op.fNoiseMulResult[Buffer].resize(Length); // Do not initialize.
+        op.fMulIn = &op.fNoiseMulQueue[Buffer][0];
+        op.fMulOut = &op.fNoiseMulResult[Buffer][0];
+      }
+      op.fMulNumVectors = op.fNumVectorsInQueue[Buffer];
+      op.fMulColumnLength = op.fNoiseColumnLength;
+      op.fMulFirstRow = 0;
+      fOperatorsToMultiply.push_back(&op);
+    }
+  }
 
-  // Queue for managing frequencies to handle in DoNoiseMultiplication.
-  // We want to handle the inclusive range [0, MAX_F-MIN_F].
-  boost::lockfree::queue<size_t, boost::lockfree::capacity<MAX_F-MIN_F+1> > freq_queue;
-  assert(freq_queue.is_lock_free());
-  for(size_t f = 0; f <= MAX_F-MIN_F; f++) {
-    assert(freq_queue.bounded_push(f));
+  fFirstNoiseMulItem.assign(1, 0);
+  for(size_t i = 0; i < fOperatorsToMultiply.size(); i++) {
+    NoiseOperator& op = *fOperatorsToMultiply[i];
+    size_t NumFreqs = op.fStore->GetEndOwnedFreq() - op.fStore->GetFirstOwnedFreq();
+    fFirstNoiseMulItem.push_back(fFirstNoiseMulItem.back() + NumFreqs*GetNumNoiseMulTiles(op));
   }
+  fNoiseMulItems->Reset(fFirstNoiseMulItem.back());
+}
 
-#ifdef USE_THREADS
-  boost::thread_group threads;
-  for(size_t i = 0; i < NUM_THREADS-1; i++) {
-    // Create threads which will grab entries off of freq_queue until it is empty.
-    threads.create_thread(boost::bind(&EXORefitSignals::DoNoiseMultiplication_FromQueue,
-                                      this, boost::ref(freq_queue)));
+size_t EXORefitSignals::GetNumNoiseMulTiles(const NoiseOperator& op) const
+{
+  // Number of column tiles the vectors op is multiplying in this pass are split into.
+  return (op.fMulNumVectors + fNoiseMulTileColumns - 1)/fNoiseMulTileColumns;
+}
+
+void EXORefitSignals::FinishNoiseMultiplication(size_t Buffer)
+{
+  // Clean up, to be ready for the next requests in this buffer.
+  if(fNoiseGroupSize > 1) ExchangeNoiseResults(Buffer);
+  for(size_t i = 0; i < fOperatorsToMultiply.size(); i++) {
+    NoiseOperator& op = *fOperatorsToMultiply[i];
+    op.fNumVectorsInQueue[Buffer] = 0; // Keep the queue's size, so its slots can be handed out again.
   }
-#endif
+  fOperatorsToMultiply.clear();
+  fNumVectorsInQueue[Buffer] = 0;
+  if(fVerbose) std::cout<<"Done with DoNoiseMultiplication."<<std::endl;
+}
 
-  // This thread should do work too -- grab frequencies off of freq_queue until it is empty.
-  DoNoiseMultiplication_FromQueue(freq_queue);
+bool EXORefitSignals::PlanNoiseGroupPass(bool Busy, size_t Buffer)
+{
+  // Collective over the noise group, at the start of every pass:  find out whether anybody has events left
+  // (Busy is whether we do), and which operators have vectors queued in Buffer anywhere in the group.
+  // Every member lists those operators in the same (key) order, in fOperatorsToMultiply, making any it lacks,
+  // and their counts in fGroupCounts.  Returns false if nobody is busy, in which case there's no pass.
+  static SafeStopwatch PlanWatch("PlanNoiseGroupPass (sequential)");
+  SafeStopwatch::tag PlanTag = PlanWatch.Start();
+  typedef std::vector<std::pair<NoiseOperatorKey, size_t> > RequestList;
+  std::pair<bool, RequestList> Mine(Busy, RequestList());
+  NoiseOperatorMap::iterator it;
+  for(it = fNoiseOperators.begin(); it != fNoiseOperators.end(); it++) {
+    size_t Count = it->second->fNumVectorsInQueue[Buffer];
+    if(Count > 0) Mine.second.push_back(std::make_pair(it->first, Count));
+  }
+  std::vector<std::pair<bool, RequestList> > All;
+  boost::mpi::all_gather(fNoiseGroup, Mine, All);
+
+  bool AnyBusy = false;
+  std::map<NoiseOperatorKey, std::vector<size_t> > Counts;
+  for(size_t r = 0; r < All.size(); r++) {
+    AnyBusy = AnyBusy or All[r].first;
+    for(size_t i = 0; i < All[r].second.size(); i++) {
+      std::vector<size_t>& CountsForKey = Counts[All[r].second[i].first];
+      CountsForKey.resize(fNoiseGroupSize, 0);
+      CountsForKey[r] = All[r].second[i].second;
+    }
+  }
 
-#ifdef USE_THREADS
-  // We reached this point because there were no more frequencies for this thread to grab.
-  // Other threads should be done shortly.
-  threads.join_all();
-#endif
+  fOperatorsToMultiply.clear();
+  fGroupCounts.clear();
+  std::map<NoiseOperatorKey, std::vector<size_t> >::iterator CountIt;
+  for(CountIt = Counts.begin(); CountIt != Counts.end(); CountIt++) {
+    it = fNoiseOperators.find(CountIt->first);
+    if(it == fNoiseOperators.end()) {
+      // Somebody else in the group is using a channel set (or noise file) we aren't, and needs our share of it.
+      // Don't evict anything for it now:  that might mean finishing our own events, which takes passes of its own.
+      // Once it's in the cache, it is evicted like any other operator (and remade here if it's needed again).
+      NoiseOperator* op = MakeNoiseOperator(CountIt->first.first, CountIt->first.second, NULL);
+      ReserveNoiseMulQueues(*op);
+      if(fNUMALocalNoise) PlaceNoiseOperator(*op);
+      op->fLastUsed = fNoiseOperatorClock;
+      it = fNoiseOperators.insert(std::make_pair(CountIt->first, op)).first;
+    }
+    fOperatorsToMultiply.push_back(it->second);
+    fGroupCounts.push_back(CountIt->second);
+  }
+  PlanWatch.Stop(PlanTag);
+  return AnyBusy;
+}
 
-  if(fVerbose) std::cout<<"Done with DoNoiseMultiplication."<<std::endl;
+void EXORefitSignals::GetGroupRows(const NoiseOperator& op, size_t Member, size_t& FirstRow, size_t& NumRows) const
+{
+  // The rows of op's noise columns which noise group member Member multiplies (those of its share of the frequencies).
+  size_t Begin, End;
+  NoiseStore::GetFreqShare(op.fStore->GetNumFreqs(), Member, fNoiseGroupSize, Begin, End);
+  op.GetRowsForFreqs(Begin, End, FirstRow, NumRows);
+}
 
-  // Clean up, to be ready for the next call.
-  fNoiseMulQueue.clear(); // Hopefully doesn't free memory, since I'll need it again.
-  fNumVectorsInQueue = 0;
+void EXORefitSignals::CountGroupRows(std::vector<int>& ToEach, std::vector<int>& FromEach) const
+{
+  // Number of doubles we send to each member of the noise group in ExchangeNoiseRows, and receive from each.
+  // (ExchangeNoiseResults sends them back the other way.)
+  const size_t Me = fNoiseGroup.rank();
+  std::vector<size_t> To(fNoiseGroupSize, 0), From(fNoiseGroupSize, 0);
+  for(size_t i = 0; i < fOperatorsToMultiply.size(); i++) {
+    const NoiseOperator& op = *fOperatorsToMultiply[i];
+    size_t FirstRow, NumRows, OurNumRows;
+    GetGroupRows(op, Me, FirstRow, OurNumRows);
+    for(size_t r = 0; r < fNoiseGroupSize; r++) {
+      GetGroupRows(op, r, FirstRow, NumRows);
+      To[r] += fGroupCounts[i][Me]*NumRows;
+      From[r] += fGroupCounts[i][r]*OurNumRows;
+    }
+  }
+  for(size_t r = 0; r < fNoiseGroupSize; r++) {
+    if(To[r] > size_t(INT_MAX) or From[r] > size_t(INT_MAX)) {
+      std::cout<<"Too many noise rows to exchange in one pass; use a smaller batch."<<std::endl;
+      std::exit(1);
+    }
+  }
+  ToEach.assign(To.begin(), To.end());
+  FromEach.assign(From.begin(), From.end());
 }
 
-void EXORefitSignals::DoNoiseMultiplication_FromQueue(
-  boost::lockfree::queue<size_t, boost::lockfree::capacity<MAX_F-MIN_F+1> >& freq_queue)
+static void ExchangeWithGroup(const boost::mpi::communicator& Group,
+                              const std::vector<double>& Send, const std::vector<int>& SendCounts,
+                              std::vector<double>& Recv, const std::vector<int>& RecvCounts)
 {
-  // Perform noise multiplications on frequencies from the queue, until it is empty.
-  assert(fNoiseMulQueue.size() == fNoiseColumnLength*fNumVectorsInQueue);
-  assert(fNoiseMulResult.size() == fNoiseColumnLength*fNumVectorsInQueue);
+  // Send SendCounts[r] doubles to each member r, taken in order from Send; receive RecvCounts[r] from each into Recv.
+  std::vector<int> SendDispls(SendCounts.size(), 0), RecvDispls(RecvCounts.size(), 0);
+  for(size_t r = 1; r < SendCounts.size(); r++) {
+    SendDispls[r] = SendDispls[r-1] + SendCounts[r-1];
+    RecvDispls[r] = RecvDispls[r-1] + RecvCounts[r-1];
+  }
+  assert(Send.size() >= size_t(SendDispls.back() + SendCounts.back()));
+  Recv.resize(std::max<size_t>(1, RecvDispls.back() + RecvCounts.back()));
+  MPI_Alltoallv(const_cast<double*>(&Send[0]), const_cast<int*>(&SendCounts[0]), &SendDispls[0], MPI_DOUBLE,
+                &Recv[0], const_cast<int*>(&RecvCounts[0]), &RecvDispls[0], MPI_DOUBLE, MPI_Comm(Group));
+}
 
-  size_t f;
-  while(freq_queue.pop(f)) {
-    assert(fNoiseCorrelations.size() > f);
-    size_t StartIndex = 2*fChannels.size()*f;
-    size_t BlockSize = fChannels.size() * (f < MAX_F - MIN_F ? 2 : 1);
-    assert(fNoiseCorrelations[f].size() == BlockSize*BlockSize);
+void EXORefitSignals::ExchangeNoiseRows(size_t Buffer)
+{
+  // Collective over the noise group:  send each member the rows for its frequencies of every vector we queued in
+  // Buffer, and gather the rows for ours of every vector queued in the group.  For each operator, fGroupQueue then holds
+  // member 0's vectors, then member 1's, and so on; and fMulIn etc. point there, to multiply just those rows.
+  static SafeStopwatch ExchangeWatch("ExchangeNoiseRows (sequential)");
+  SafeStopwatch::tag ExchangeTag = ExchangeWatch.Start();
+  const size_t Me = fNoiseGroup.rank();
+  std::vector<int> ToEach, FromEach;
+  CountGroupRows(ToEach, FromEach);
+
+  // Pack by destination, then by operator, then by vector.
+  fGroupSendBuffer.resize(std::max<size_t>(1, std::accumulate(ToEach.begin(), ToEach.end(), size_t(0))));
+  double* SendPos = &fGroupSendBuffer[0];
+  for(size_t r = 0; r < fNoiseGroupSize; r++) {
+    for(size_t i = 0; i < fOperatorsToMultiply.size(); i++) {
+      const NoiseOperator& op = *fOperatorsToMultiply[i];
+      size_t FirstRow, NumRows;
+      GetGroupRows(op, r, FirstRow, NumRows);
+      for(size_t col = 0; col < fGroupCounts[i][Me]; col++) {
+        size_t Index = FirstRow + col*op.fNoiseColumnLength;
+        if(op.IsSingle()) {
+          const float* Column = &op.fNoiseMulQueueSingle[Buffer][Index];
+          SendPos = std::copy(Column, Column + NumRows, SendPos);
+        }
+        else {
+          const double* Column = &op.fNoiseMulQueue[Buffer][Index];
+          SendPos = std::copy(Column, Column + NumRows, SendPos);
+        }
+      }
+    }
+  }
+  ExchangeWithGroup(fNoiseGroup, fGroupSendBuffer, ToEach, fGroupRecvBuffer, FromEach);
+
+  // Unpack, by source member, into each operator's group queue.
+  std::vector<size_t> NextCol(fOperatorsToMultiply.size(), 0);
+  const double* RecvPos = &fGroupRecvBuffer[0];
+  for(size_t i = 0; i < fOperatorsToMultiply.size(); i++) {
+    NoiseOperator& op = *fOperatorsToMultiply[i];
+    size_t FirstRow, NumRows;
+    GetGroupRows(op, Me, FirstRow, NumRows);
+    op.fMulNumVectors = std::accumulate(fGroupCounts[i].begin(), fGroupCounts[i].end(), size_t(0));
+    op.fMulColumnLength = NumRows;
+    op.fMulFirstRow = FirstRow;
+    size_t Length = std::max<size_t>(1, NumRows*op.fMulNumVectors);
+    if(op.IsSingle()) {
+      op.fGroupQueueSingle.resize(Length);
+      op.fGroupResultSingle.resize(Length); // Do not initialize.
+      op.fMulInSingle = &op.fGroupQueueSingle[0];
+      op.fMulOutSingle = &op.fGroupResultSingle[0];
+      op.fNoiseMulResultSingle[Buffer].resize(op.fNoiseColumnLength*fGroupCounts[i][Me]);
+    }
+    else {
+      op.fGroupQueue.resize(Length);
+      op.fGroupResult.resize(Length); // Do not initialize.
+      op.fMulIn = &op.fGroupQueue[0];
+      op.fMulOut = &op.fGroupResult[0];
+      op.fNoiseMulResult[Buffer].resize(op.fNoiseColumnLength*fGroupCounts[i][Me]);
+    }
+  }
+  for(size_t r = 0; r < fNoiseGroupSize; r++) {
+    for(size_t i = 0; i < fOperatorsToMultiply.size(); i++) {
+      NoiseOperator& op = *fOperatorsToMultiply[i];
+      size_t Length = fGroupCounts[i][r]*op.fMulColumnLength;
+      size_t Index = NextCol[i]*op.fMulColumnLength;
+      if(op.IsSingle()) std::copy(RecvPos, RecvPos + Length, op.fGroupQueueSingle.begin() + Index);
+      else std::copy(RecvPos, RecvPos + Length, op.fGroupQueue.begin() + Index);
+      RecvPos += Length;
+      NextCol[i] += fGroupCounts[i][r];
+    }
+  }
+  ExchangeWatch.Stop(ExchangeTag);
+}
 
-    static SafeStopwatch NoiseMulRangeWatch("DoNoiseMultiplication_Range (threaded)");
-    SafeStopwatch::tag NoiseMulRangeTag = NoiseMulRangeWatch.Start(); // Don't count vector allocation.
-    cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
-                BlockSize, fNumVectorsInQueue, BlockSize,
-                1, &fNoiseCorrelations[f][0], BlockSize, &fNoiseMulQueue[StartIndex], fNoiseColumnLength,
-                0, &fNoiseMulResult[StartIndex], fNoiseColumnLength);
-    NoiseMulRangeWatch.Stop(NoiseMulRangeTag);
+void EXORefitSignals::ExchangeNoiseResults(size_t Buffer)
+{
+  // The reverse of ExchangeNoiseRows:  send each member our rows of the results for its vectors,
+  // and put the rows we get back into the fNoiseMulResult[Buffer] of our own vectors.
+  static SafeStopwatch ExchangeWatch("ExchangeNoiseResults (sequential)");
+  SafeStopwatch::tag ExchangeTag = ExchangeWatch.Start();
+  const size_t Me = fNoiseGroup.rank();
+  std::vector<int> FromEach, ToEach;
+  CountGroupRows(FromEach, ToEach);
+
+  fGroupSendBuffer.resize(std::max<size_t>(1, std::accumulate(ToEach.begin(), ToEach.end(), size_t(0))));
+  double* SendPos = &fGroupSendBuffer[0];
+  std::vector<size_t> NextCol(fOperatorsToMultiply.size(), 0);
+  for(size_t r = 0; r < fNoiseGroupSize; r++) {
+    for(size_t i = 0; i < fOperatorsToMultiply.size(); i++) {
+      const NoiseOperator& op = *fOperatorsToMultiply[i];
+      size_t Index = NextCol[i]*op.fMulColumnLength;
+      size_t Length = fGroupCounts[i][r]*op.fMulColumnLength;
+      if(op.IsSingle()) {
+        SendPos = std::copy(&op.fGroupResultSingle[Index], &op.fGroupResultSingle[Index] + Length, SendPos);
+      }
+      else {
+        SendPos = std::copy(&op.fGroupResult[Index], &op.fGroupResult[Index] + Length, SendPos);
+      }
+      NextCol[i] += fGroupCounts[i][r];
+    }
+  }
+  ExchangeWithGroup(fNoiseGroup, fGroupSendBuffer, ToEach, fGroupRecvBuffer, FromEach);
+
+  const double* RecvPos = &fGroupRecvBuffer[0];
+  for(size_t r = 0; r < fNoiseGroupSize; r++) {
+    for(size_t i = 0; i < fOperatorsToMultiply.size(); i++) {
+      NoiseOperator& op = *fOperatorsToMultiply[i];
+      size_t FirstRow, NumRows;
+      GetGroupRows(op, r, FirstRow, NumRows);
+      for(size_t col = 0; col < fGroupCounts[i][Me]; col++) {
+        size_t Index = FirstRow + col*op.fNoiseColumnLength;
+        if(op.IsSingle()) std::copy(RecvPos, RecvPos + NumRows, &op.fNoiseMulResultSingle[Buffer][Index]);
+        else std::copy(RecvPos, RecvPos + NumRows, &op.fNoiseMulResult[Buffer][Index]);
+        RecvPos += NumRows;
+      }
+    }
+  }
+  ExchangeWatch.Stop(ExchangeTag);
+}
+
+void EXORefitSignals::DoNoiseMultiplication()
+{
+  // Run by every thread, between StartNoiseMultiplication and FinishNoiseMultiplication:
+  // do the multiplication, one call for every operator and frequency.
+  if(fNUMALocalNoise) {
+    // Each thread does the frequencies whose blocks and rows were placed near it.
+    DoNoiseMultiplication_OwnShare();
+  }
+  else {
+    // Every thread works through its own items, then steals until none are left.
+    DoNoiseMultiplication_Steal();
   }
 }
 
+void EXORefitSignals::DoNoiseMultiplication_Steal()
+{
+  // Perform noise multiplications on (operator, frequency, column tile) items from fNoiseMulItems, until none are left.
+  // We want to handle every frequency index we own for each operator (normally, the inclusive range [0, fMaxF-MIN_F]).
+  // Tiles of the same frequency are numbered consecutively, so a thread mostly runs through every tile of a block
+  // while that block is still in its cache; and whole frequencies were uneven work units (the last is a quarter
+  // the size of the others), while tiles leave much less imbalance at the end.
+  const size_t ThreadIndex = WorkerPool::GetThreadIndex();
+  size_t item;
+  while(fNoiseMulItems->Pop(ThreadIndex, item)) {
+    size_t opIndex = 0;
+    while(item >= fFirstNoiseMulItem[opIndex+1]) opIndex++;
+    NoiseOperator& op = *fOperatorsToMultiply[opIndex];
+    item -= fFirstNoiseMulItem[opIndex];
+    size_t NumTiles = GetNumNoiseMulTiles(op);
+    size_t FirstCol = (item % NumTiles)*fNoiseMulTileColumns;
+    size_t NumCols = std::min(fNoiseMulTileColumns, op.fMulNumVectors - FirstCol);
+    DoNoiseMultiplication_Frequency(op, op.fStore->GetFirstOwnedFreq() + item / NumTiles, FirstCol, NumCols);
+  }
+}
+
+void EXORefitSignals::DoNoiseMultiplication_OwnShare()
+{
+  // Perform noise multiplications on this thread's own, fixed share of the frequencies we own
+  // (with fNUMALocalNoise, the share whose blocks and rows were placed on this thread's NUMA node).
+  for(size_t i = 0; i < fOperatorsToMultiply.size(); i++) {
+    NoiseOperator& op = *fOperatorsToMultiply[i];
+    size_t Begin, End;
+    fWorkerPool->GetShare(op.fStore->GetEndOwnedFreq() - op.fStore->GetFirstOwnedFreq(), Begin, End);
+    for(size_t f = Begin; f < End; f++) {
+      DoNoiseMultiplication_Frequency(op, op.fStore->GetFirstOwnedFreq() + f, 0, op.fMulNumVectors);
+    }
+  }
+}
+
+void EXORefitSignals::DoNoiseMultiplication_Frequency(NoiseOperator& op, size_t f, size_t FirstCol, size_t NumCols)
+{
+  // Multiply vectors [FirstCol, FirstCol + NumCols) of this pass (see StartNoiseMultiplication)
+  // by the block for frequency index f.
+  assert(op.fStore->OwnsFreq(f));
+  assert(FirstCol + NumCols <= op.fMulNumVectors);
+  size_t StartIndex = 2*op.fChannels.size()*f - op.fMulFirstRow + FirstCol*op.fMulColumnLength;
+
+  static SafeStopwatch NoiseMulRangeWatch("DoNoiseMultiplication_Range (threaded)");
+  SafeStopwatch::tag NoiseMulRangeTag = NoiseMulRangeWatch.Start(); // Don't count vector allocation.
+  if(op.IsSingle()) {
+    op.fStore->MultiplyBlock(f, op.fMulInSingle + StartIndex, op.fMulOutSingle + StartIndex,
+                             NumCols, op.fMulColumnLength);
+  }
+  else op.fStore->MultiplyBlock(f, op.fMulIn + StartIndex, op.fMulOut + StartIndex, NumCols, op.fMulColumnLength);
+  NoiseMulRangeWatch.Stop(NoiseMulRangeTag);
+}
+
 void EXORefitSignals::DoInvLPrecon(std::vector<double>& in, EventHandler& event)
 {
   // Multiply by K1_inv in-place.
-  mkl_dimatcopy('C', 'N', event.fNumSignals, event.fNumSignals,
-                -1, &in[fNoiseColumnLength], event.fColumnLength, event.fColumnLength); // in = {{v1} {-v2}}
-  DoLagrangeAndConstraintMul<'C', true>(in, in, event); // in = {{v1} {trans(L)D^(-1/2)v1 - v2}}
-  cblas_dtrsm(CblasColMajor, CblasLeft, CblasUpper, CblasTrans, CblasNonUnit,
-              event.fNumSignals, event.fNumSignals,
-              1, &event.fPreconX[0], event.fNumSignals,
-              &in[fNoiseColumnLength], event.fColumnLength);
+  // (If HasNoiseFactor(), read C_inv D^(-1/2)L = G for D^(-1/2)L, and C_inv v1 for v1, throughout; see DoNoiseFactorMul.)
+  if(HasNoiseFactor()) DoNoiseFactorMul(in, event, false, true);
+  LinAlg::imatcopy('N', event.fNumSignals, event.fNumColumns,
+                   -1, &in[event.fNoiseColumnLength], event.fColumnLength, event.fColumnLength); // in = {{v1} {-v2}}
+  if(HasNoiseFactor()) {
+    LinAlg::gemm('T', 'N', event.fNumSignals, event.fNumColumns, event.fNoiseColumnLength,
+                 1, &event.fPreconG[0], event.fColumnLength, &in[0], event.fColumnLength,
+                 1, &in[event.fNoiseColumnLength], event.fColumnLength);
+  }
+  else DoLagrangeAndConstraintMul<'C', true>(in, in, event); // in = {{v1} {trans(L)D^(-1/2)v1 - v2}}
+  LinAlg::trsm('L', 'U', 'T', 'N',
+               event.fNumSignals, event.fNumColumns,
+               1, &event.fPreconX[0], event.fNumSignals,
+               &in[event.fNoiseColumnLength], event.fColumnLength);
   // in = {{v1} {Inv(trans(X))(trans(L)D^(-1)v1 - v2)}}.
 }
 
 void EXORefitSignals::DoInvRPrecon(std::vector<double>& in, EventHandler& event)
 {
   // Multiply by K2_inv in-place.
-  cblas_dtrsm(CblasColMajor, CblasLeft, CblasUpper, CblasNoTrans, CblasNonUnit,
-              event.fNumSignals, event.fNumSignals,
-              1, &event.fPreconX[0], event.fNumSignals,
-              &in[fNoiseColumnLength], event.fColumnLength); // in = {{v1} {X^(-1)v2}}
-  DoLagrangeAndConstraintMul<'L', false>(in, in, event); // in = {{v1 - D^(-1/2)LX^(-1)v2} {X^(-1)v2}}
+  LinAlg::trsm('L', 'U', 'N', 'N',
+               event.fNumSignals, event.fNumColumns,
+               1, &event.fPreconX[0], event.fNumSignals,
+               &in[event.fNoiseColumnLength], event.fColumnLength); // in = {{v1} {X^(-1)v2}}
+  if(HasNoiseFactor()) {
+    LinAlg::gemm('N', 'N', event.fNoiseColumnLength, event.fNumColumns, event.fNumSignals,
+                 -1, &event.fPreconG[0], event.fColumnLength, &in[event.fNoiseColumnLength], event.fColumnLength,
+                 1, &in[0], event.fColumnLength);
+    DoNoiseFactorMul(in, event, true, true);
+  }
+  else DoLagrangeAndConstraintMul<'L', false>(in, in, event); // in = {{v1 - D^(-1/2)LX^(-1)v2} {X^(-1)v2}}
 }
 
 void EXORefitSignals::DoLPrecon(std::vector<double>& in, EventHandler& event)
 {
   // Multiply by K1 in-place.
-  cblas_dtrmm(CblasColMajor, CblasLeft, CblasUpper, CblasTrans, CblasNonUnit,
-              event.fNumSignals, event.fNumSignals,
-              -1, &event.fPreconX[0], event.fNumSignals,
-              &in[fNoiseColumnLength], event.fColumnLength); // in = {{v1} {-trans(X)v2}}
-  DoLagrangeAndConstraintMul<'C', true>(in, in, event); // in = {{v1} {trans(L)D^(-1/2)v1 - trans(X)v2}}
+  LinAlg::trmm('L', 'U', 'T', 'N',
+               event.fNumSignals, event.fNumColumns,
+               -1, &event.fPreconX[0], event.fNumSignals,
+               &in[event.fNoiseColumnLength], event.fColumnLength); // in = {{v1} {-trans(X)v2}}
+  if(HasNoiseFactor()) {
+    LinAlg::gemm('T', 'N', event.fNumSignals, event.fNumColumns, event.fNoiseColumnLength,
+                 1, &event.fPreconG[0], event.fColumnLength, &in[0], event.fColumnLength,
+                 1, &in[event.fNoiseColumnLength], event.fColumnLength);
+    DoNoiseFactorMul(in, event, false, false);
+  }
+  else DoLagrangeAndConstraintMul<'C', true>(in, in, event); // in = {{v1} {trans(L)D^(-1/2)v1 - trans(X)v2}}
 }
 
 void EXORefitSignals::DoRPrecon(std::vector<double>& in, EventHandler& event)
 {
   // Multiply by K2 in-place.
-  DoLagrangeAndConstraintMul<'L', true>(in, in, event); // out = {{v1 + D^(-1/2)Lv2} {v2}}
-  cblas_dtrmm(CblasColMajor, CblasLeft, CblasUpper, CblasNoTrans, CblasNonUnit,
-              event.fNumSignals, event.fNumSignals,
-              1, &event.fPreconX[0], event.fNumSignals,
-              &in[fNoiseColumnLength], event.fColumnLength); // out = {{v1 + D^(-1/2)Lv2} {Xv2}}
+  if(HasNoiseFactor()) {
+    DoNoiseFactorMul(in, event, true, false);
+    LinAlg::gemm('N', 'N', event.fNoiseColumnLength, event.fNumColumns, event.fNumSignals,
+                 1, &event.fPreconG[0], event.fColumnLength, &in[event.fNoiseColumnLength], event.fColumnLength,
+                 1, &in[0], event.fColumnLength);
+  }
+  else DoLagrangeAndConstraintMul<'L', true>(in, in, event); // out = {{v1 + D^(-1/2)Lv2} {v2}}
+  LinAlg::trmm('L', 'U', 'N', 'N',
+               event.fNumSignals, event.fNumColumns,
+               1, &event.fPreconX[0], event.fNumSignals,
+               &in[event.fNoiseColumnLength], event.fColumnLength); // out = {{v1 + D^(-1/2)Lv2} {Xv2}}
 }
 
-size_t EXORefitSignals::RequestNoiseMul(std::vector<double>& vec,
-                                        size_t ColLength)
+void EXORefitSignals::DoNoiseFactorMul(std::vector<double>& in, EventHandler& event, bool Transpose, bool Inverse)
 {
-  // Request a noise multiplication on vec.
-  // Return value indicates where to retrieve results.
-  assert(fNoiseColumnLength <= ColLength);
-  assert(vec.size() % ColLength == 0);
-  size_t NumCols = vec.size() / ColLength;
+  // Multiply the noise rows of in, in place, by C, trans(C), C_inv or trans(C)_inv, where D = C trans(C) stands in
+  // for the noise matrix (plus the Poisson terms) in the preconditioner.  We take D = S N S:
+  //   N = trans(U) U is the noise matrix, factored once per noise operator (see PrepareNoiseBlocks), with fBlockPrecon;
+  //     else its diagonal, which is I -- except in the directions Y recycled from earlier events (see AddRecycleVectors),
+  //     if event.fUseRecycled.  Those are Ritz vectors of the noise, with N Y ~ Y diag(theta); so we take
+  //     N = I + Y (diag(theta) - I) trans(Y), which has the symmetric square root I + Y (diag(theta)^(1/2) - I) trans(Y).
+  //   S is diagonal and per-event (event.fPreconScale, see SetPoissonDiagonal), with fPreconPoissonDiagonal; else I.
+  // So C = S trans(U).  Scaling N keeps its correlations, and (since N has ones on the diagonal) gets the diagonal of
+  // the Poisson terms exactly right, without factoring anything per event.
+  // But the Poisson terms are low-rank, which Krylov solvers already deal with well; their diagonal alone can
+  // do more harm than good, which is why it's optional.
+  const NoiseOperator& op = *event.fNoiseOperator;
+  const size_t ColLength = event.fColumnLength;
+  const bool ScaleFirst = (Transpose != Inverse); // trans(C) = U S and C_inv = U_inv^T S_inv start with S.
+  const char TransU = (Transpose ? 'N' : 'T');
+  for(size_t pass = 0; pass < 2; pass++) {
+    if((pass == 0) == ScaleFirst) {
+      if(event.fPreconScale.empty()) continue;
+      for(size_t col = 0; col < event.fNumColumns; col++) {
+        for(size_t i = 0; i < op.fNoiseColumnLength; i++) {
+          if(Inverse) in[col*ColLength + i] /= event.fPreconScale[i];
+          else in[col*ColLength + i] *= event.fPreconScale[i];
+        }
+      }
+    }
+    else if(event.fUseRecycled) {
+      const size_t k = op.GetNumRecycled();
+      std::vector<double> Coefs(k*event.fNumColumns);
+      LinAlg::gemm('T', 'N', k, event.fNumColumns, op.fNoiseColumnLength,
+                   1, &op.fRecycleY[0], op.fNoiseColumnLength, &in[0], ColLength,
+                   0, &Coefs[0], k);
+      for(size_t col = 0; col < event.fNumColumns; col++) {
+        for(size_t i = 0; i < k; i++) {
+          double RootTheta = std::sqrt(op.fRecycleRitz[i]);
+          Coefs[col*k + i] *= (Inverse ? 1/RootTheta : RootTheta) - 1;
+        }
+      }
+      LinAlg::gemm('N', 'N', op.fNoiseColumnLength, event.fNumColumns, k,
+                   1, &op.fRecycleY[0], op.fNoiseColumnLength, &Coefs[0], k,
+                   1, &in[0], ColLength);
+    }
+    else {
+      if(not fBlockPrecon) continue;
+      for(size_t f = 0; f < op.fStore->GetNumFreqs(); f++) {
+        size_t BlockSize = op.fStore->GetBlockSize(f);
+        size_t FirstRow = 2*op.fChannels.size()*f;
+        const double* U = &op.fNoiseBlockFactors[op.fNoiseBlockOffsets[f]];
+        if(Inverse) {
+          LinAlg::trsm('L', 'U', TransU, 'N', BlockSize, event.fNumColumns,
+                       1, U, BlockSize, &in[FirstRow], ColLength);
+        }
+        else {
+          LinAlg::trmm('L', 'U', TransU, 'N', BlockSize, event.fNumColumns,
+                       1, U, BlockSize, &in[FirstRow], ColLength);
+        }
+      }
+    }
+  }
+}
 
-#ifdef USE_THREADS
-  boost::mutex::scoped_lock sL(RequestNoiseMulMutex); // Protect fNoiseMulQueue.
-#endif
+void EXORefitSignals::SetPoissonDiagonal(EventHandler& event)
+{
+  // Set event.fPreconScale = sqrt(1 + diagonal of the Poisson terms), for DoNoiseFactorMul.
+  event.fPreconScale.assign(event.fNoiseColumnLength, 1);
+  const size_t NumChannels = event.fChannels.size();
+  for(size_t m = 0; m < event.fAPDModel.size(); m++) {
+    const ModelManager& modelManager = event.fAPDModel[m];
+    for(std::set<unsigned char>::const_iterator it = modelManager.fHitChannels.begin();
+        it != modelManager.fHitChannels.end();
+        it++) {
+      double Scale = GetPoissonScale(modelManager, *it, event);
+      for(size_t i = *it; i < event.fNoiseColumnLength; i += NumChannels) {
+        event.fPreconScale[i] += Scale*modelManager.fModel[i]*modelManager.fModel[i];
+      }
+    }
+  }
+  for(size_t i = 0; i < event.fNoiseColumnLength; i++) event.fPreconScale[i] = std::sqrt(event.fPreconScale[i]);
+}
 
-  size_t InitSize = fNoiseMulQueue.size();
-  assert(InitSize == fNumVectorsInQueue*fNoiseColumnLength);
-  fNoiseMulQueue.reserve(InitSize + NumCols*fNoiseColumnLength);
-  for(size_t i = 0; i < NumCols; i++) {
-    fNoiseMulQueue.insert(fNoiseMulQueue.end(),
-                          vec.begin() + i*ColLength,
-                          vec.begin() + i*ColLength + fNoiseColumnLength);
+void EXORefitSignals::ReserveNoiseMul(EventHandler& event)
+{
+  // Reserve a slot for event's columns in its noise operator's queue (in the event's buffer), at fResultIndex.
+  // The caller writes the noise rows of each column straight into the slot, with stride fNoiseColumnLength;
+  // after multiplication, FillFromNoise copies the results out of the same position of fNoiseMulResult.
+  // A slot is claimed with a fetch-add on the count, so threads request in parallel without a lock.
+  // Slots never move, because the queue is never resized while events are being handled:  it only grows in
+  // GrowNoiseMulQueue, as events are accepted, and every event handled in a pass asks again for (at most)
+  // the columns it had in the last multiplication of its buffer.
+  // Relaxed ordering is enough; the counts and slots are only read after RunOnAll has joined the writers.
+  NoiseOperator& op = *event.fNoiseOperator;
+  const size_t Buffer = event.fNoiseBuffer;
+  const size_t NumCols = event.fNumColumns;
+  size_t FirstVector = op.fNumVectorsInQueue[Buffer].fetch_add(NumCols, boost::memory_order_relaxed);
+  fNumVectorsInQueue[Buffer].fetch_add(NumCols, boost::memory_order_relaxed);
+  event.fResultIndex = FirstVector*op.fNoiseColumnLength;
+  assert(event.fResultIndex + NumCols*op.fNoiseColumnLength <= op.GetQueueLength(Buffer));
+}
+
+template<typename T>
+static void GrowQueue(WorkerPool* Pool, const NoiseOperator& op, QueueBuffer<T>& Queue, QueueBuffer<T>& Result,
+                      size_t Length)
+{
+  // For GrowNoiseMulQueue:  resize Queue to Length, placing it (and Result) anew with Pool if it has to move.
+  if(Pool and Length > Queue.capacity()) {
+    size_t Capacity = std::max(Length, 2*Queue.capacity());
+    PlaceQueue(*Pool, op, Queue, Capacity);
+    PlaceQueue(*Pool, op, Result, Capacity);
   }
-  fNumVectorsInQueue += NumCols;
+  Queue.resize(Length);
+}
+
+void EXORefitSignals::GrowNoiseMulQueue(EventHandler& event)
+{
+  // Make sure the event's buffer has room for one more request from it.
+  // Only call this while no thread is handling events, since it may move every slot in the buffer.
+  NoiseOperator& op = *event.fNoiseOperator;
+  const size_t Buffer = event.fNoiseBuffer;
+  size_t Length = (op.fNumVectorsInQueue[Buffer] + event.fNumSignals)*op.fNoiseColumnLength;
+  if(op.GetQueueLength(Buffer) >= Length) return;
+  // If it has to move, then with fNUMALocalNoise, move it (and the result, which would move once it caught up)
+  // into fresh memory ourselves, so that each row stays on the NUMA node of the thread which multiplies it.
+  WorkerPool* Pool = (fNUMALocalNoise ? fWorkerPool : NULL);
+  if(op.IsSingle()) GrowQueue(Pool, op, op.fNoiseMulQueueSingle[Buffer], op.fNoiseMulResultSingle[Buffer], Length);
+  else GrowQueue(Pool, op, op.fNoiseMulQueue[Buffer], op.fNoiseMulResult[Buffer], Length);
+}
 
-  return InitSize;
+void EXORefitSignals::RequestNoiseMul(const std::vector<double>& vec,
+                                      EventHandler& event)
+{
+  // Request a noise multiplication on vec, using the event's noise operator and buffer.
+  // event.fResultIndex is set to indicate where to retrieve results.
+  NoiseOperator& op = *event.fNoiseOperator;
+  size_t ColLength = event.fColumnLength;
+  assert(op.fNoiseColumnLength <= ColLength);
+  assert(vec.size() == event.fNumColumns*ColLength);
+
+  // Copy the noise rows straight into our slot (rounding them, for a single-precision store).
+  ReserveNoiseMul(event);
+  for(size_t i = 0; i < event.fNumColumns; i++) {
+    size_t Index = event.fResultIndex + i*op.fNoiseColumnLength;
+    std::vector<double>::const_iterator Column = vec.begin() + i*ColLength;
+    if(op.IsSingle()) {
+      std::copy(Column, Column + op.fNoiseColumnLength, &op.fNoiseMulQueueSingle[event.fNoiseBuffer][Index]);
+    }
+    else std::copy(Column, Column + op.fNoiseColumnLength, &op.fNoiseMulQueue[event.fNoiseBuffer][Index]);
+  }
 }
 
 void EXORefitSignals::FillFromNoise(std::vector<double>& vec,
-                                    size_t NumCols,
-                                    size_t ColLength,
-                                    size_t ResultIndex)
+                                    const EventHandler& event)
 {
-  // Overwrite in with the results from noise multiplication.
+  // Overwrite vec with the results from noise multiplication, copied out of the event's slot.
+  // (They can't be used in place:  the solvers keep them past the next pass, when the slot is handed out again,
+  // and need them as whole columns, with the constraint rows after the noise rows.)
   // Leave zeros for rows which are not subject to noise multiplication terms.
-  assert(fNoiseColumnLength <= ColLength);
-  assert(ResultIndex % fNoiseColumnLength == 0);
-  assert(ResultIndex + NumCols*fNoiseColumnLength <= fNoiseMulResult.size());
-
-  vec.assign(NumCols*ColLength, 0);
+  // vec is built up column by column rather than zeroed first, so each element is only written once;
+  // and clear() keeps its memory, so vectors which are refilled every iteration aren't reallocated.
+  // Results from a single-precision store are widened as they are copied.
+  const NoiseOperator& op = *event.fNoiseOperator;
+  const size_t Buffer = event.fNoiseBuffer;
+  size_t NumCols = event.fNumColumns;
+  size_t ColLength = event.fColumnLength;
+  size_t ResultIndex = event.fResultIndex;
+  assert(op.fNoiseColumnLength <= ColLength);
+  assert(ResultIndex % op.fNoiseColumnLength == 0);
+  assert(ResultIndex + NumCols*op.fNoiseColumnLength <=
+         (op.IsSingle() ? op.fNoiseMulResultSingle[Buffer].size() : op.fNoiseMulResult[Buffer].size()));
+
+  vec.clear();
+  vec.reserve(NumCols*ColLength);
   for(size_t i = 0; i < NumCols; i++) {
-    std::copy(fNoiseMulResult.begin() + ResultIndex +  i   *fNoiseColumnLength,
-              fNoiseMulResult.begin() + ResultIndex + (i+1)*fNoiseColumnLength,
-              vec.begin() + i*ColLength);
+    size_t Index = ResultIndex + i*op.fNoiseColumnLength;
+    if(op.IsSingle()) {
+      const float* Column = &op.fNoiseMulResultSingle[Buffer][Index];
+      vec.insert(vec.end(), Column, Column + op.fNoiseColumnLength);
+    }
+    else {
+      const double* Column = &op.fNoiseMulResult[Buffer][Index];
+      vec.insert(vec.end(), Column, Column + op.fNoiseColumnLength);
+    }
+    vec.insert(vec.end(), ColLength - op.fNoiseColumnLength, 0.0);
   }
 }
 
@@ -1357,7 +2716,7 @@ EventHandler* EXORefitSignals::PopAnEvent()
   // Return an event to process, or NULL if there isn't one.
   // Make sure this is thread-safe.
   EventHandler* evt = NULL;
-  if(not fEventHandlerQueue.pop(evt)) evt = NULL;
+  if(not fMultipliedEvents.pop(evt)) evt = NULL;
   return evt;
 }
 
@@ -1377,11 +2736,7 @@ void EXORefitSignals::HandleEventsInThread()
   EventHandler* evt = NULL;
   while(evt = PopAnEvent()) {
     // We just drew an event pointer from the queue; handle it.
-    static SafeStopwatch DoBlBiCGSTABWatch("DoBlBiCGSTAB (threaded)");
-    SafeStopwatch::tag DoBlBiCGSTABTag = DoBlBiCGSTABWatch.Start();
-    bool Result = DoBlBiCGSTAB(*evt);
-    DoBlBiCGSTABWatch.Stop(DoBlBiCGSTABTag);
-    if(Result) {
+    if(DoSolverStep(*evt)) {
       // This event is done.
       static SafeStopwatch FinishEventWatch("FinishEvent (threaded)");
       SafeStopwatch::tag FinishEventTag = FinishEventWatch.Start();
@@ -1396,44 +2751,88 @@ void EXORefitSignals::HandleEventsInThread()
   HandleEventsWatch.Stop(HandleEventsTag);
 }
 
-void EXORefitSignals::DoPassThroughEvents()
+void EXORefitSignals::HandleEventsThenMultiply()
+{
+  // Function for each thread in a pipelined pass:  handle events until none are left, then help
+  // with the multiplication.  Threads which run out of events go straight on to the multiplication,
+  // rather than waiting at a barrier for the slowest event.
+  HandleEventsInThread();
+  DoNoiseMultiplication();
+}
+
+static void MoveAllEvents(queue_type& from, queue_type& to)
+{
+  // Transfer entries from one queue into another (only while no other thread is using them).
+  EventHandler* evt = NULL;
+  while(from.unsynchronized_pop(evt)) assert(to.unsynchronized_push(evt));
+}
+
+bool EXORefitSignals::DoPassThroughEvents()
 {
   // Do a pass through the event handlers we've accumulated;
   // do a round of noise multiplication followed by a round of BiCGSTAB.
+  // With fPipelinePasses, the two rounds overlap instead:  the buffer which fEventHandlerQueue's events
+  // are waiting on is multiplied while fMultipliedEvents are handled, and those queue their next requests
+  // in the other buffer, to be multiplied during the next pass.
+  // In a noise group, every member takes part in every pass (multiplying its frequencies of everybody's vectors),
+  // even once its own events are done, until nobody has any left.  Returns false, doing nothing, once that's so
+  // (or, outside a group, if we have no events).
+  bool Busy = not fEventHandlerQueue.empty() or not fMultipliedEvents.empty();
+  if(fNoiseGroupSize > 1) Busy = PlanNoiseGroupPass(Busy, fFillingBuffer);
+  if(not Busy) return false;
+
   static SafeStopwatch DoPassWatch("DoPassThroughEvents (sequential)");
   SafeStopwatch::tag DoPassTag = DoPassWatch.Start();
-
-  static SafeStopwatch NoiseMulWatch("Noise multiplication (sequential)");
-  SafeStopwatch::tag NoiseMulTag = NoiseMulWatch.Start();
-  DoNoiseMultiplication();
   assert(fEventHandlerResults.empty());
-  NoiseMulWatch.Stop(NoiseMulTag);
 
-  static SafeStopwatch HandleEventsWatch("HandleEvents (sequential)");
-  SafeStopwatch::tag HandleEventsTag = HandleEventsWatch.Start();
-  if(fVerbose) std::cout<<"Starting HandleEvents."<<std::endl;
-#ifdef USE_THREADS
-  boost::thread_group threads;
-  for(size_t i = 0; i < (NUM_THREADS)-1; i++) {
-    threads.add_thread(new boost::thread(&EXORefitSignals::HandleEventsInThread, this));
+  const size_t Buffer = fFillingBuffer;
+  StartNoiseMultiplication(Buffer);
+  const size_t NumVectors = fNumVectorsInQueue[Buffer];
+  double Flops = 0;
+  for(size_t i = 0; i < fOperatorsToMultiply.size(); i++) {
+    const NoiseOperator& op = *fOperatorsToMultiply[i];
+    Flops += op.fMulNumVectors*op.fStore->GetFlopsPerVector();
+  }
+  boost::timer::cpu_timer NoiseMulTimer;
+  if(fPipelinePasses) {
+    static SafeStopwatch PipelinedWatch("Noise multiplication with HandleEvents (sequential)");
+    SafeStopwatch::tag PipelinedTag = PipelinedWatch.Start();
+    if(fVerbose) std::cout<<"Starting HandleEvents."<<std::endl;
+    fFillingBuffer = 1 - Buffer;
+    fWorkerPool->RunOnAll(boost::bind(&EXORefitSignals::HandleEventsThenMultiply, this));
+    NoiseMulTimer.stop();
+    assert(fMultipliedEvents.empty());
+    if(fVerbose) std::cout<<"Done with HandleEvents."<<std::endl;
+    FinishNoiseMultiplication(Buffer);
+    MoveAllEvents(fEventHandlerQueue, fMultipliedEvents); // These get handled next pass.
+    PipelinedWatch.Stop(PipelinedTag);
+  }
+  else {
+    static SafeStopwatch NoiseMulWatch("Noise multiplication (sequential)");
+    SafeStopwatch::tag NoiseMulTag = NoiseMulWatch.Start();
+    fWorkerPool->RunOnAll(boost::bind(&EXORefitSignals::DoNoiseMultiplication, this));
+    NoiseMulTimer.stop();
+    FinishNoiseMultiplication(Buffer);
+    NoiseMulWatch.Stop(NoiseMulTag);
+
+    static SafeStopwatch HandleEventsWatch("HandleEvents (sequential)");
+    SafeStopwatch::tag HandleEventsTag = HandleEventsWatch.Start();
+    if(fVerbose) std::cout<<"Starting HandleEvents."<<std::endl;
+    // Every thread (or, in unthreaded code, just this one) keeps grabbing events until none are left.
+    MoveAllEvents(fEventHandlerQueue, fMultipliedEvents);
+    fWorkerPool->RunOnAll(boost::bind(&EXORefitSignals::HandleEventsInThread, this));
+    assert(fMultipliedEvents.empty());
+    if(fVerbose) std::cout<<"Done with HandleEvents."<<std::endl;
+    HandleEventsWatch.Stop(HandleEventsTag);
   }
-#endif
-  // This thread is the last one.
-  // If we're in unthreaded code, this thread is the only one.
-  HandleEventsInThread();
-#ifdef USE_THREADS
-  threads.join_all();
-#endif
   assert(fEventHandlerQueue.empty());
-  if(fVerbose) std::cout<<"Done with HandleEvents."<<std::endl;
-  HandleEventsWatch.Stop(HandleEventsTag);
+  double NoiseMulSeconds = double(NoiseMulTimer.elapsed().wall)/1e9;
+  fNoiseMulFlops += Flops;
+  fNoiseMulSeconds += NoiseMulSeconds;
+  if(fAutotuneBatchSize and fSolver != kDirect) TuneBatchSize(NumVectors, Flops, NoiseMulSeconds);
 
-  // Transfer entries from results into queue.
-  while(not fEventHandlerResults.empty()) {
-    EventHandler* evt = NULL;
-    assert(fEventHandlerResults.unsynchronized_pop(evt));
-    assert(fEventHandlerQueue.unsynchronized_push(evt));
-  }
+  // Transfer entries from results into queue; they wait on fFillingBuffer now.
+  MoveAllEvents(fEventHandlerResults, fEventHandlerQueue);
 
   // Initiate send requests of finished events to the finisher process.
   fSaveToPushEH.consume_all(boost::bind(&EXORefitSignals::FinishProcessedEvent, this, _1));
@@ -1451,6 +2850,64 @@ void EXORefitSignals::DoPassThroughEvents()
   } while(fPendingSends.size() > 1000); // Ensure we don't let fPendingSends grow out of control.
 
   DoPassWatch.Stop(DoPassTag);
+  return true;
+}
+
+void EXORefitSignals::TuneBatchSize(size_t NumVectors, double Flops, double Seconds)
+{
+  // Move fNumMulsToAccumulate toward the batch size which multiplies the most vectors per second.
+  // (With pipelined passes, we can't separate the multiplication from the event handling it overlaps;
+  // so we time the whole pass, which is the throughput we care about anyway.)
+  // We measure a few full passes at each batch size, and keep scaling the best size by fTuneStep while that helps;
+  // when it stops helping, we go back to the best size and try the other direction, with a smaller step.
+  // Once the step is down to a few percent, we stay at the best size.
+  // Only full passes count -- those from FlushEvents are short, and would make any batch size look bad.
+  static const size_t PassesPerTrial = 8;
+  if(fTuneDone or NumVectors < fNumMulsToAccumulate) return;
+  fTuneVectors += NumVectors;
+  fTuneFlops += Flops;
+  fTuneSeconds += Seconds;
+  if(++fTunePasses < PassesPerTrial) return;
+
+  double SecondsPerVector = fTuneSeconds/fTuneVectors;
+  double GFLOPS = fTuneFlops/fTuneSeconds/1e9;
+  if(fVerbose) {
+    std::cout<<"With a batch size of "<<fNumMulsToAccumulate<<", noise multiplication ran at "
+             <<GFLOPS<<" GFLOP/s."<<std::endl;
+  }
+  if(fTuneBestBatch == 0 or SecondsPerVector < fTuneBestSecondsPerVector) {
+    fTuneBestBatch = fNumMulsToAccumulate;
+    fTuneBestSecondsPerVector = SecondsPerVector;
+    fTuneBestGFLOPS = GFLOPS;
+  }
+  else fTuneStep = 1/std::sqrt(fTuneStep);
+  fTunePasses = 0;
+  fTuneVectors = fTuneFlops = fTuneSeconds = 0;
+
+  // Every queued vector takes a row in the queue and result of its buffer (floats, for a single-precision store),
+  // for as many buffers as are in use; that must stay within fMaxBatchMemory_MB.
+  size_t BytesPerVector = 0;
+  NoiseOperatorMap::const_iterator it;
+  for(it = fNoiseOperators.begin(); it != fNoiseOperators.end(); it++) {
+    const NoiseOperator& op = *it->second;
+    size_t Bytes = op.fNoiseColumnLength*2*(op.IsSingle() ? sizeof(float) : sizeof(double))*(fPipelinePasses ? 2 : 1);
+    BytesPerVector = std::max(BytesPerVector, Bytes);
+  }
+  size_t MaxBatch = std::max<size_t>(1, (fMaxBatchMemory_MB << 20)/std::max<size_t>(1, BytesPerVector));
+
+  // Pick the next batch size to try; if the step can't take us anywhere new, reverse it.
+  while(std::fabs(std::log(fTuneStep)) > 0.03) {
+    size_t NextBatch = std::min(MaxBatch, std::max<size_t>(1, size_t(fTuneBestBatch*fTuneStep + 0.5)));
+    if(NextBatch != fTuneBestBatch) {
+      fNumMulsToAccumulate = NextBatch;
+      return;
+    }
+    fTuneStep = 1/std::sqrt(fTuneStep);
+  }
+  fNumMulsToAccumulate = fTuneBestBatch;
+  fTuneDone = true;
+  std::cout<<"Noise multiplication batch size tuned to "<<fNumMulsToAccumulate<<" vectors ("
+           <<fTuneBestGFLOPS<<" GFLOP/s)."<<std::endl;
 }
 
 bool EXORefitSignals::CanTerminate(EventHandler& event)
@@ -1458,49 +2915,102 @@ bool EXORefitSignals::CanTerminate(EventHandler& event)
   // Test whether the residual matrix R indicates we can terminate yet.
   // For now we test for termination against the *unpreconditioned* residual matrix.
   // This should be compared to the alternative of terminating against the preconditioned residual matrix.
-  // Permit early return if we're not in verbose mode; if we are, finish to collect all possible information.
+  // Every column is checked, and the ones which pass are left in event.fConvergedColumns (see FreezeConvergedColumns).
   event.fNumIterations++; // Iterations = number of times we've tried to terminate.
   event.fNumIterSinceReset++;
   std::vector<double> R_unprec = event.fR;
   DoLPrecon(R_unprec, event);
   double WorstNorm = 0;
-  bool ret = true;
-  bool is_worst = false;
+  event.fConvergedColumns.clear();
 
-  for(size_t col = 0; col < event.fNumSignals; col++) {
+  for(size_t col = 0; col < event.fNumColumns; col++) {
     size_t ColIndex = col*event.fColumnLength;
-    size_t NextCol = ColIndex + event.fColumnLength;
     double Norm = 0;
-    for(size_t i = 0; i < fNoiseColumnLength; i++) {
-      Norm += R_unprec[ColIndex + i]*R_unprec[ColIndex+i]*fNoiseDiag[i];
+    for(size_t i = 0; i < event.fNoiseColumnLength; i++) {
+      Norm += R_unprec[ColIndex + i]*R_unprec[ColIndex+i]*event.fNoiseOperator->fNoiseDiag[i];
     }
-    for(size_t i = fNoiseColumnLength; i < event.fColumnLength; i++) {
+    for(size_t i = event.fNoiseColumnLength; i < event.fColumnLength; i++) {
       Norm += R_unprec[ColIndex + i]*R_unprec[ColIndex+i];
     }
     WorstNorm = std::max(Norm, WorstNorm);
-    if(col == event.fNumSignals-1) is_worst = true;
-    if(Norm > fRThreshold*fRThreshold) {
-      ret = false;
-      break;
-    }
+    if(Norm <= fRThreshold*fRThreshold) event.fConvergedColumns.push_back(col);
   }
 
   if(fVerbose) {
 #ifdef USE_THREADS
     boost::mutex::scoped_lock sL(CoutMutex);
 #endif
-    if(is_worst) std::cout<<"Entry "<<event.fEntryNumber<<" has worst norm = "<<WorstNorm<<std::endl;
-    else std::cout<<"Entry "<<event.fEntryNumber<<" has worst norm >= "<<WorstNorm<<std::endl;
+    std::cout<<"Entry "<<event.fEntryNumber<<" has worst norm = "<<WorstNorm<<" ("
+             <<event.fConvergedColumns.size()<<" of "<<event.fNumColumns<<" columns converged)"<<std::endl;
   }
-  return ret;
+  return event.fConvergedColumns.size() == event.fNumColumns;
 }
 
-void EXORefitSignals::DoRestart(EventHandler& event)
+bool EXORefitSignals::FreezeConvergedColumns(EventHandler& event)
+{
+  // The columns of X are independent systems, which only share the Krylov space; once one has converged (as of the
+  // last CanTerminate), there's no need to keep multiplying it.  Set those columns of X aside in fConvergedX, and
+  // shrink X and R to the rest; return true if any were dropped.  Everything else built from the old columns is
+  // stale then, so the caller has to start its recurrence afresh from the new R -- which costs no multiplication,
+  // since R is already known.  Fewer columns in turn take fewer slots in the noise queue (see ReserveNoiseMul).
+  // Don't call this if every column has converged; the event is done then.
+  if(not fFreezeConvergedColumns or event.fConvergedColumns.empty()) return false;
+  assert(event.fConvergedColumns.size() < event.fNumColumns);
+  const size_t n = event.fColumnLength;
+  if(event.fConvergedX.empty()) event.fConvergedX.assign(n*event.fNumSignals, 0);
+  size_t NumKept = 0;
+  size_t NextConverged = 0; // fConvergedColumns is in ascending order.
+  for(size_t col = 0; col < event.fNumColumns; col++) {
+    if(NextConverged < event.fConvergedColumns.size() and event.fConvergedColumns[NextConverged] == col) {
+      std::copy(event.fX.begin() + col*n, event.fX.begin() + (col+1)*n,
+                event.fConvergedX.begin() + event.fColumnSignals[col]*n);
+      NextConverged++;
+      continue;
+    }
+    if(NumKept != col) {
+      std::copy(event.fX.begin() + col*n, event.fX.begin() + (col+1)*n, event.fX.begin() + NumKept*n);
+      std::copy(event.fR.begin() + col*n, event.fR.begin() + (col+1)*n, event.fR.begin() + NumKept*n);
+      event.fColumnSignals[NumKept] = event.fColumnSignals[col];
+    }
+    NumKept++;
+  }
+  event.fX.resize(NumKept*n);
+  event.fR.resize(NumKept*n);
+  event.fColumnSignals.resize(NumKept);
+  event.fNumColumns = NumKept;
+  event.fConvergedColumns.clear();
+  return true;
+}
+
+void EXORefitSignals::RestoreFrozenColumns(EventHandler& event)
+{
+  // The solver is done with event; put the columns FreezeConvergedColumns set aside back into X,
+  // so that it has all fNumSignals columns again, in order.
+  if(not event.fConvergedX.empty()) {
+    const size_t n = event.fColumnLength;
+    if(not event.fX.empty()) {
+      for(size_t col = 0; col < event.fNumColumns; col++) {
+        std::copy(event.fX.begin() + col*n, event.fX.begin() + (col+1)*n,
+                  event.fConvergedX.begin() + event.fColumnSignals[col]*n);
+      }
+      event.fX.swap(event.fConvergedX);
+    }
+    std::vector<double>().swap(event.fConvergedX);
+  }
+  event.fNumColumns = event.fNumSignals;
+  event.fColumnSignals.resize(event.fNumSignals);
+  for(size_t i = 0; i < event.fNumSignals; i++) event.fColumnSignals[i] = i;
+}
+
+void EXORefitSignals::DoRestart(EventHandler& event, bool Refinement)
 {
   // "Restart" the event -- retain X, but clear out everything else so that
   // it will be treated like an initial guess.
-  std::cout<<"Restarting entry "<<event.fEntryNumber<<
-             " with "<<event.fNumIterations<<" total iterations."<<std::endl;
+  // Refinement restarts happen routinely with single-precision noise, so only report them when verbose.
+  if(fVerbose or not Refinement) {
+    std::cout<<"Restarting entry "<<event.fEntryNumber<<
+               " with "<<event.fNumIterations<<" total iterations."<<std::endl;
+  }
   event.fR.clear();
   event.fV.clear();
   event.fNumIterSinceReset = 0;
@@ -1508,7 +3018,7 @@ void EXORefitSignals::DoRestart(EventHandler& event)
   // Start matrix multiplication of X, to find a new R.
   event.fprecon_tmp = event.fX;
   DoInvRPrecon(event.fprecon_tmp, event);
-  event.fResultIndex = RequestNoiseMul(event.fprecon_tmp, event.fColumnLength);
+  RequestNoiseMul(event.fprecon_tmp, event);
 }
 
 void EXORefitSignals::PushFinishedEvent(EventHandler* event)
@@ -1522,7 +3032,7 @@ void EXORefitSignals::PushFinishedEvent(EventHandler* event)
     DoInvRPrecon(event->fX, *event);
     for(size_t i = 0; i < event->fX.size(); i++) {
       size_t imod = i % event->fColumnLength;
-      if(imod < fNoiseColumnLength) event->fX[i] *= fInvSqrtNoiseDiag[imod];
+      if(imod < event->fNoiseColumnLength) event->fX[i] *= event->fNoiseOperator->fInvSqrtNoiseDiag[imod];
     }
   }
 
@@ -1532,6 +3042,13 @@ void EXORefitSignals::PushFinishedEvent(EventHandler* event)
   std::vector<double>().swap(event->fR0hat);
   std::vector<double>().swap(event->fV);
   std::vector<double>().swap(event->fprecon_tmp);
+  std::vector<double>().swap(event->fPreconScale);
+  std::vector<double>().swap(event->fPreconG);
+  for(size_t i = 0; i < 2; i++) {
+    std::vector<double>().swap(event->fLanczosV[i]);
+    std::vector<double>().swap(event->fMINRESDir[i]);
+    std::vector<double>().swap(event->fMINRESADir[i]);
+  }
   for(size_t i = 0; i < event->fModels.size(); i++) event->fModels[i]->Strip();
 
   assert(event->fStatusCode >= 0);
@@ -1542,6 +3059,8 @@ void EXORefitSignals::FinishProcessedEvent(EventHandler* event)
 {
   static SafeStopwatch watch("EXORefitSignals::FinishProcessedEvent (sequential)");
   SafeStopwatch::tag tag = watch.Start();
+  if(event->fHarvestRecycled) AddRecycleVectors(*event);
+  if(event->fNoiseOperator) event->fNoiseOperator->fNumEventsInFlight--; // We're done with it.
   fPendingSends.push_back(std::make_pair(gMPIComm.isend(gMPIComm.rank()+1, 0, *event),
                                          event));
   watch.Stop(tag);
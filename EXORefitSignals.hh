@@ -3,12 +3,15 @@
 
 #include "SafeStopwatch.hh"
 #include "EventHandler.hh"
+#include "NoiseOperator.hh"
+#include "WorkerPool.hh"
 #include "Constants.hh"
 #include "Rtypes.h"
-#include "mkl_cblas.h"
-#include "mkl_lapacke.h"
-#include "mkl_vml_functions.h"
+#include "LinearAlgebra.hh"
 #include <boost/mpi/request.hpp>
+#include <boost/mpi/communicator.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
 #include <string>
 #include <vector>
 #include <set>
@@ -39,20 +42,57 @@ typedef boost::lockfree::queue<EventHandler*> queue_type;
 class EXORefitSignals
 {
  public:
+  // How each event's system is solved.  The iterative solvers pick up after every noise multiplication
+  // (see HandleEventsInThread), with all their state in the EventHandler.
+  enum Solver {
+    kBlBiCGSTAB, // Block BiCGSTAB:  two noise multiplications per iteration.
+    kBlMINRES,   // Block MINRES on the symmetric form of the system:  one multiplication per iteration.
+    kDirect      // Woodbury and a Schur complement, with the inverted noise blocks; no iteration.
+  };
+
   // Functions specified in the order they should be called.
   EXORefitSignals();
 
+  // The noise file may be changed between events; events already accepted keep the noise they started with.
   void SetNoiseFilename(std::string name) { fNoiseFilename = name; }
+  // Load the noise file we'll switch to next in a background thread, while events carry on with the current one;
+  // then SetNoiseFilename(name) is just a pointer swap.  (Any store file this builds also outlives us.)
+  void PrefetchNoiseFile(std::string name);
   void SetLightmapFilename(std::string name) { fLightmapFilename = name; }
   void SetRThreshold(double threshold) { fRThreshold = threshold; }
+  // Share noise multiplication with the other compute processes in group (a "noise group"):  each member keeps,
+  // and multiplies, only the noise blocks for its own share of the frequencies, so it needs a fraction of the memory.
+  // Every pass is then collective over the group, so each member must keep calling AcceptEvent and FlushEvents
+  // as usual.  Call before Initialize.
+  void SetNoiseGroup(const boost::mpi::communicator& group) {
+    fNoiseGroup = group;
+    fNoiseGroupSize = group.size();
+  }
 #ifdef ENABLE_CHARGE
   bool fAPDsOnly; // Do not denoise wire signals; and do not use u-wires to denoise APDs.
   bool fUseWireAPDCorrelations; // For now, this isn't higher performance -- just for testing.
 #endif
   bool fVerbose;
+  NoiseStore::Options fNoiseStoreOptions; // Where and how the reordered noise blocks are kept.
+  size_t fNoiseCacheBudget_MB; // Noise operators for other channel sets are kept while they fit in this (0: two).
+  bool fIncrementalNoiseUpdate; // Derive operators for new channel sets from cached ones where possible.
+  bool fPinThreads; // Pin each worker thread to its own CPU.
+  bool fNUMALocalNoise; // Each thread owns a fixed share of frequencies, with its blocks and rows on its NUMA node.
+  bool fPipelinePasses; // Multiply one buffer of requests while events from the other buffer are handled.
+  Solver fSolver;
+  bool fBlockPrecon; // Precondition with the whole noise blocks, not just the noise diagonal.
+  bool fPreconPoissonDiagonal; // Include the diagonal of the Poisson terms in the preconditioner.
+  size_t fRecycleSize; // Noise directions recycled per noise operator (see AddRecycleVectors); 0 for none.
+  size_t fRecycleHarvests; // Events per noise operator whose multiplications they're harvested from.
+  bool fFreezeConvergedColumns; // Stop iterating on each column as soon as it converges (see FreezeConvergedColumns).
   size_t fDoRestarts; // 0 if we never restart; else, value indicates number of iterations before a restart.
   size_t fNumMulsToAccumulate;
+  size_t fNoiseMulTileColumns; // Noise multiplication is split into work items of this many vectors (and one frequency).
+  bool fAutotuneBatchSize; // Adjust fNumMulsToAccumulate at runtime, toward the fastest noise multiplication.
+  size_t fMaxBatchMemory_MB; // While autotuning, the buffers for queued vectors must fit in this.
   double fGainCorrectionFactor;
+  size_t fMaxF; // The refit only uses frequencies MIN_F...fMaxF (and just the real part at MAX_F).
+  double fBandLimitEnergyFraction; // If nonzero, choose fMaxF so the light model loses at most this much energy.
 
   int Initialize();
   void AcceptEvent(EXOEventData* ED, Long64_t entryNum);
@@ -61,23 +101,37 @@ class EXORefitSignals
 
  protected:
 
-  // fNoiseCorrelations[f-MIN_F] stores the matrix of noise correlations at frequency f.
-  // This matrix is a single contiguous array, ordered like:
-  // <N^R_0 N^R_0> <N^I_0 N^R_0> <N^R_1 N^R_0> ... <N^R_0 N^I_0> ...
-  // (Ie. in column-major format -- this facilitates the use of GEMM if a BLAS library is available.)
-  // The number corresponds to the *index* of the various channels, of course.
+  // Each NoiseOperator holds the matrix of noise correlations for one channel set, reordered
+  // and preconditioned, along with its own queue of pending multiplications.  See NoiseOperator.hh.
+  // They are cached by noise file and channel set, and evicted (least-recently-used first) to respect
+  // fNoiseCacheBudget_MB.
+  typedef std::pair<std::string, std::vector<unsigned char> > NoiseOperatorKey;
+  typedef std::map<NoiseOperatorKey, NoiseOperator*> NoiseOperatorMap;
   std::string fNoiseFilename;
-  std::vector<std::vector<double> > fNoiseCorrelations;
-  std::vector<double> fNoiseDiag;
-  std::vector<double> fInvSqrtNoiseDiag;
-  void FillNoiseCorrelations(const EXOEventData& ED);
+  NoiseOperatorMap fNoiseOperators;
+  size_t fNoiseOperatorClock;
+  NoiseOperator* GetNoiseOperator(const EXOEventData& ED);
+  NoiseOperator* MakeNoiseOperator(const std::string& NoiseFilename,
+                                   const std::vector<unsigned char>& Channels,
+                                   const NoiseOperator* Source);
+  void ReserveNoiseMulQueues(NoiseOperator& op);
+  void EvictNoiseOperators(size_t BytesNeeded);
+  NoiseOperator* InsertNoiseOperator(const NoiseOperatorKey& key, NoiseOperator* op);
+  void PlaceNoiseOperator(NoiseOperator& op);
+  size_t GetNoiseCacheUsage() const;
+
+  // The operator for a prefetched noise file is made in fNoiseLoaderThread, and handed over to
+  // fNoiseOperators by GetNoiseOperator once that noise file is in use.
+  boost::thread fNoiseLoaderThread;
+  NoiseOperatorKey fPrefetchKey;
+  NoiseOperator* fPrefetchedOperator;
+  bool fPrefetchPending; // We've been asked to prefetch, but don't know the channel set yet.
+  void LoadPrefetchedOperator();
 
   std::string fLightmapFilename;
   std::map<unsigned char, TH3D*> fLightMaps;
   std::map<unsigned char, TGraph*> fGainMaps;
   std::map<unsigned char, double> fGainMapAtT0;
-  std::vector<unsigned char> fChannels;
-  size_t fFirstAPDChannelIndex;
 
   double GetGain(unsigned char channel, EventHandler& event) const;
 
@@ -101,10 +155,15 @@ class EXORefitSignals
 #endif
 
   // Interact with files.
+  // Events in fEventHandlerQueue are waiting on the multiplication of buffer fFillingBuffer;
+  // events in fMultipliedEvents have their results, and are ready to be handled.
   queue_type fEventHandlerQueue;
+  queue_type fMultipliedEvents;
   queue_type fEventHandlerResults;
+  size_t fFillingBuffer; // The buffer which newly accepted events queue their requests in.
   void HandleEventsInThread();
-  void DoPassThroughEvents();
+  bool DoPassThroughEvents();
+  void FinishEventsInFlight();
   EventHandler* PopAnEvent();
   void PushAnEvent(EventHandler* evt);
 
@@ -112,24 +171,64 @@ class EXORefitSignals
   void FinishProcessedEvent(EventHandler* event);
   std::list<std::pair<boost::mpi::request, EventHandler*> > fPendingSends;
 
+  // Take the event as far as possible with fSolver; true if it's done, false if it requested a noise multiplication.
+  bool DoSolverStep(EventHandler& event);
+  void DoRestart(EventHandler& event, bool Refinement = false);
+  bool FreezeConvergedColumns(EventHandler& event);
+  void RestoreFrozenColumns(EventHandler& event);
+
   // Block BiCGSTAB algorithm.
   bool DoBlBiCGSTAB(EventHandler& event);
-  void DoRestart(EventHandler& event);
+
+  // Block MINRES algorithm.
+  bool DoBlMINRES(EventHandler& event);
+
+  // Krylov subspace recycling across events with the same noise operator.
+  void HarvestRecycleVectors(EventHandler& event);
+  void AddRecycleVectors(EventHandler& event);
+
+  // Direct solver, using the inverse of each noise block.
+  bool DoDirectSolve(EventHandler& event);
+  void PrepareNoiseBlocks(NoiseOperator& op);
+  void PrepareNoiseBlocks_Share(NoiseOperator& op, bool NeedInverses, bool NeedFactors);
 
   // Functions to multiply by the noise matrix.
-  size_t fNoiseColumnLength;
-  std::vector<double> fNoiseMulQueue;
-  std::vector<double> fNoiseMulResult;
-  size_t fNumVectorsInQueue;
+  boost::atomic<size_t> fNumVectorsInQueue[2]; // In each buffer, summed over all noise operators.
+  double fNoiseMulFlops; // Totals over all passes, for reporting throughput.
+  double fNoiseMulSeconds;
+  WorkerPool* fWorkerPool; // Threads shared by noise multiplication and event handling; made in Initialize.
+  std::vector<NoiseOperator*> fOperatorsToMultiply; // Those with vectors in the buffer being multiplied.
+  // Work items are (operator, frequency, column tile), numbered in that order; operator i's items start at
+  // fFirstNoiseMulItem[i].  Threads take them from fNoiseMulItems.
+  std::vector<size_t> fFirstNoiseMulItem;
+  WorkStealingRanges* fNoiseMulItems;
+  size_t GetNumNoiseMulTiles(const NoiseOperator& op) const;
+  void StartNoiseMultiplication(size_t Buffer);
+  void FinishNoiseMultiplication(size_t Buffer);
   void DoNoiseMultiplication();
-  void DoNoiseMultiplication_FromQueue(boost::lockfree::queue<size_t,
-                                         boost::lockfree::capacity<MAX_F-MIN_F+1> >& freq_queue);
-  size_t RequestNoiseMul(std::vector<double>& vec,
-                         size_t ColLength);
+  void DoNoiseMultiplication_Steal();
+  void DoNoiseMultiplication_OwnShare();
+  void DoNoiseMultiplication_Frequency(NoiseOperator& op, size_t f, size_t FirstCol, size_t NumCols);
+  void HandleEventsThenMultiply();
+  void ReserveNoiseMul(EventHandler& event);
+  void GrowNoiseMulQueue(EventHandler& event);
+  void RequestNoiseMul(const std::vector<double>& vec,
+                       EventHandler& event);
   void FillFromNoise(std::vector<double>& vec,
-                     size_t NumCols,
-                     size_t ColLength,
-                     size_t ResultIndex);
+                     const EventHandler& event);
+
+  // Noise groups; see SetNoiseGroup.  In a group, fOperatorsToMultiply lists every operator with vectors queued
+  // anywhere in the group, and fGroupCounts[i][r] is the number member r queued for fOperatorsToMultiply[i].
+  boost::mpi::communicator fNoiseGroup;
+  size_t fNoiseGroupSize; // 1 if we aren't in a group.
+  std::vector<std::vector<size_t> > fGroupCounts;
+  std::vector<double> fGroupSendBuffer;
+  std::vector<double> fGroupRecvBuffer;
+  bool PlanNoiseGroupPass(bool Busy, size_t Buffer);
+  void GetGroupRows(const NoiseOperator& op, size_t Member, size_t& FirstRow, size_t& NumRows) const;
+  void CountGroupRows(std::vector<int>& ToEach, std::vector<int>& FromEach) const;
+  void ExchangeNoiseRows(size_t Buffer);
+  void ExchangeNoiseResults(size_t Buffer);
 
   // Function to perform the rest of matrix multiplication.
   void DoRestOfMultiplication(const std::vector<double>& in,
@@ -138,19 +237,38 @@ class EXORefitSignals
   void DoPoissonMultiplication(const std::vector<double>& in,
                                std::vector<double>& out,
                                EventHandler& event);
+  double GetPoissonScale(const ModelManager& modelManager, unsigned char ChannelIndex, EventHandler& event) const;
   template<char WHICH, bool Add>
   void DoLagrangeAndConstraintMul(const std::vector<double>& in,
                                   std::vector<double>& out,
                                   EventHandler& event);
 
+  // Autotuning of fNumMulsToAccumulate; see TuneBatchSize.
+  size_t fTunePasses; // Full passes measured so far at the current batch size.
+  double fTuneVectors;
+  double fTuneFlops;
+  double fTuneSeconds;
+  size_t fTuneBestBatch; // Zero until the first batch size has been measured.
+  double fTuneBestSecondsPerVector;
+  double fTuneBestGFLOPS;
+  double fTuneStep; // Factor to scale the best batch size by for the next trial.
+  bool fTuneDone;
+  void TuneBatchSize(size_t NumVectors, double Flops, double Seconds);
+
   // Preconditioner functions.
   void DoInvLPrecon(std::vector<double>& in, EventHandler& event);
   void DoInvRPrecon(std::vector<double>& in, EventHandler& event);
   void DoLPrecon(std::vector<double>& in, EventHandler& event);
   void DoRPrecon(std::vector<double>& in, EventHandler& event);
+  // Whether D (see EventHandler.hh) is more than the noise diagonal, so that preconditioning needs DoNoiseFactorMul.
+  bool HasNoiseFactor() const { return fBlockPrecon or fPreconPoissonDiagonal or fRecycleSize > 0; }
+  void DoNoiseFactorMul(std::vector<double>& in, EventHandler& event, bool Transpose, bool Inverse);
+  void SetPoissonDiagonal(EventHandler& event);
 
   // Produce the light model, used on all gangs.
   EXOWaveformFT GetModelForTime(double time) const;
+  std::vector<double> GetRealImagInBand(const EXOWaveformFT& fwf) const;
+  void ChooseBandLimit();
 };
 
 template<char WHICH, bool Add>
@@ -172,10 +290,12 @@ void EXORefitSignals::DoLagrangeAndConstraintMul(const std::vector<double>& in,
   assert(WHICH == 'L' or WHICH == 'C' or &in[0] != &out[0]);
   bool Lagrange = (WHICH == 'L' or WHICH == 'A');
   bool Constraint = (WHICH == 'C' or WHICH == 'A');
+  // Noise rows come in runs of one per channel:  real and imaginary parts of each frequency (just real at MAX_F).
+  const size_t NumRuns = event.fNoiseColumnLength/event.fChannels.size();
 
   for(size_t m = 0; m < event.fModels.size(); m++) {
     const ModelManager& modelManager = *event.fModels.at(m);
-    assert(modelManager.fNumChannels == fChannels.size());
+    assert(modelManager.fNumChannels == event.fChannels.size());
 
     // Exploit ranges of contiguous channels which are hit by this signal.
     const std::set<std::pair<unsigned char, unsigned char> >& contigChannels =
@@ -183,22 +303,22 @@ void EXORefitSignals::DoLagrangeAndConstraintMul(const std::vector<double>& in,
     for(std::set<std::pair<unsigned char, unsigned char> >::const_iterator it = contigChannels.begin();
         it != contigChannels.end();
         it++) {
-      for(size_t f = 0; f < 2*(MAX_F-MIN_F)+1; f++) {
+      for(size_t f = 0; f < NumRuns; f++) {
         if(Constraint) {
-          cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
-                      1, event.fNumSignals, it->second - it->first,
-                      (Add ? 1 : -1),
-                      &modelManager.fModel[f*fChannels.size() + it->first], 1,
-                      &in[f*fChannels.size() + it->first], event.fColumnLength,
-                      1, &out[fNoiseColumnLength + m], event.fColumnLength);
+          LinAlg::gemm('N', 'N',
+                       1, event.fNumColumns, it->second - it->first,
+                       (Add ? 1 : -1),
+                       &modelManager.fModel[f*event.fChannels.size() + it->first], 1,
+                       &in[f*event.fChannels.size() + it->first], event.fColumnLength,
+                       1, &out[event.fNoiseColumnLength + m], event.fColumnLength);
         }
         if(Lagrange) {
-          cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
-                      it->second - it->first, event.fNumSignals, 1,
-                      (Add ? 1 : -1),
-                      &modelManager.fModel[f*fChannels.size() + it->first], fChannels.size(),
-                      &in[fNoiseColumnLength + m], event.fColumnLength,
-                      1, &out[f*fChannels.size() + it->first], event.fColumnLength);
+          LinAlg::gemm('N', 'N',
+                       it->second - it->first, event.fNumColumns, 1,
+                       (Add ? 1 : -1),
+                       &modelManager.fModel[f*event.fChannels.size() + it->first], event.fChannels.size(),
+                       &in[event.fNoiseColumnLength + m], event.fColumnLength,
+                       1, &out[f*event.fChannels.size() + it->first], event.fColumnLength);
         }
       }
     }
@@ -94,13 +94,16 @@ void EventFinisher::FinishEvent(EventHandler* event)
     }
 
     // Produce estimates of the signals.
+    // The refit may have been band-limited, to fewer frequencies; only MAX_F has just a real part.
+    const size_t NumRuns = event->fNoiseColumnLength/event->fChannels.size(); // Runs of rows, one per channel.
+    const size_t NumFreqs = (NumRuns + 1)/2;
     for(size_t i = 0; i < event->fResults.size(); i++) {
-      for(size_t f = 0; f <= MAX_F - MIN_F; f++) {
+      for(size_t f = 0; f < NumFreqs; f++) {
         for(size_t chan_index = 0; chan_index < event->fChannels.size(); chan_index++) {
           size_t XIndex = event->fColumnLength*i + 2*event->fChannels.size()*f + chan_index;
           event->fResults[i] += event->fX[XIndex]*WF_real[chan_index][f + MIN_F];
         }
-        if(f == MAX_F - MIN_F) continue;
+        if(2*f + 1 == NumRuns) continue; // No imaginary part.
         for(size_t chan_index = 0; chan_index < event->fChannels.size(); chan_index++) {
           size_t XIndex = event->fColumnLength*i + 2*event->fChannels.size()*f + event->fChannels.size() + chan_index;
           event->fResults[i] += event->fX[XIndex]*WF_imag[chan_index][f + MIN_F];
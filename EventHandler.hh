@@ -3,7 +3,7 @@
 
 #include "ModelManager.hh"
 #include "Rtypes.h"
-#include "mkl_lapacke.h"
+#include "LinearAlgebra.hh"
 #include <vector>
 #include <map>
 #include <utility>
@@ -11,6 +11,8 @@
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/map.hpp>
 
+struct NoiseOperator;
+
 struct EventHandler {
   // So we can grab the event again when we're done.
   Long64_t fEntryNumber;
@@ -18,10 +20,12 @@ struct EventHandler {
   Int_t fEventNumber;
   double fUnixTimeOfEvent;
   size_t fColumnLength;
+  size_t fNoiseColumnLength; // The rows of a column which are subject to noise multiplication.
   size_t fNumSignals;
   size_t fNumIterSinceReset;
   size_t fNumIterations; // Count the number of times we've tried to terminate.
   std::vector<unsigned char> fChannels;
+  NoiseOperator* fNoiseOperator; // Noise for fChannels; NULL if the event was skipped before we needed it.
   int fStatusCode;
   std::vector<double> fResults;
 
@@ -49,6 +53,31 @@ struct EventHandler {
   std::vector<lapack_int> fR0hat_V_pivot;
   std::vector<double> fprecon_tmp; // For storing the right-preconditioned version of a vector.
 
+  // The solvers only carry the columns which haven't converged yet (see EXORefitSignals::FreezeConvergedColumns):
+  // fNumColumns of them, where column c is the one for signal fColumnSignals[c].  Every vector above (and below) with
+  // one column per signal has fNumColumns columns while the event is being solved; the columns which have been
+  // frozen wait in fConvergedX, with all fNumSignals columns, until the rest are done.
+  size_t fNumColumns;
+  std::vector<size_t> fColumnSignals;
+  std::vector<double> fConvergedX;
+  std::vector<size_t> fConvergedColumns; // The columns which passed in the last CanTerminate.
+
+  // Block MINRES (see EXORefitSignals::DoBlMINRES) shares fX, fR and fprecon_tmp, and keeps the rest here.
+  // Index 0 is the latest block, index 1 the one before it.
+  std::vector<double> fLanczosV[2]; // Lanczos blocks V_j and V_(j-1).
+  std::vector<double> fLanczosBeta; // beta_j, the coupling between V_(j-1) and V_j.
+  std::vector<double> fMINRESDir[2]; // Search directions M_(j-1) and M_(j-2).
+  std::vector<double> fMINRESADir[2]; // Their products with the (left-preconditioned) matrix, to update fR.
+  std::vector<double> fMINRESQ[2]; // The last two orthogonal factors from the QR of the block tridiagonal matrix.
+  std::vector<double> fMINRESTau; // The part of the rotated right-hand side not yet reached.
+
+  // Recycling (see EXORefitSignals::HarvestRecycleVectors):  orthonormal noise columns Y spanning (roughly) what we've
+  // multiplied by the noise so far, and N Y; handed over to the noise operator when the event is finished.
+  std::vector<double> fHarvestY;
+  std::vector<double> fHarvestNY;
+  bool fHarvestRecycled; // Whether we're one of the events the noise operator's recycled directions come from.
+  bool fUseRecycled; // Whether the noise operator's recycled directions were ready when we were accepted.
+
   // Preconditioner stuff.
   // We approximate approx(A) = {{D L} {trans(L) 0}}, where D is diagonal.
   // Then approx(A) = {{D^(0.5) 0} {trans(L)D^(-0.5) -trans(X)}}.{{D^(0.5) D^(-0.5)L}{0 X}},
@@ -58,8 +87,13 @@ struct EventHandler {
   // We precondition with K1 as the first, and K2 as the second;
   // both are easy to invert.
   std::vector<double> fPreconX; // X, which is upper-triangular (unpacked).
+  // D may also be the whole noise matrix, and/or include the Poisson diagonal (see EXORefitSignals::DoNoiseFactorMul):
+  std::vector<double> fPreconScale; // The diagonal scaling S in D = S N S, for each noise row; empty if S = I.
+  // (And N, unless it's factored whole, may be corrected in the recycled directions; see fUseRecycled.)
+  std::vector<double> fPreconG; // C_inv D^(-1/2) L, where D = C trans(C); with the columns fColumnLength apart.
 
   // Where in the result matrix can we expect to find the required result?
+  size_t fNoiseBuffer; // Which of the noise operator's two queues (and result matrices) we use.
   size_t fResultIndex;
 
   friend class boost::serialization::access;
@@ -70,6 +104,7 @@ struct EventHandler {
     ar & fRunNumber;
     ar & fEventNumber;
     ar & fColumnLength;
+    ar & fNoiseColumnLength;
     ar & fNumSignals;
     ar & fChannels;
     ar & fStatusCode;
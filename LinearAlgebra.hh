@@ -0,0 +1,178 @@
+#ifndef LinearAlgebra_hh
+#define LinearAlgebra_hh
+/*
+The handful of BLAS and LAPACK kernels we use, behind one thin layer, so that the code isn't tied to MKL.
+Everything is column-major, and transposes etc. are given as LAPACK-style characters ('N', 'T', 'U', 'L', ...).
+
+The backend is chosen at build time (see BLAS in the Makefile):
+  (default)          MKL:  CBLAS, LAPACKE, mkl_?imatcopy and the 3M complex GEMM.
+  -DBLAS_OPENBLAS    OpenBLAS, which bundles LAPACKE and also has the 3M GEMM and in-place copy/transpose.
+  -DBLAS_BLIS        BLIS, through its CBLAS compatibility layer; LAPACKE then comes from a separate LAPACK
+                     (eg. the reference one, or libFLAME's).  BLIS has no 3M GEMM, so zgemm is the ordinary one,
+                     and imatcopy goes through a scratch copy.
+These are all inline, so there's no cost over calling the backend directly.
+
+LinearAlgebraBenchmark (make benchmark) times each kernel on the shapes the refit actually uses.
+*/
+
+#if defined(BLAS_OPENBLAS)
+#include <cblas.h>
+#include <lapacke.h>
+#elif defined(BLAS_BLIS)
+#include <blis/cblas.h>
+#include <lapacke.h>
+#include <vector>
+#else
+#include "mkl_cblas.h"
+#include "mkl_lapacke.h"
+#include "mkl_trans.h"
+#endif
+
+namespace LinAlg {
+
+inline const char* BackendName()
+{
+#if defined(BLAS_OPENBLAS)
+  return "OpenBLAS";
+#elif defined(BLAS_BLIS)
+  return "BLIS";
+#else
+  return "MKL";
+#endif
+}
+
+inline CBLAS_TRANSPOSE Trans(char t) { return (t == 'N' or t == 'n') ? CblasNoTrans : CblasTrans; }
+inline CBLAS_UPLO Uplo(char u) { return (u == 'U' or u == 'u') ? CblasUpper : CblasLower; }
+inline CBLAS_SIDE Side(char s) { return (s == 'L' or s == 'l') ? CblasLeft : CblasRight; }
+inline CBLAS_DIAG Diag(char d) { return (d == 'U' or d == 'u') ? CblasUnit : CblasNonUnit; }
+
+// C = alpha op(A) op(B) + beta C.
+inline void gemm(char TransA, char TransB, int M, int N, int K,
+                 double alpha, const double* A, int lda, const double* B, int ldb,
+                 double beta, double* C, int ldc)
+{
+  cblas_dgemm(CblasColMajor, Trans(TransA), Trans(TransB), M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+inline void gemm(char TransA, char TransB, int M, int N, int K,
+                 float alpha, const float* A, int lda, const float* B, int ldb,
+                 float beta, float* C, int ldc)
+{
+  cblas_sgemm(CblasColMajor, Trans(TransA), Trans(TransB), M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+// C = alpha A B + beta C (SideA = 'L') or alpha B A + beta C ('R'), for symmetric A (only the UploA triangle is read).
+inline void symm(char SideA, char UploA, int M, int N,
+                 double alpha, const double* A, int lda, const double* B, int ldb,
+                 double beta, double* C, int ldc)
+{
+  cblas_dsymm(CblasColMajor, Side(SideA), Uplo(UploA), M, N, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+inline void symm(char SideA, char UploA, int M, int N,
+                 float alpha, const float* A, int lda, const float* B, int ldb,
+                 float beta, float* C, int ldc)
+{
+  cblas_ssymm(CblasColMajor, Side(SideA), Uplo(UploA), M, N, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+// Complex C = alpha op(A) op(B) + beta C, with real and imaginary parts interleaved (alpha and beta too).
+// Uses the 3M algorithm (three real multiplications instead of four) where the backend has it.
+inline void zgemm(char TransA, char TransB, int M, int N, int K,
+                  const double* alpha, const double* A, int lda, const double* B, int ldb,
+                  const double* beta, double* C, int ldc)
+{
+#if defined(BLAS_BLIS)
+  cblas_zgemm(CblasColMajor, Trans(TransA), Trans(TransB), M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+#else
+  cblas_zgemm3m(CblasColMajor, Trans(TransA), Trans(TransB), M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+#endif
+}
+
+// How many real multiplications zgemm does per complex one (for counting FLOPs).
+#if defined(BLAS_BLIS)
+const int zgemmRealProducts = 4;
+#else
+const int zgemmRealProducts = 3;
+#endif
+
+// B = alpha op(A)^(-1) B (SideA = 'L') or alpha B op(A)^(-1) ('R'), for triangular A.
+inline void trsm(char SideA, char UploA, char TransA, char DiagA, int M, int N,
+                 double alpha, const double* A, int lda, double* B, int ldb)
+{
+  cblas_dtrsm(CblasColMajor, Side(SideA), Uplo(UploA), Trans(TransA), Diag(DiagA), M, N, alpha, A, lda, B, ldb);
+}
+
+// B = alpha op(A) B (SideA = 'L') or alpha B op(A) ('R'), for triangular A.
+inline void trmm(char SideA, char UploA, char TransA, char DiagA, int M, int N,
+                 double alpha, const double* A, int lda, double* B, int ldb)
+{
+  cblas_dtrmm(CblasColMajor, Side(SideA), Uplo(UploA), Trans(TransA), Diag(DiagA), M, N, alpha, A, lda, B, ldb);
+}
+
+// In place, AB = alpha op(AB), where AB is Rows x Cols with leading dimension lda on the way in, and ldb on the way out.
+inline void imatcopy(char TransAB, size_t Rows, size_t Cols, double alpha, double* AB, size_t lda, size_t ldb)
+{
+#if defined(BLAS_OPENBLAS)
+  cblas_dimatcopy(CblasColMajor, Trans(TransAB), Rows, Cols, alpha, AB, lda, ldb);
+#elif defined(BLAS_BLIS)
+  std::vector<double> Copy(Rows*Cols);
+  for(size_t col = 0; col < Cols; col++) {
+    for(size_t row = 0; row < Rows; row++) Copy[row + Rows*col] = AB[row + lda*col];
+  }
+  bool Transpose = (Trans(TransAB) == CblasTrans);
+  for(size_t col = 0; col < Cols; col++) {
+    for(size_t row = 0; row < Rows; row++) {
+      AB[Transpose ? col + ldb*row : row + ldb*col] = alpha*Copy[row + Rows*col];
+    }
+  }
+#else
+  mkl_dimatcopy('C', TransAB, Rows, Cols, alpha, AB, lda, ldb);
+#endif
+}
+
+// LAPACK routines return their info code:  zero on success.
+
+// Cholesky factorization of a symmetric positive-definite A, in place; only the UploA triangle is used.
+inline lapack_int potrf(char UploA, lapack_int N, double* A, lapack_int lda)
+{
+  return LAPACKE_dpotrf(LAPACK_COL_MAJOR, UploA, N, A, lda);
+}
+
+// The inverse of A from its factorization by potrf, in place; only the UploA triangle is written.
+inline lapack_int potri(char UploA, lapack_int N, double* A, lapack_int lda)
+{
+  return LAPACKE_dpotri(LAPACK_COL_MAJOR, UploA, N, A, lda);
+}
+
+// LU factorization of A, in place, with pivots in ipiv.
+inline lapack_int getrf(lapack_int M, lapack_int N, double* A, lapack_int lda, lapack_int* ipiv)
+{
+  return LAPACKE_dgetrf(LAPACK_COL_MAJOR, M, N, A, lda, ipiv);
+}
+
+// Solve op(A) X = B in place in B, with A as factored by getrf.
+inline lapack_int getrs(char TransA, lapack_int N, lapack_int NRHS, const double* A, lapack_int lda,
+                        const lapack_int* ipiv, double* B, lapack_int ldb)
+{
+  return LAPACKE_dgetrs(LAPACK_COL_MAJOR, TransA, N, NRHS, A, lda, ipiv, B, ldb);
+}
+
+// QR factorization of the M x N matrix A, in place:  R in the upper triangle, and the reflectors below it (with tau).
+inline lapack_int geqrf(lapack_int M, lapack_int N, double* A, lapack_int lda, double* tau)
+{
+  return LAPACKE_dgeqrf(LAPACK_COL_MAJOR, M, N, A, lda, tau);
+}
+
+// Overwrite A with the first N columns of Q, from the K reflectors left in it (and tau) by geqrf.
+inline lapack_int orgqr(lapack_int M, lapack_int N, lapack_int K, double* A, lapack_int lda, const double* tau)
+{
+  return LAPACKE_dorgqr(LAPACK_COL_MAJOR, M, N, K, A, lda, tau);
+}
+
+// Eigenvalues (ascending, in w) and, if JobZ = 'V', eigenvectors (in A) of a symmetric A.
+inline lapack_int syev(char JobZ, char UploA, lapack_int N, double* A, lapack_int lda, double* w)
+{
+  return LAPACKE_dsyev(LAPACK_COL_MAJOR, JobZ, UploA, N, A, lda, w);
+}
+
+} // namespace LinAlg
+#endif
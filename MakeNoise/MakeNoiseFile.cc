@@ -9,6 +9,9 @@ So, eg. we could call:
 ./MakeNoiseCorrelationObject OutFile.dat 1000 4001 4002 4003 ...
 For simplicity in the interface, I assume every LB run has exactly one file segment.
 
+The output format is described in ../NoiseFile.hh:  a header with the channel list, frequency range
+and event count, then a table of block offsets and per-column checksums, then the blocks themselves.
+
 Be sure to compile with optimization enabled!  It makes a big difference.
 */
 
@@ -22,10 +25,21 @@ Be sure to compile with optimization enabled!  It makes a big difference.
 #include "EXOUtilities/EXORunInfoManager.hh"
 #include "EXOUtilities/EXORunInfo.hh"
 #include "TChain.h"
+#include "../NoiseFile.hh"
 #include <cassert>
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <cstring>
+
+void WriteToFile(std::filebuf& outfile, const void* data, size_t numChars, const char* filename)
+{
+  // Write numChars bytes, or report the short write and quit; a partial noise file is worse than none.
+  if(numChars > 0 and outfile.sputn((const char*)data, numChars) != std::streamsize(numChars)) {
+    std::cout<<"Failed to write to "<<filename<<" (disk full?)"<<std::endl;
+    std::exit(1);
+  }
+}
 
 bool IsEventAcceptable(const EXOEventData* event, const EXOCoincidences& coinc)
 {
@@ -275,16 +289,69 @@ int main(int argc, char** argv)
   }
   std::cout<<"Done filling RI entries."<<std::endl;
 
+  // Build the header and tables.
+  // The channel list is just the order in which we filled FourierWaveforms.
+  std::vector<unsigned char> FileChannels;
+  for(Int_t channel = 0; channel < NUMBER_READOUT_CHANNELS; channel++) {
+    if(EXOMiscUtil::TypeOfChannel(channel) == EXOMiscUtil::kVWire) continue;
+    FileChannels.push_back(channel);
+  }
+  assert(FileChannels.size() == ChannelsToHold);
+
+  NoiseFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.fMagic, NoiseFileMagic, sizeof(NoiseFileMagic));
+  header.fVersion = NoiseFileVersion;
+  header.fNumChannels = ChannelsToHold;
+  header.fMinF = 1;
+  header.fMaxF = 1024;
+  header.fBytesPerValue = sizeof(double);
+  header.fLayout = kNoiseFileFullBlocks;
+  header.fNumEvents = NumEntriesAccepted;
+  header.fChannelsOffset = sizeof(header);
+  header.fBlockOffsetsOffset = 8*((header.fChannelsOffset + FileChannels.size() + 7)/8);
+  header.fChecksumsOffset = header.fBlockOffsetsOffset + sizeof(uint64_t)*NoiseCorrelations.size();
+
+  std::vector<uint64_t> BlockOffsets;
+  std::vector<uint64_t> Checksums;
+  uint64_t NextOffset = header.fChecksumsOffset;
+  for(size_t f = 0; f < NoiseCorrelations.size(); f++) NextOffset += sizeof(uint64_t)*(f == 1023 ? 1 : 2)*ChannelsToHold;
+  for(size_t f = 0; f < NoiseCorrelations.size(); f++) {
+    size_t BlockSize = (f == 1023 ? 1 : 2)*ChannelsToHold;
+    BlockOffsets.push_back(NextOffset);
+    NextOffset += sizeof(double)*NoiseCorrelations[f].size();
+    for(size_t col = 0; col < BlockSize; col++) {
+      Checksums.push_back(NoiseFileChecksum(&NoiseCorrelations[f][col*BlockSize], sizeof(double)*BlockSize));
+    }
+  }
+  header.fTableChecksum = NoiseFileChecksum(&FileChannels[0], FileChannels.size());
+  header.fTableChecksum = NoiseFileChecksum(&BlockOffsets[0], sizeof(uint64_t)*BlockOffsets.size(), header.fTableChecksum);
+  header.fTableChecksum = NoiseFileChecksum(&Checksums[0], sizeof(uint64_t)*Checksums.size(), header.fTableChecksum);
+
   // Write out to file.
   std::cout<<"Writing to file."<<std::endl;
   std::filebuf outfile;
-  outfile.open(argv[1],
-               std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
-  assert(outfile.pubseekoff(0, std::ios_base::cur, std::ios_base::out) == std::streampos(0));
+  if(outfile.open(argv[1], std::ios_base::out | std::ios_base::binary | std::ios_base::trunc) == NULL) {
+    std::cout<<"Unable to open "<<argv[1]<<" for writing."<<std::endl;
+    std::exit(1);
+  }
+  WriteToFile(outfile, &header, sizeof(header), argv[1]);
+  WriteToFile(outfile, &FileChannels[0], FileChannels.size(), argv[1]);
+  std::vector<char> Padding(header.fBlockOffsetsOffset - header.fChannelsOffset - FileChannels.size(), 0);
+  if(not Padding.empty()) WriteToFile(outfile, &Padding[0], Padding.size(), argv[1]);
+  WriteToFile(outfile, &BlockOffsets[0], sizeof(uint64_t)*BlockOffsets.size(), argv[1]);
+  WriteToFile(outfile, &Checksums[0], sizeof(uint64_t)*Checksums.size(), argv[1]);
   for(size_t f = 0; f < NoiseCorrelations.size(); f++) {
-    size_t numChars = sizeof(double)*NoiseCorrelations[f].size();
-    assert(outfile.sputn((char*)&NoiseCorrelations[f][0], numChars) == numChars);
+    if(outfile.pubseekoff(0, std::ios_base::cur, std::ios_base::out) != std::streampos(BlockOffsets[f])) {
+      std::cout<<"Block for f = "<<f+1<<" isn't where the offset table says it is."<<std::endl;
+      std::exit(1);
+    }
+    WriteToFile(outfile, &NoiseCorrelations[f][0], sizeof(double)*NoiseCorrelations[f].size(), argv[1]);
+  }
+  if(outfile.close() == NULL) {
+    std::cout<<"Failed to close "<<argv[1]<<std::endl;
+    std::exit(1);
   }
-  std::cout<<"Done; closing file as we terminate."<<std::endl;
+  std::cout<<"Done writing the file."<<std::endl;
   std::cout<<NumEntriesAccepted<<" entries were used in creating this noise correlation file."<<std::endl;
 }
@@ -0,0 +1,63 @@
+#ifndef NoiseFile_hh
+#define NoiseFile_hh
+/*
+The on-disk format of a noise correlation file, as written by MakeNoise/MakeNoiseFile.cc
+and read by NoiseFileReader.  Header-only, so that MakeNoiseFile can include it without
+linking against anything from the refitter.
+
+Layout:
+[NoiseFileHeader]
+[channel list: fNumChannels software channel numbers, one byte each, in file index order]
+[padding to 8 bytes]
+[block offsets: one uint64_t per frequency fMinF...fMaxF]
+[column checksums: one uint64_t per column of each block, block by block]
+[blocks]
+
+The block for frequency f has 2*fNumChannels rows and columns (fNumChannels for f == fMaxF,
+where the imaginary parts vanish), column-major; index c < fNumChannels refers to the real part
+of file channel c, and index fNumChannels + c to its imaginary part.  So the entry at (row, col)
+is <X_row X_col>, averaged over fNumEvents noise events.
+
+Everything is in native byte order.  fTableChecksum covers the channel list, offsets and
+column checksums, so a reader can trust the tables before it reads any block; each column
+checksum lets a reader verify exactly the columns it fetched, without reading the whole block.
+
+Files from before this format (bare blocks with a hard-coded channel order) have no magic;
+NoiseFileReader still accepts them.
+*/
+
+#include <cstddef>
+#include <stdint.h>
+
+struct NoiseFileHeader
+{
+  char fMagic[8];
+  uint32_t fVersion;
+  uint32_t fNumChannels;
+  uint32_t fMinF;
+  uint32_t fMaxF;
+  uint32_t fBytesPerValue; // Precision; only 8 (double) is written for now.
+  uint32_t fLayout; // Only kNoiseFileFullBlocks for now.
+  uint64_t fNumEvents; // Number of noise events averaged.
+  uint64_t fChannelsOffset;
+  uint64_t fBlockOffsetsOffset;
+  uint64_t fChecksumsOffset;
+  uint64_t fTableChecksum;
+};
+
+static const char NoiseFileMagic[8] = {'E', 'X', 'O', 'N', 'O', 'I', 'S', 'E'};
+static const uint32_t NoiseFileVersion = 1;
+static const uint32_t kNoiseFileFullBlocks = 0;
+
+// 64-bit FNV-1a.  Pass the previous result as Hash to checksum discontiguous pieces.
+inline uint64_t NoiseFileChecksum(const void* data, size_t length, uint64_t Hash = 14695981039346656037ULL)
+{
+  const unsigned char* bytes = (const unsigned char*)data;
+  for(size_t i = 0; i < length; i++) {
+    Hash ^= bytes[i];
+    Hash *= 1099511628211ULL;
+  }
+  return Hash;
+}
+
+#endif
@@ -0,0 +1,201 @@
+#include "NoiseFileReader.hh"
+#include "NoiseFile.hh"
+#include "Constants.hh"
+#include "EXOUtilities/EXODimensions.hh"
+#include "EXOUtilities/EXOMiscUtil.hh"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+NoiseFileReader::NoiseFileReader(const std::string& Filename)
+: fFilename(Filename),
+  fFD(-1),
+  fLegacy(false),
+  fNumEvents(0),
+  fMinF(0),
+  fMaxF(0),
+  fNumChannels(0),
+  fFileIndex(256, -1)
+{
+  fFD = open(fFilename.c_str(), O_RDONLY);
+  struct stat FileStat;
+  if(fFD < 0 or fstat(fFD, &FileStat) != 0) {
+    std::cout<<"Unable to open noise file "<<fFilename<<std::endl;
+    std::exit(1);
+  }
+  uint64_t FileSize = FileStat.st_size;
+
+  NoiseFileHeader header;
+  if(FileSize < sizeof(header)) {
+    OpenLegacy(FileSize);
+    return;
+  }
+  ReadAt(&header, sizeof(header), 0);
+  if(std::memcmp(header.fMagic, NoiseFileMagic, sizeof(NoiseFileMagic)) != 0) {
+    OpenLegacy(FileSize);
+    return;
+  }
+
+  if(header.fVersion != NoiseFileVersion or
+     header.fBytesPerValue != sizeof(double) or
+     header.fLayout != kNoiseFileFullBlocks or
+     header.fNumChannels == 0 or header.fNumChannels > 256 or
+     header.fMinF > header.fMaxF) {
+    std::cout<<"Noise file "<<fFilename<<" has an unsupported version, precision or layout."<<std::endl;
+    std::exit(1);
+  }
+  fNumEvents = header.fNumEvents;
+  fMinF = header.fMinF;
+  fMaxF = header.fMaxF;
+  fNumChannels = header.fNumChannels;
+  size_t NumFreqs = fMaxF - fMinF + 1;
+
+  // Read the tables, and check them before trusting anything in them.
+  std::vector<unsigned char> FileChannels(fNumChannels);
+  fBlockOffsets.resize(NumFreqs);
+  fFirstChecksum.resize(NumFreqs + 1, 0);
+  for(size_t freq = fMinF; freq <= fMaxF; freq++) {
+    fFirstChecksum[freq - fMinF + 1] = fFirstChecksum[freq - fMinF] + GetFileBlockSize(freq);
+  }
+  fChecksums.resize(fFirstChecksum[NumFreqs]);
+  if(header.fChecksumsOffset + fChecksums.size()*sizeof(uint64_t) > FileSize) {
+    std::cout<<"Noise file "<<fFilename<<" is truncated."<<std::endl;
+    std::exit(1);
+  }
+  ReadAt(&FileChannels[0], FileChannels.size(), header.fChannelsOffset);
+  ReadAt(&fBlockOffsets[0], fBlockOffsets.size()*sizeof(uint64_t), header.fBlockOffsetsOffset);
+  ReadAt(&fChecksums[0], fChecksums.size()*sizeof(uint64_t), header.fChecksumsOffset);
+  uint64_t TableChecksum = NoiseFileChecksum(&FileChannels[0], FileChannels.size());
+  TableChecksum = NoiseFileChecksum(&fBlockOffsets[0], fBlockOffsets.size()*sizeof(uint64_t), TableChecksum);
+  TableChecksum = NoiseFileChecksum(&fChecksums[0], fChecksums.size()*sizeof(uint64_t), TableChecksum);
+  if(TableChecksum != header.fTableChecksum) {
+    std::cout<<"Noise file "<<fFilename<<" has a corrupt header."<<std::endl;
+    std::exit(1);
+  }
+
+  for(size_t i = 0; i < fNumChannels; i++) fFileIndex[FileChannels[i]] = i;
+  for(size_t freq = fMinF; freq <= fMaxF; freq++) {
+    size_t FileBlockSize = GetFileBlockSize(freq);
+    if(fBlockOffsets[freq - fMinF] + FileBlockSize*FileBlockSize*sizeof(double) > FileSize) {
+      std::cout<<"Noise file "<<fFilename<<" is truncated."<<std::endl;
+      std::exit(1);
+    }
+  }
+}
+
+NoiseFileReader::~NoiseFileReader()
+{
+  if(fFD >= 0) close(fFD);
+}
+
+void NoiseFileReader::OpenLegacy(uint64_t FileSize)
+{
+  // A bare file of blocks for f = 1...1024, holding u-wires and APDs in software-channel order
+  // (that is, every channel but the v-wires, which is what MakeNoiseFile used to keep).
+  fLegacy = true;
+  fMinF = 1;
+  fMaxF = 1024;
+  for(size_t channel = 0; channel < NUMBER_READOUT_CHANNELS; channel++) {
+    if(EXOMiscUtil::TypeOfChannel(channel) == EXOMiscUtil::kVWire) continue;
+    fFileIndex[channel] = fNumChannels++;
+  }
+  if(FileSize != fNumChannels*fNumChannels*(4*1023+1)*sizeof(double)) {
+    std::cout<<"Noise file "<<fFilename<<" has an unexpected size."<<std::endl;
+    std::exit(1);
+  }
+  fBlockOffsets.resize(fMaxF - fMinF + 1);
+  for(size_t freq = fMinF; freq <= fMaxF; freq++) {
+    fBlockOffsets[freq - fMinF] = (freq - fMinF)*4*sizeof(double)*fNumChannels*fNumChannels;
+  }
+}
+
+void NoiseFileReader::ReadAt(void* dest, size_t length, uint64_t offset) const
+{
+  // pread may return short counts, so loop until done.
+  char* pos = (char*)dest;
+  while(length > 0) {
+    ssize_t ret = pread(fFD, pos, length, offset);
+    if(ret <= 0) {
+      std::cout<<"Failed to read "<<length<<" bytes at offset "<<offset<<" of noise file "<<fFilename<<std::endl;
+      std::exit(1);
+    }
+    pos += ret;
+    offset += ret;
+    length -= ret;
+  }
+}
+
+void NoiseFileReader::ReadBlock(size_t freq,
+                                const std::vector<unsigned char>& Channels,
+                                std::vector<double>& block) const
+{
+  std::vector<size_t> Columns(Channels.size()*(freq == fMaxF ? 1 : 2));
+  for(size_t i = 0; i < Columns.size(); i++) Columns[i] = i;
+  ReadColumns(freq, Channels, Columns, block);
+}
+
+void NoiseFileReader::ReadColumns(size_t freq,
+                                  const std::vector<unsigned char>& Channels,
+                                  const std::vector<size_t>& Columns,
+                                  std::vector<double>& dest) const
+{
+  assert(freq >= fMinF and freq <= fMaxF);
+  const size_t NumChannels = Channels.size();
+  const size_t BlockSize = NumChannels*(freq == fMaxF ? 1 : 2);
+  const size_t FileBlockSize = GetFileBlockSize(freq);
+
+  // Where each block index lives in the file's block.
+  std::vector<size_t> FileIndex(BlockSize);
+  for(size_t i = 0; i < BlockSize; i++) {
+    unsigned char channel = Channels[i % NumChannels];
+    if(not HasChannel(channel)) {
+      std::cout<<"Channel "<<int(channel)<<" is not in noise file "<<fFilename<<std::endl;
+      std::exit(1);
+    }
+    FileIndex[i] = fFileIndex[channel] + (i < NumChannels ? 0 : fNumChannels);
+  }
+
+  // Fetch just the file columns we need; runs of adjacent columns come in one read, since many
+  // small reads don't scale well.  Suppressed or bad channels are simply skipped over.
+  std::vector<size_t> FileColumns(Columns.size());
+  for(size_t i = 0; i < Columns.size(); i++) {
+    assert(Columns[i] < BlockSize);
+    FileColumns[i] = FileIndex[Columns[i]];
+  }
+  std::sort(FileColumns.begin(), FileColumns.end());
+  FileColumns.erase(std::unique(FileColumns.begin(), FileColumns.end()), FileColumns.end());
+  std::vector<size_t> ColumnSlot(FileBlockSize, FileBlockSize);
+  for(size_t i = 0; i < FileColumns.size(); i++) ColumnSlot[FileColumns[i]] = i;
+  std::vector<double> FileData(FileColumns.size()*FileBlockSize);
+  const size_t ColumnBytes = FileBlockSize*sizeof(double);
+  for(size_t RunStart = 0; RunStart < FileColumns.size(); ) {
+    size_t RunEnd = RunStart + 1;
+    while(RunEnd < FileColumns.size() and FileColumns[RunEnd] == FileColumns[RunEnd-1] + 1) RunEnd++;
+    ReadAt(&FileData[RunStart*FileBlockSize], (RunEnd - RunStart)*ColumnBytes,
+           fBlockOffsets[freq - fMinF] + FileColumns[RunStart]*ColumnBytes);
+    RunStart = RunEnd;
+  }
+  if(not fLegacy) {
+    for(size_t i = 0; i < FileColumns.size(); i++) {
+      if(NoiseFileChecksum(&FileData[i*FileBlockSize], ColumnBytes) !=
+         fChecksums[fFirstChecksum[freq - fMinF] + FileColumns[i]]) {
+        std::cout<<"Checksum mismatch in noise file "<<fFilename<<" at f = "<<freq
+                 <<", column "<<FileColumns[i]<<std::endl;
+        std::exit(1);
+      }
+    }
+  }
+
+  // Reorder.
+  dest.resize(BlockSize*Columns.size());
+  for(size_t col = 0; col < Columns.size(); col++) {
+    const double* FileCol = &FileData[ColumnSlot[FileIndex[Columns[col]]]*FileBlockSize];
+    for(size_t row = 0; row < BlockSize; row++) dest[row + BlockSize*col] = FileCol[FileIndex[row]];
+  }
+}
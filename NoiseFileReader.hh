@@ -0,0 +1,63 @@
+#ifndef NoiseFileReader_hh
+#define NoiseFileReader_hh
+/*
+Read noise correlation blocks from a noise file (see NoiseFile.hh), for a chosen set of channels.
+
+Only the columns belonging to the requested channels are fetched, with positioned reads
+(adjacent columns are coalesced into one read), and each fetched column is checked against
+its checksum.  Files in the legacy format are accepted too; those carry no channel list or
+checksums, so we fall back to the hard-coded channel order and read whole blocks.
+*/
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class NoiseFileReader
+{
+ public:
+  // Open and validate the file; exits on failure.
+  NoiseFileReader(const std::string& Filename);
+  ~NoiseFileReader();
+
+  bool IsLegacy() const { return fLegacy; }
+  uint64_t GetNumEvents() const { return fNumEvents; } // Zero if unknown (legacy files).
+  size_t GetMinF() const { return fMinF; }
+  size_t GetMaxF() const { return fMaxF; }
+  bool HasChannel(unsigned char channel) const { return fFileIndex[channel] >= 0; }
+
+  // Fill block (resized as needed) with the block for frequency freq, restricted to and reordered for Channels.
+  // The result is column-major with 2*Channels.size() rows and columns (Channels.size() for freq == GetMaxF()),
+  // reals before imaginaries, just like the file.
+  void ReadBlock(size_t freq, const std::vector<unsigned char>& Channels, std::vector<double>& block) const;
+
+  // Like ReadBlock, but only fill in the given columns of the block (by block index); dest (resized as needed)
+  // gets each of them in turn, whole.  This is all we need to add a channel to a block we already have.
+  void ReadColumns(size_t freq,
+                   const std::vector<unsigned char>& Channels,
+                   const std::vector<size_t>& Columns,
+                   std::vector<double>& dest) const;
+
+ private:
+  std::string fFilename;
+  int fFD;
+  bool fLegacy;
+  uint64_t fNumEvents;
+  size_t fMinF;
+  size_t fMaxF;
+  size_t fNumChannels;
+  std::vector<int> fFileIndex; // Software channel -> index in the file, or -1.
+  std::vector<uint64_t> fBlockOffsets; // Indexed by freq - fMinF.
+  std::vector<uint64_t> fChecksums; // Column checksums, block by block.
+  std::vector<size_t> fFirstChecksum; // Index into fChecksums of the first column of each block.
+
+  size_t GetFileBlockSize(size_t freq) const { return fNumChannels*(freq == fMaxF ? 1 : 2); }
+  void ReadAt(void* dest, size_t length, uint64_t offset) const;
+  void OpenLegacy(uint64_t FileSize);
+
+  // No copying -- we own a file descriptor.
+  NoiseFileReader(const NoiseFileReader&);
+  NoiseFileReader& operator=(const NoiseFileReader&);
+};
+#endif
@@ -0,0 +1,196 @@
+#ifndef NoiseOperator_hh
+#define NoiseOperator_hh
+/*
+Everything that depends on one particular set of channels:  the noise blocks (reordered and
+preconditioned for that set), quantities derived from them, and the queue of vectors waiting
+to be multiplied by them.
+
+EXORefitSignals keeps a cache of these, keyed by channel set, so that events with different
+channel sets (eg. when a channel is suppressed for a few runs) can be in flight together,
+each multiplied against its own operator.  An operator can only be evicted from the cache
+once no event in flight refers to it.
+*/
+
+#include "NoiseStore.hh"
+#include <boost/atomic.hpp>
+#include <sys/mman.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstddef>
+
+// A growable array for the multiplication queues.  Unlike std::vector, it never initializes the memory it
+// allocates (fresh anonymous pages), so nothing is placed on a NUMA node until somebody writes it; that lets
+// the thread which will multiply each row be the first to touch it (see EXORefitSignals::PlaceNoiseOperator).
+// resize() grows the capacity geometrically, and leaves any new elements undefined.
+template<typename T>
+class QueueBuffer
+{
+ public:
+  QueueBuffer() : fData(NULL), fSize(0), fCapacity(0) {}
+  ~QueueBuffer() { Release(); }
+
+  size_t size() const { return fSize; }
+  size_t capacity() const { return fCapacity; }
+  bool empty() const { return fSize == 0; }
+  T* data() { return fData; }
+  const T* data() const { return fData; }
+  T& operator[](size_t i) { return fData[i]; }
+  const T& operator[](size_t i) const { return fData[i]; }
+  void clear() { fSize = 0; }
+
+  void reserve(size_t n) {
+    if(n <= fCapacity) return;
+    void* addr = mmap(NULL, n*sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED) {
+      std::cout<<"Unable to allocate "<<n*sizeof(T)<<" bytes for a noise multiplication queue."<<std::endl;
+      std::exit(1);
+    }
+    std::copy(fData, fData + fSize, (T*)addr);
+    size_t Size = fSize;
+    Release();
+    fData = (T*)addr;
+    fSize = Size;
+    fCapacity = n;
+  }
+  void resize(size_t n) {
+    if(n > fCapacity) reserve(std::max(n, 2*fCapacity));
+    fSize = n;
+  }
+  void swap(QueueBuffer& other) {
+    std::swap(fData, other.fData);
+    std::swap(fSize, other.fSize);
+    std::swap(fCapacity, other.fCapacity);
+  }
+
+ private:
+  T* fData;
+  size_t fSize;
+  size_t fCapacity;
+  void Release() {
+    if(fData) munmap(fData, fCapacity*sizeof(T));
+    fData = NULL;
+    fSize = fCapacity = 0;
+  }
+
+  // No copying -- we own a mapping.
+  QueueBuffer(const QueueBuffer&);
+  QueueBuffer& operator=(const QueueBuffer&);
+};
+
+struct NoiseOperator
+{
+  NoiseOperator()
+  : fStore(NULL),
+    fFirstAPDChannelIndex(0),
+    fNoiseColumnLength(0),
+    fMulIn(NULL),
+    fMulOut(NULL),
+    fMulInSingle(NULL),
+    fMulOutSingle(NULL),
+    fMulNumVectors(0),
+    fMulColumnLength(0),
+    fMulFirstRow(0),
+    fNumRecycleHarvesters(0),
+    fNumRecycleHarvests(0),
+    fRecycleReady(false),
+    fNumEventsInFlight(0),
+    fLastUsed(0)
+  {
+    fNumVectorsInQueue[0] = fNumVectorsInQueue[1] = 0;
+  }
+  ~NoiseOperator() { delete fStore; }
+
+  NoiseStore* fStore;
+  std::vector<unsigned char> fChannels;
+  size_t fFirstAPDChannelIndex;
+  size_t fNoiseColumnLength;
+  std::vector<double> fNoiseDiag;
+  std::vector<double> fInvSqrtNoiseDiag;
+
+  // Vectors waiting for multiplication by this operator, and the results of the last multiplication.
+  // There are two of each, so that (when passes are pipelined) one set of events can fill one buffer
+  // while the other buffer is being multiplied; an event always uses the same one (its fNoiseBuffer).
+  // Each event writes into, and reads from, its own slot of these (see EXORefitSignals::ReserveNoiseMul);
+  // fNumVectorsInQueue[b] counts the vectors in use, and fNoiseMulQueue[b] may hold room for more.
+  // With a single-precision store (IsSingle), the Single ones are used instead, and the others stay empty:
+  // each event rounds its vectors to float as it queues them, and widens the results again as it reads them,
+  // so the multiplication itself only moves floats.
+  QueueBuffer<double> fNoiseMulQueue[2];
+  QueueBuffer<double> fNoiseMulResult[2];
+  QueueBuffer<float> fNoiseMulQueueSingle[2];
+  QueueBuffer<float> fNoiseMulResultSingle[2];
+  boost::atomic<size_t> fNumVectorsInQueue[2]; // Bumped by concurrent requests.
+  bool IsSingle() const { return fStore->GetPrecision() == NoiseStore::kSingle; }
+  size_t GetQueueLength(size_t b) const {
+    return IsSingle() ? fNoiseMulQueueSingle[b].size() : fNoiseMulQueue[b].size();
+  }
+
+  // What the pass in progress multiplies (see EXORefitSignals::StartNoiseMultiplication):  fMulNumVectors columns,
+  // fMulColumnLength apart, whose first row is row fMulFirstRow of a noise column.  Normally those are just
+  // the vectors queued here; but in a noise group, they are the rows for our own frequencies of every vector
+  // queued for this channel set anywhere in the group, gathered into fGroupQueue (and multiplied into fGroupResult).
+  // Again, with a single-precision store the Single ones are used instead.
+  std::vector<double> fGroupQueue;
+  std::vector<double> fGroupResult;
+  std::vector<float> fGroupQueueSingle;
+  std::vector<float> fGroupResultSingle;
+  const double* fMulIn;
+  double* fMulOut;
+  const float* fMulInSingle;
+  float* fMulOutSingle;
+  size_t fMulNumVectors;
+  size_t fMulColumnLength;
+  size_t fMulFirstRow;
+
+  // The rows [FirstRow, FirstRow + NumRows) of a noise column which belong to frequency indices [Begin, End).
+  void GetRowsForFreqs(size_t Begin, size_t End, size_t& FirstRow, size_t& NumRows) const {
+    FirstRow = 2*fChannels.size()*Begin;
+    NumRows = 0;
+    if(Begin < End) NumRows = (End == fStore->GetNumFreqs() ? fNoiseColumnLength : 2*fChannels.size()*End) - FirstRow;
+  }
+
+  // Whole noise blocks, derived once per operator (see EXORefitSignals::PrepareNoiseBlocks), and only if needed;
+  // each is column-major, starting at fNoiseBlockOffsets[f].
+  // For the direct solver (see EXORefitSignals::DoDirectSolve), the inverse of each block:
+  std::vector<double> fInvNoiseBlocks;
+  // For the block preconditioner (see EXORefitSignals::fBlockPrecon), the upper Cholesky factor U of each block,
+  // with zeros below the diagonal:  block = trans(U) U.
+  std::vector<double> fNoiseBlockFactors;
+  std::vector<size_t> fNoiseBlockOffsets;
+
+  // Directions recycled from finished events into new ones (see EXORefitSignals::AddRecycleVectors):  orthonormal
+  // noise columns Y, approximating the eigenvectors of the noise with the most extreme eigenvalues; N Y; and the
+  // Ritz values, trans(Y) N Y = diag(fRecycleRitz).  They are collected from the first few events, and then fixed
+  // (fRecycleReady), so that an event's preconditioner never changes under it.
+  std::vector<double> fRecycleY;
+  std::vector<double> fRecycleNY;
+  std::vector<double> fRecycleRitz;
+  size_t fNumRecycleHarvesters; // Events accepted to harvest directions (see EventHandler::fHarvestRecycled).
+  size_t fNumRecycleHarvests; // Of those, the ones whose directions have been added.
+  bool fRecycleReady;
+  size_t GetNumRecycled() const { return fNoiseColumnLength ? fRecycleY.size()/fNoiseColumnLength : 0; }
+
+  size_t fNumEventsInFlight; // Events which were accepted with this operator, and haven't been sent off yet.
+  size_t fLastUsed; // When an event last asked for this operator; for LRU eviction.
+
+  // Approximate memory held on behalf of this operator, in bytes.
+  size_t GetMemoryUsage() const {
+    return (fStore ? fStore->GetMappingLength() : 0) +
+           sizeof(double)*(fNoiseMulQueue[0].capacity() + fNoiseMulResult[0].capacity() +
+                           fNoiseMulQueue[1].capacity() + fNoiseMulResult[1].capacity() +
+                           fGroupQueue.capacity() + fGroupResult.capacity() +
+                           fInvNoiseBlocks.capacity() + fNoiseBlockFactors.capacity() +
+                           fRecycleY.capacity() + fRecycleNY.capacity()) +
+           sizeof(float)*(fNoiseMulQueueSingle[0].capacity() + fNoiseMulResultSingle[0].capacity() +
+                          fNoiseMulQueueSingle[1].capacity() + fNoiseMulResultSingle[1].capacity() +
+                          fGroupQueueSingle.capacity() + fGroupResultSingle.capacity());
+  }
+
+ private:
+  // No copying -- we own the store.
+  NoiseOperator(const NoiseOperator&);
+  NoiseOperator& operator=(const NoiseOperator&);
+};
+#endif
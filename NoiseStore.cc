@@ -0,0 +1,1192 @@
+#include "NoiseStore.hh"
+#include "NoiseFileReader.hh"
+#include "WorkerPool.hh"
+#include "EXOUtilities/EXODimensions.hh"
+#include "EXOUtilities/EXOMiscUtil.hh"
+#include "LinearAlgebra.hh"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <algorithm>
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+// Layout of a store (whether a file or a shared-memory segment):
+// [NoiseStoreHeader][channel list][padding to a page boundary][blocks for f = MIN_F...fMaxF][diagonal]
+// A store limited to a share of the frequencies has no entries at all for the blocks outside its share,
+// but the diagonal still covers every frequency.
+// For the kTiledUpper layout, each block is stored as its tile-columns j in order; within tile-column j,
+// the diagonal tile (j,j) comes first, followed by tiles (0,j) ... (j-1,j).
+// Blocks are floats for kSingle, doubles otherwise; the diagonal is always double.
+// For kLowRank, a table of ranks (one uint32_t per block) follows the channel list, and each block holds
+// [d: BlockSize][s: MaxRank][U: BlockSize x MaxRank], approximating the block by diag(d) + U diag(s) trans(U).
+// Only the first rank(f) entries of s and columns of U are meaningful.
+// For kHermitian, each block below MAX_F is the CxC complex matrix K, column-major with real and imaginary parts
+// interleaved; the block at MAX_F (which has no imaginary part) is stored whole, as for kFull.
+// Everything is in native byte order -- these are a cache, not an archival format.
+// The magic is written last, so a store with a valid magic is complete.
+struct NoiseStoreHeader
+{
+  char fMagic[8];
+  uint32_t fVersion;
+  uint32_t fNumChannels;
+  uint32_t fMinF;
+  uint32_t fMaxF;
+  uint32_t fUseWireAPDCorrelations;
+  uint32_t fLayout;
+  uint32_t fNumTiles; // Tiles per block dimension, for kTiledUpper.
+  uint32_t fPrecision;
+  uint32_t fPadding;
+  uint32_t fUnused;
+  uint64_t fSourceSize; // Size and modification time of the raw noise file it was built from.
+  int64_t fSourceModTime;
+  uint64_t fBlocksOffset;
+  uint64_t fDiagOffset;
+  uint64_t fTotalLength;
+  uint32_t fLowRankMaxRank;
+  uint32_t fPadding2;
+  double fLowRankTolerance;
+  double fApproximationError; // Worst relative error of a block multiplication, versus the exact double block.
+  uint32_t fShareIndex;
+  uint32_t fNumShares;
+};
+static const char NoiseStoreMagic[8] = {'R', 'F', 'N', 'O', 'I', 'S', 'E', '\0'};
+static const uint32_t NoiseStoreVersion = 6;
+static const size_t NoiseStorePageSize = 4096;
+
+// For kTiledUpper, each block is cut into (at most) NumTiles x NumTiles tiles.
+// More tiles save more memory (the stored fraction is about (1 + 1/NumTiles)/2),
+// but tiles which are too small make for inefficient GEMM calls.
+static const size_t NumTiles = 8;
+
+// How long to wait for another process to finish filling a shared-memory store.
+static const unsigned int SharedStoreTimeout_sec = 1800;
+
+static struct stat StatNoiseFile(const std::string& NoiseFilename)
+{
+  struct stat SourceStat;
+  if(stat(NoiseFilename.c_str(), &SourceStat) != 0) {
+    std::cout<<"Unable to stat noise file "<<NoiseFilename<<std::endl;
+    std::exit(1);
+  }
+  return SourceStat;
+}
+
+static bool IsNamedSharedMemory(const std::string& name, int fd)
+{
+  // Whether name still refers to the shared-memory segment we have open as fd; since we opened it, its last user
+  // may have removed it, and somebody else may have made a new one under the same name.
+  struct stat Ours, Named;
+  int NamedFd = shm_open(name.c_str(), O_RDONLY, 0600);
+  if(NamedFd < 0) return false;
+  bool Same = (fstat(fd, &Ours) == 0 and fstat(NamedFd, &Named) == 0 and
+               Ours.st_dev == Named.st_dev and Ours.st_ino == Named.st_ino);
+  close(NamedFd);
+  return Same;
+}
+
+static void UnlinkSharedMemory(const std::string& name, int fd)
+{
+  // Remove the shared-memory segment we have open as fd -- but not somebody else's new one under the same name.
+  if(IsNamedSharedMemory(name, fd)) shm_unlink(name.c_str());
+}
+
+NoiseStore::NoiseStore(const std::string& NoiseFilename,
+                       const std::vector<unsigned char>& Channels,
+                       bool UseWireAPDCorrelations,
+                       const Options& options)
+: fChannels(Channels),
+  fUseWireAPDCorrelations(UseWireAPDCorrelations),
+  fLayout(options.fLayout),
+  fPrecision(options.fPrecision),
+  fLowRankTolerance(options.fLowRankTolerance),
+  fLowRankMaxRank(options.fLowRankMaxRank),
+  fHermitianTolerance(options.fHermitianTolerance),
+  fMaxF(options.fMaxF),
+  fShareIndex(options.fShareIndex),
+  fNumShares(options.fNumShares),
+  fFirstOwnedF(0),
+  fEndOwnedF(0),
+  fApproximationError(0),
+  fMapping(NULL),
+  fMappingLength(0),
+  fSharedMemoryFd(-1)
+{
+  if(fLayout == kLowRank and (fPrecision != kDouble or fLowRankMaxRank == 0)) {
+    std::cout<<"The low-rank noise layout needs double precision and a nonzero maximum rank."<<std::endl;
+    std::exit(1);
+  }
+  if(fLayout == kHermitian and fPrecision != kDouble) {
+    std::cout<<"The Hermitian noise layout needs double precision."<<std::endl;
+    std::exit(1);
+  }
+  if(fMaxF < MIN_F or fMaxF > MAX_F) {
+    std::cout<<"Can't keep noise up to f = "<<fMaxF<<"; it must be in "<<MIN_F<<"..."<<MAX_F<<std::endl;
+    std::exit(1);
+  }
+  if(fNumShares == 0 or fShareIndex >= fNumShares) {
+    std::cout<<"Can't keep share "<<fShareIndex<<" of "<<fNumShares<<" of the noise blocks."<<std::endl;
+    std::exit(1);
+  }
+  GetFreqShare(GetNumFreqs(), fShareIndex, fNumShares, fFirstOwnedF, fEndOwnedF);
+  if(fLayout != kLowRank) {
+    // Irrelevant, so keep them from changing the key.
+    fLowRankTolerance = 0;
+    fLowRankMaxRank = 0;
+  }
+
+  if(options.fBacking == kSharedMemory) OpenSharedMemory(NoiseFilename);
+  else {
+    fStoreFilename = ChooseStoreFilename(NoiseFilename, options.fStoreDirectory);
+    if(not MapStoreFile(NoiseFilename)) {
+      // There is no usable store yet for this channel set, so make one.
+      std::cout<<"Building noise store "<<fStoreFilename<<" from "<<NoiseFilename<<std::endl;
+      BuildStoreFile(NoiseFilename);
+      if(not MapStoreFile(NoiseFilename)) {
+        std::cout<<"Failed to map noise store "<<fStoreFilename<<" just after building it."<<std::endl;
+        std::exit(1);
+      }
+    }
+  }
+
+  // Only now do we know whether the noise is circular enough for the Hermitian layout.  (We still finish
+  // building the store if it isn't, so that others waiting on it find out just as quickly.)
+  if(fLayout == kHermitian and fApproximationError > fHermitianTolerance) {
+    std::cout<<"Dropping the pseudo-covariance of the noise costs a relative error of "<<fApproximationError
+             <<"; can't use the Hermitian layout."<<std::endl;
+    ReleaseMapping();
+    std::exit(1);
+  }
+}
+
+NoiseStore::NoiseStore(const NoiseStore& Source,
+                       const std::string& NoiseFilename,
+                       const std::vector<unsigned char>& Channels)
+: fChannels(Channels),
+  fUseWireAPDCorrelations(Source.fUseWireAPDCorrelations),
+  fLayout(Source.fLayout),
+  fPrecision(Source.fPrecision),
+  fLowRankTolerance(Source.fLowRankTolerance),
+  fLowRankMaxRank(Source.fLowRankMaxRank),
+  fHermitianTolerance(Source.fHermitianTolerance),
+  fMaxF(Source.fMaxF),
+  fShareIndex(Source.fShareIndex),
+  fNumShares(Source.fNumShares),
+  fFirstOwnedF(Source.fFirstOwnedF),
+  fEndOwnedF(Source.fEndOwnedF),
+  fApproximationError(0),
+  fMapping(NULL),
+  fMappingLength(0),
+  fSharedMemoryFd(-1)
+{
+  if(not Source.CanDerive(Channels)) {
+    std::cout<<"Can't derive a noise store for this channel set from the one we have."<<std::endl;
+    std::exit(1);
+  }
+
+  // The store lives in anonymous memory, but otherwise looks just like a mapped store file.
+  // It describes the same raw noise file as its source, whatever has happened to that file since.
+  NoiseStoreHeader header;
+  ComputeLayout(NoiseFilename, header);
+  const NoiseStoreHeader& SourceHeader = *(const NoiseStoreHeader*)Source.fMapping;
+  header.fSourceSize = SourceHeader.fSourceSize;
+  header.fSourceModTime = SourceHeader.fSourceModTime;
+  void* addr = mmap(NULL, header.fTotalLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(addr == MAP_FAILED) {
+    std::cout<<"Unable to allocate "<<header.fTotalLength<<" bytes for a noise store."<<std::endl;
+    std::exit(1);
+  }
+  DeriveStore(Source, NoiseFilename, header, (char*)addr);
+  if(not AttachMapping(addr, header.fTotalLength, header)) {
+    std::cout<<"Derived noise store failed validation."<<std::endl;
+    std::exit(1);
+  }
+  mprotect(addr, header.fTotalLength, PROT_READ);
+}
+
+NoiseStore::~NoiseStore()
+{
+  ReleaseMapping();
+}
+
+void NoiseStore::ReleaseMapping()
+{
+  if(not fMapping) return;
+  if(fSharedMemoryFd >= 0) {
+    // If we can trade our shared lock for an exclusive one, nobody else is using the segment; remove it.
+    // (A user which died, however it died, no longer holds its lock.)
+    if(flock(fSharedMemoryFd, LOCK_EX | LOCK_NB) == 0) UnlinkSharedMemory(fSharedMemoryName, fSharedMemoryFd);
+    close(fSharedMemoryFd);
+    fSharedMemoryFd = -1;
+    fSharedMemoryName.clear();
+  }
+  munmap(fMapping, fMappingLength);
+  fMapping = NULL;
+}
+
+void NoiseStore::Localize(WorkerPool& Pool)
+{
+  // Move the store into private memory, each thread of Pool copying the blocks of its own share of
+  // the frequencies we own (WorkerPool::GetShare) -- so those pages end up on that thread's NUMA node.
+  // A mapped store file (or shared-memory segment) lives wherever its pages were first read in,
+  // which is usually the node of whichever thread built or first used it.
+  char* Local = (char*)mmap(NULL, fMappingLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(Local == MAP_FAILED) {
+    std::cout<<"Unable to allocate "<<fMappingLength<<" bytes to localize a noise store."<<std::endl;
+    std::exit(1);
+  }
+
+  // The header, tables and diagonal are small, and not used in multiplication; just copy them.
+  const char* Old = (const char*)fMapping;
+  size_t BlocksOffset = fBlocks.front() - Old;
+  size_t DiagOffset = fBlocks.back() - Old + GetStoredBlockLength(GetNumFreqs() - 1)*GetElementSize();
+  std::memcpy(Local, Old, BlocksOffset);
+  std::memcpy(Local + DiagOffset, Old + DiagOffset, fMappingLength - DiagOffset);
+  Pool.RunOnAll(boost::bind(&NoiseStore::CopyOwnBlocks, this, boost::cref(Pool), Local));
+
+  for(size_t f = 0; f < GetNumFreqs(); f++) fBlocks[f] = Local + (fBlocks[f] - Old);
+  ReleaseMapping();
+  fMapping = Local;
+  mprotect(Local, fMappingLength, PROT_READ);
+}
+
+void NoiseStore::CopyOwnBlocks(const WorkerPool& Pool, char* Local) const
+{
+  // Runs in each thread of Pool, for Localize.
+  size_t Begin, End;
+  Pool.GetShare(fEndOwnedF - fFirstOwnedF, Begin, End);
+  if(Begin == End) return;
+  Begin += fFirstOwnedF;
+  End += fFirstOwnedF;
+  const char* Old = (const char*)fMapping;
+  size_t Length = fBlocks[End-1] - fBlocks[Begin] + GetStoredBlockLength(End-1)*GetElementSize();
+  std::memcpy(Local + (fBlocks[Begin] - Old), fBlocks[Begin], Length);
+}
+
+uint64_t NoiseStore::ComputeKey(const std::string& NoiseFilename, bool IncludeSource) const
+{
+  // Key the store by everything which affects its contents.  A 64-bit FNV-1a hash is plenty.
+  // Store files are placed next to (and validated against) their raw noise file,
+  // so they needn't include the source in the key; shared-memory segments do.
+  // The format version is included too, so that a leftover shared-memory segment in an older format is never
+  // mistaken for ours.
+  std::vector<unsigned char> KeyBytes = fChannels;
+  KeyBytes.push_back((unsigned char)(NoiseStoreVersion & 0xff));
+  KeyBytes.push_back((unsigned char)(NoiseStoreVersion >> 8));
+  KeyBytes.push_back(fUseWireAPDCorrelations ? 1 : 0);
+  KeyBytes.push_back((unsigned char)fLayout);
+  KeyBytes.push_back((unsigned char)fPrecision);
+  const unsigned char* ToleranceBytes = (const unsigned char*)&fLowRankTolerance;
+  KeyBytes.insert(KeyBytes.end(), ToleranceBytes, ToleranceBytes + sizeof(fLowRankTolerance));
+  KeyBytes.push_back((unsigned char)(fLowRankMaxRank & 0xff));
+  KeyBytes.push_back((unsigned char)(fLowRankMaxRank >> 8));
+  KeyBytes.push_back((unsigned char)(MIN_F & 0xff));
+  KeyBytes.push_back((unsigned char)(fMaxF & 0xff));
+  KeyBytes.push_back((unsigned char)(fMaxF >> 8));
+  KeyBytes.push_back((unsigned char)(fShareIndex & 0xff));
+  KeyBytes.push_back((unsigned char)(fShareIndex >> 8));
+  KeyBytes.push_back((unsigned char)(fNumShares & 0xff));
+  KeyBytes.push_back((unsigned char)(fNumShares >> 8));
+  if(IncludeSource) {
+    struct stat SourceStat = StatNoiseFile(NoiseFilename);
+    std::ostringstream Source;
+    Source << NoiseFilename << ":" << SourceStat.st_size << ":" << SourceStat.st_mtime;
+    std::string SourceString = Source.str();
+    KeyBytes.insert(KeyBytes.end(), SourceString.begin(), SourceString.end());
+  }
+
+  uint64_t Hash = 14695981039346656037ULL;
+  for(size_t i = 0; i < KeyBytes.size(); i++) {
+    Hash ^= KeyBytes[i];
+    Hash *= 1099511628211ULL;
+  }
+  return Hash;
+}
+
+std::string NoiseStore::ChooseStoreFilename(const std::string& NoiseFilename,
+                                            const std::string& StoreDirectory) const
+{
+  size_t SlashPos = NoiseFilename.rfind('/');
+  std::string BaseName = (SlashPos == std::string::npos ? NoiseFilename : NoiseFilename.substr(SlashPos+1));
+  std::string Directory = StoreDirectory;
+  if(Directory.empty()) Directory = (SlashPos == std::string::npos ? "." : NoiseFilename.substr(0, SlashPos));
+
+  std::ostringstream name;
+  name << Directory << "/" << BaseName << "."
+       << std::hex << std::setw(16) << std::setfill('0') << ComputeKey(NoiseFilename, false) << ".store";
+  return name.str();
+}
+
+size_t NoiseStore::GetTileSize(size_t BlockSize) const
+{
+  // Rows (and columns) per tile; the last tile in each dimension may be smaller.
+  if(fLayout != kTiledUpper) return BlockSize;
+  return (BlockSize + NumTiles - 1)/NumTiles;
+}
+
+size_t NoiseStore::GetMaxRank(size_t f) const
+{
+  // Number of modes we have room for in the low-rank block at frequency index f.
+  return std::min<size_t>(fLowRankMaxRank, GetBlockSize(f));
+}
+
+size_t NoiseStore::GetRanksOffset() const
+{
+  // The rank table sits after the channel list, aligned for uint32_t.
+  return 8*((sizeof(NoiseStoreHeader) + fChannels.size() + 7)/8);
+}
+
+size_t NoiseStore::GetStoredBlockLength(size_t f) const
+{
+  // Number of entries (not bytes) stored for the block at frequency index f; none if it isn't ours.
+  if(not OwnsFreq(f)) return 0;
+  size_t BlockSize = GetBlockSize(f);
+  if(fLayout == kLowRank) return BlockSize + GetMaxRank(f)*(BlockSize + 1);
+  if(fLayout == kHermitian) return (BlockSize == fChannels.size() ? BlockSize*BlockSize : BlockSize*BlockSize/2);
+  size_t TileSize = GetTileSize(BlockSize);
+  size_t Length = 0;
+  for(size_t col = 0; col < BlockSize; col += TileSize) {
+    size_t NumCols = std::min(TileSize, BlockSize - col);
+    Length += (col + NumCols)*NumCols; // Every row from the top down through the diagonal tile.
+  }
+  return Length;
+}
+
+template<typename T>
+static void MultiplyStoredBlock(const T* block, size_t BlockSize, bool Tiled, size_t TileSize,
+                                const T* in, T* out, size_t NumVectors, size_t ld)
+{
+  // out = block * in, with block stored as described at the top of this file.
+  // (LinAlg overloads gemm and symm for both precisions, so this is written once for each.)
+  if(not Tiled) {
+    LinAlg::gemm('N', 'N', BlockSize, NumVectors, BlockSize, T(1), block, BlockSize, in, ld, T(0), out, ld);
+    return;
+  }
+
+  // Tiled: walk the tiles in storage order.  Processing the diagonal tile of each tile-column first
+  // means every output row range is initialized (beta = 0) before anything is accumulated into it.
+  const T* tile = block;
+  for(size_t col = 0; col < BlockSize; col += TileSize) {
+    size_t NumCols = std::min(TileSize, BlockSize - col);
+    LinAlg::symm('L', 'U', NumCols, NumVectors, T(1), tile, NumCols, in + col, ld, T(0), out + col, ld);
+    tile += NumCols*NumCols;
+    for(size_t row = 0; row < col; row += TileSize) {
+      // Tile (row, col) contributes to out[row] directly, and to out[col] through its transpose (tile (col, row)).
+      LinAlg::gemm('N', 'N', TileSize, NumVectors, NumCols, T(1), tile, TileSize, in + col, ld, T(1), out + row, ld);
+      LinAlg::gemm('T', 'N', NumCols, NumVectors, TileSize, T(1), tile, TileSize, in + row, ld, T(1), out + col, ld);
+      tile += TileSize*NumCols;
+    }
+  }
+}
+
+template<typename T>
+static void PackStoredBlock(const double* block, size_t BlockSize, size_t TileSize, T* stored)
+{
+  // Copy a whole block into the store, in the order described at the top of this file.
+  // For the kFull layout, TileSize == BlockSize, so this is just one tile containing the whole block.
+  for(size_t TileCol = 0; TileCol < BlockSize; TileCol += TileSize) {
+    size_t NumCols = std::min(TileSize, BlockSize - TileCol);
+    // The diagonal tile first, then the tiles above it (which all have TileSize rows).
+    std::vector<size_t> TileRows(1, TileCol);
+    for(size_t TileRow = 0; TileRow < TileCol; TileRow += TileSize) TileRows.push_back(TileRow);
+    for(size_t t = 0; t < TileRows.size(); t++) {
+      size_t NumRows = std::min(TileSize, BlockSize - TileRows[t]);
+      for(size_t col = TileCol; col < TileCol + NumCols; col++) {
+        for(size_t row = TileRows[t]; row < TileRows[t] + NumRows; row++) *stored++ = T(block[row + BlockSize*col]);
+      }
+    }
+  }
+}
+
+template<typename T>
+static void UnpackStoredBlock(const T* stored, size_t BlockSize, size_t TileSize, double* block)
+{
+  // The reverse of PackStoredBlock.  Entries below the diagonal tiles are filled in from their transposes.
+  for(size_t TileCol = 0; TileCol < BlockSize; TileCol += TileSize) {
+    size_t NumCols = std::min(TileSize, BlockSize - TileCol);
+    std::vector<size_t> TileRows(1, TileCol);
+    for(size_t TileRow = 0; TileRow < TileCol; TileRow += TileSize) TileRows.push_back(TileRow);
+    for(size_t t = 0; t < TileRows.size(); t++) {
+      size_t NumRows = std::min(TileSize, BlockSize - TileRows[t]);
+      for(size_t col = TileCol; col < TileCol + NumCols; col++) {
+        for(size_t row = TileRows[t]; row < TileRows[t] + NumRows; row++) {
+          block[row + BlockSize*col] = *stored;
+          if(t != 0) block[col + BlockSize*row] = *stored;
+          stored++;
+        }
+      }
+    }
+  }
+}
+
+static void MultiplyLowRankBlock(const double* block, size_t BlockSize, size_t MaxRank, size_t Rank,
+                                 const double* in, double* out, size_t NumVectors, size_t ld)
+{
+  // out = (diag(d) + U diag(s) trans(U)) in, with block = [d][s][U] as described at the top of this file.
+  const double* d = block;
+  const double* sv = block + BlockSize;
+  const double* U = block + BlockSize + MaxRank;
+  for(size_t col = 0; col < NumVectors; col++) {
+    for(size_t row = 0; row < BlockSize; row++) out[row + ld*col] = d[row]*in[row + ld*col];
+  }
+  if(Rank == 0) return;
+
+  // Project onto the modes, weight each mode, and expand again -- O(BlockSize*Rank) per vector.
+  std::vector<double> Coeffs(Rank*NumVectors);
+  LinAlg::gemm('T', 'N', Rank, NumVectors, BlockSize,
+               1, U, BlockSize, in, ld, 0, &Coeffs[0], Rank);
+  for(size_t col = 0; col < NumVectors; col++) {
+    for(size_t mode = 0; mode < Rank; mode++) Coeffs[mode + Rank*col] *= sv[mode];
+  }
+  LinAlg::gemm('N', 'N', BlockSize, NumVectors, Rank,
+               1, U, BlockSize, &Coeffs[0], Rank, 1, out, ld);
+}
+
+static void PackHermitianBlock(const double* block, size_t BlockSize, size_t NumChannels, double* stored)
+{
+  // Keep the circularly-symmetric part of a real block [[A B] [B^T D]] as K = (A + D)/2 - i(B - B^T)/2.
+  // The block at MAX_F is real, and kept whole.
+  if(BlockSize == NumChannels) {
+    std::copy(block, block + BlockSize*BlockSize, stored);
+    return;
+  }
+  const size_t C = NumChannels;
+  for(size_t col = 0; col < C; col++) {
+    for(size_t row = 0; row < C; row++) {
+      stored[2*(row + C*col)] = (block[row + BlockSize*col] + block[C+row + BlockSize*(C+col)])/2;
+      stored[2*(row + C*col) + 1] = -(block[row + BlockSize*(C+col)] - block[col + BlockSize*(C+row)])/2;
+    }
+  }
+}
+
+static void UnpackHermitianBlock(const double* stored, size_t BlockSize, size_t NumChannels, double* block)
+{
+  // The real block [[Re K, -Im K] [Im K, Re K]] which K stands for; the reverse of PackHermitianBlock.
+  if(BlockSize == NumChannels) {
+    std::copy(stored, stored + BlockSize*BlockSize, block);
+    return;
+  }
+  const size_t C = NumChannels;
+  for(size_t col = 0; col < C; col++) {
+    for(size_t row = 0; row < C; row++) {
+      double Re = stored[2*(row + C*col)], Im = stored[2*(row + C*col) + 1];
+      block[row + BlockSize*col] = block[C+row + BlockSize*(C+col)] = Re;
+      block[row + BlockSize*(C+col)] = -Im;
+      block[C+row + BlockSize*col] = Im;
+    }
+  }
+}
+
+static void MultiplyHermitianBlock(const double* block, size_t BlockSize, size_t NumChannels,
+                                   const double* in, double* out, size_t NumVectors, size_t ld)
+{
+  // out = block * in, with block stored as K (see PackHermitianBlock).
+  if(BlockSize == NumChannels) {
+    LinAlg::gemm('N', 'N', BlockSize, NumVectors, BlockSize,
+                 1, block, BlockSize, in, ld, 0, out, ld);
+    return;
+  }
+
+  // Each column holds the real parts x of the channels, then the imaginary parts y; interleave them into
+  // z = x + iy, multiply, and split the result the same way.  That's O(C) per vector, against O(C^2) for the GEMM.
+  const size_t C = NumChannels;
+  std::vector<double> z(2*C*NumVectors), Kz(2*C*NumVectors);
+  for(size_t col = 0; col < NumVectors; col++) {
+    for(size_t row = 0; row < C; row++) {
+      z[2*(row + C*col)] = in[row + ld*col];
+      z[2*(row + C*col) + 1] = in[C+row + ld*col];
+    }
+  }
+  const double One[2] = {1, 0};
+  const double Zero[2] = {0, 0};
+  LinAlg::zgemm('N', 'N', C, NumVectors, C,
+                One, block, C, &z[0], C, Zero, &Kz[0], C);
+  for(size_t col = 0; col < NumVectors; col++) {
+    for(size_t row = 0; row < C; row++) {
+      out[row + ld*col] = Kz[2*(row + C*col)];
+      out[C+row + ld*col] = Kz[2*(row + C*col) + 1];
+    }
+  }
+}
+
+void NoiseStore::MultiplyBlock(size_t f, const double* in, double* out, size_t NumVectors, size_t ld) const
+{
+  assert(fPrecision == kDouble and OwnsFreq(f));
+  size_t BlockSize = GetBlockSize(f);
+  if(fLayout == kLowRank) {
+    MultiplyLowRankBlock((const double*)fBlocks[f], BlockSize, GetMaxRank(f), fRanks[f],
+                         in, out, NumVectors, ld);
+    return;
+  }
+  if(fLayout == kHermitian) {
+    MultiplyHermitianBlock((const double*)fBlocks[f], BlockSize, fChannels.size(), in, out, NumVectors, ld);
+    return;
+  }
+  MultiplyStoredBlock((const double*)fBlocks[f], BlockSize, fLayout == kTiledUpper, GetTileSize(BlockSize),
+                      in, out, NumVectors, ld);
+}
+
+void NoiseStore::MultiplyBlock(size_t f, const float* in, float* out, size_t NumVectors, size_t ld) const
+{
+  assert(fPrecision == kSingle and OwnsFreq(f));
+  size_t BlockSize = GetBlockSize(f);
+  MultiplyStoredBlock((const float*)fBlocks[f], BlockSize, fLayout == kTiledUpper, GetTileSize(BlockSize),
+                      in, out, NumVectors, ld);
+}
+
+double NoiseStore::GetFlopsPerVector() const
+{
+  // A dense (or tiled) block costs a multiply and an add per entry; a low-rank block costs that per entry of
+  // its modes, twice (project and expand), plus the diagonal.  A Hermitian block is three real CxC GEMMs
+  // with the 3M complex GEMM, or four with the ordinary one (see LinAlg::zgemm).
+  double Flops = 0;
+  for(size_t f = fFirstOwnedF; f < fEndOwnedF; f++) {
+    double BlockSize = GetBlockSize(f);
+    if(fLayout == kLowRank) Flops += 4*BlockSize*fRanks[f] + BlockSize;
+    else if(fLayout == kHermitian and BlockSize != fChannels.size()) {
+      Flops += LinAlg::zgemmRealProducts*2*(BlockSize/2)*(BlockSize/2);
+    }
+    else Flops += 2*BlockSize*BlockSize;
+  }
+  return Flops;
+}
+
+bool NoiseStore::CanDerive(const std::vector<unsigned char>& Channels) const
+{
+  // Any channel set can be derived from a full or tiled store: channels we have are copied, others are read.
+  // A low-rank block can't take on new channels without decomposing it all over again, and must have room
+  // for all of its modes in the smaller blocks.
+  if(fLayout != kLowRank) return true;
+  for(size_t i = 0; i < Channels.size(); i++) {
+    if(std::find(fChannels.begin(), fChannels.end(), Channels[i]) == fChannels.end()) return false;
+  }
+  for(size_t f = 0; f < GetNumFreqs(); f++) {
+    if(fRanks[f] > std::min<size_t>(fLowRankMaxRank, Channels.size()*(f + MIN_F < MAX_F ? 2 : 1))) return false;
+  }
+  return true;
+}
+
+void NoiseStore::UnpackBlock(size_t f, std::vector<double>& block) const
+{
+  // The whole (preconditioned) block at frequency index f, column-major.
+  assert(OwnsFreq(f));
+  size_t BlockSize = GetBlockSize(f);
+  block.resize(BlockSize*BlockSize);
+  if(fLayout == kLowRank) {
+    // diag(d) + U diag(s) trans(U), with the block stored as [d][s][U].
+    const double* d = (const double*)fBlocks[f];
+    const double* sv = d + BlockSize;
+    const double* U = sv + GetMaxRank(f);
+    size_t Rank = fRanks[f];
+    block.assign(BlockSize*BlockSize, 0);
+    for(size_t i = 0; i < BlockSize; i++) block[i + BlockSize*i] = d[i];
+    if(Rank == 0) return;
+    std::vector<double> US(U, U + BlockSize*Rank);
+    for(size_t mode = 0; mode < Rank; mode++) {
+      for(size_t row = 0; row < BlockSize; row++) US[row + BlockSize*mode] *= sv[mode];
+    }
+    LinAlg::gemm('N', 'T', BlockSize, BlockSize, Rank, 1, &US[0], BlockSize, U, BlockSize, 1, &block[0], BlockSize);
+  }
+  else if(fLayout == kHermitian) UnpackHermitianBlock((const double*)fBlocks[f], BlockSize, fChannels.size(), &block[0]);
+  else if(fPrecision == kSingle) UnpackStoredBlock((const float*)fBlocks[f], BlockSize, GetTileSize(BlockSize), &block[0]);
+  else UnpackStoredBlock((const double*)fBlocks[f], BlockSize, GetTileSize(BlockSize), &block[0]);
+}
+
+void NoiseStore::PackBlock(size_t f, const std::vector<double>& block, char* dest) const
+{
+  // Copy the whole (preconditioned) block at frequency index f into the store at dest; not for kLowRank.
+  assert(fLayout != kLowRank);
+  size_t BlockSize = GetBlockSize(f);
+  if(fLayout == kHermitian) PackHermitianBlock(&block[0], BlockSize, fChannels.size(), (double*)dest);
+  else if(fPrecision == kSingle) PackStoredBlock(&block[0], BlockSize, GetTileSize(BlockSize), (float*)dest);
+  else PackStoredBlock(&block[0], BlockSize, GetTileSize(BlockSize), (double*)dest);
+}
+
+void NoiseStore::ComputeLayout(const std::string& NoiseFilename, NoiseStoreHeader& header) const
+{
+  // Fill in the header for a store of fChannels (everything except the magic).
+  struct stat SourceStat = StatNoiseFile(NoiseFilename);
+  std::memset(&header, 0, sizeof(header));
+  header.fVersion = NoiseStoreVersion;
+  header.fNumChannels = fChannels.size();
+  header.fMinF = MIN_F;
+  header.fMaxF = fMaxF;
+  header.fUseWireAPDCorrelations = (fUseWireAPDCorrelations ? 1 : 0);
+  header.fLayout = fLayout;
+  header.fNumTiles = (fLayout == kTiledUpper ? NumTiles : 1);
+  header.fPrecision = fPrecision;
+  header.fLowRankMaxRank = fLowRankMaxRank;
+  header.fLowRankTolerance = fLowRankTolerance;
+  header.fShareIndex = fShareIndex;
+  header.fNumShares = fNumShares;
+  header.fSourceSize = SourceStat.st_size;
+  header.fSourceModTime = SourceStat.st_mtime;
+  header.fBlocksOffset = sizeof(NoiseStoreHeader) + fChannels.size();
+  if(fLayout == kLowRank) header.fBlocksOffset = GetRanksOffset() + GetNumFreqs()*sizeof(uint32_t);
+  header.fBlocksOffset = NoiseStorePageSize*((header.fBlocksOffset + NoiseStorePageSize - 1)/NoiseStorePageSize);
+  header.fDiagOffset = header.fBlocksOffset;
+  for(size_t f = 0; f < GetNumFreqs(); f++) header.fDiagOffset += GetStoredBlockLength(f)*GetElementSize();
+  header.fTotalLength = header.fDiagOffset + fChannels.size()*RowsPerChannel(fMaxF)*sizeof(double);
+}
+
+bool NoiseStore::AttachMapping(void* addr, size_t length, const NoiseStoreHeader& expected)
+{
+  // Check that a complete store is mapped at addr and matches what we want (expected, as from ComputeLayout);
+  // if so, adopt it.
+  const NoiseStoreHeader& header = *(const NoiseStoreHeader*)addr;
+  if(length < sizeof(NoiseStoreHeader) or
+     std::memcmp(header.fMagic, NoiseStoreMagic, sizeof(NoiseStoreMagic)) != 0) return false;
+  __sync_synchronize(); // Don't read the rest of the header until after the magic.
+  bool Matches = (header.fVersion == expected.fVersion and
+                  header.fNumChannels == expected.fNumChannels and
+                  header.fMinF == expected.fMinF and
+                  header.fMaxF == expected.fMaxF and
+                  header.fUseWireAPDCorrelations == expected.fUseWireAPDCorrelations and
+                  header.fLayout == expected.fLayout and
+                  header.fNumTiles == expected.fNumTiles and
+                  header.fPrecision == expected.fPrecision and
+                  header.fLowRankMaxRank == expected.fLowRankMaxRank and
+                  header.fLowRankTolerance == expected.fLowRankTolerance and
+                  header.fShareIndex == expected.fShareIndex and
+                  header.fNumShares == expected.fNumShares and
+                  header.fSourceSize == expected.fSourceSize and
+                  header.fSourceModTime == expected.fSourceModTime and
+                  header.fBlocksOffset == expected.fBlocksOffset and
+                  header.fDiagOffset == expected.fDiagOffset and
+                  header.fTotalLength == expected.fTotalLength and
+                  header.fTotalLength == length);
+  const unsigned char* StoredChannels = (const unsigned char*)addr + sizeof(NoiseStoreHeader);
+  if(Matches) Matches = std::equal(fChannels.begin(), fChannels.end(), StoredChannels);
+  if(not Matches) return false;
+
+  fMapping = addr;
+  fMappingLength = length;
+
+  // Locate the blocks.
+  fBlocks.resize(GetNumFreqs());
+  const char* BlockPos = (const char*)addr + header.fBlocksOffset;
+  for(size_t f = 0; f < GetNumFreqs(); f++) {
+    fBlocks[f] = BlockPos;
+    BlockPos += GetStoredBlockLength(f)*GetElementSize();
+  }
+  assert(BlockPos == (const char*)addr + header.fDiagOffset);
+  if(fLayout == kLowRank) {
+    const uint32_t* Ranks = (const uint32_t*)((const char*)addr + GetRanksOffset());
+    fRanks.assign(Ranks, Ranks + GetNumFreqs());
+  }
+
+  fApproximationError = header.fApproximationError;
+
+  // The diagonal is small, so keep a private copy in a convenient form.
+  const double* Diag = (const double*)((const char*)addr + header.fDiagOffset);
+  fNoiseDiag.assign(Diag, Diag + fChannels.size()*RowsPerChannel(fMaxF));
+  return true;
+}
+
+bool NoiseStore::MapStoreFile(const std::string& NoiseFilename)
+{
+  // Try to map an existing store file; return false if it is missing or doesn't match.
+  int fd = open(fStoreFilename.c_str(), O_RDONLY);
+  if(fd < 0) return false;
+  struct stat StoreStat;
+  if(fstat(fd, &StoreStat) != 0 or StoreStat.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void* addr = mmap(NULL, StoreStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // The mapping keeps the file alive.
+  if(addr == MAP_FAILED) return false;
+
+  NoiseStoreHeader expected;
+  ComputeLayout(NoiseFilename, expected);
+  if(not AttachMapping(addr, StoreStat.st_size, expected)) {
+    std::cout<<"Noise store "<<fStoreFilename<<" does not match; it will be rebuilt."<<std::endl;
+    munmap(addr, StoreStat.st_size);
+    return false;
+  }
+  return true;
+}
+
+void NoiseStore::BuildStoreFile(const std::string& NoiseFilename) const
+{
+  // The store is written to a temporary file and renamed into place, so that a concurrent
+  // process building the same store can never observe a half-written file.
+  NoiseStoreHeader header;
+  ComputeLayout(NoiseFilename, header);
+
+  std::ostringstream TempNameStream;
+  TempNameStream << fStoreFilename << ".tmp." << getpid();
+  std::string TempName = TempNameStream.str();
+  int fd = open(TempName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    std::cout<<"Unable to create noise store "<<TempName<<std::endl;
+    std::exit(1);
+  }
+  void* addr = MAP_FAILED;
+  if(ftruncate(fd, header.fTotalLength) == 0) {
+    addr = mmap(NULL, header.fTotalLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if(addr == MAP_FAILED) {
+    std::cout<<"Unable to size or map noise store "<<TempName<<std::endl;
+    std::remove(TempName.c_str());
+    std::exit(1);
+  }
+
+  FillStore(NoiseFilename, header, (char*)addr);
+  bool WriteOK = (msync(addr, header.fTotalLength, MS_SYNC) == 0);
+  munmap(addr, header.fTotalLength);
+  if(not WriteOK or std::rename(TempName.c_str(), fStoreFilename.c_str()) != 0) {
+    std::cout<<"Failed to write noise store "<<fStoreFilename<<std::endl;
+    std::remove(TempName.c_str());
+    std::exit(1);
+  }
+}
+
+void NoiseStore::OpenSharedMemory(const std::string& NoiseFilename)
+{
+  // Attach to a node-wide POSIX shared-memory store, creating it if we are the first process to ask.
+  // Exactly one process wins the O_EXCL race and fills the segment from the raw noise file;
+  // everyone else waits for it to be completed, then maps the very same pages.
+  // Who is using the segment is kept by flock, since the kernel drops a process's locks however it dies:
+  // the creator holds an exclusive lock until the store is complete, and then every user holds a shared lock
+  // for as long as it is attached.  So a waiter which can lock it exclusively while it's incomplete knows that
+  // the creator is gone, and a user which can do so while detaching knows that it was the last (ReleaseMapping).
+  std::ostringstream name;
+  name << "/RefitterNoise." << std::hex << std::setw(16) << std::setfill('0') << ComputeKey(NoiseFilename, true);
+  fSharedMemoryName = name.str();
+
+  NoiseStoreHeader header;
+  ComputeLayout(NoiseFilename, header);
+
+  unsigned int Waited_ms = 0;
+  while(not fMapping) {
+    int fd = shm_open(fSharedMemoryName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd >= 0) {
+      // We fill it.  Lock it before sizing it, since waiters don't look until it's sized.
+      std::cout<<"Filling shared-memory noise store "<<fSharedMemoryName<<" from "<<NoiseFilename<<std::endl;
+      void* addr = MAP_FAILED;
+      if(flock(fd, LOCK_EX) == 0 and ftruncate(fd, header.fTotalLength) == 0) {
+        addr = mmap(NULL, header.fTotalLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      }
+      if(addr == MAP_FAILED) {
+        std::cout<<"Unable to size or map shared-memory noise store "<<fSharedMemoryName<<std::endl;
+        shm_unlink(fSharedMemoryName.c_str());
+        std::exit(1);
+      }
+      FillStore(NoiseFilename, header, (char*)addr);
+      flock(fd, LOCK_SH); // Now we're just another user.
+      if(not AttachMapping(addr, header.fTotalLength, header)) {
+        std::cout<<"Shared-memory noise store "<<fSharedMemoryName<<" failed validation."<<std::endl;
+        shm_unlink(fSharedMemoryName.c_str());
+        std::exit(1);
+      }
+      fSharedMemoryFd = fd;
+      break;
+    }
+
+    // Someone else is creating it (or already has).  Wait until it is sized, then until it is filled.
+    // A segment of some other size isn't one we can use, nor one which is being created (that starts out empty).
+    fd = shm_open(fSharedMemoryName.c_str(), O_RDWR, 0600);
+    struct stat SegmentStat;
+    void* addr = MAP_FAILED;
+    bool Remove = false;
+    if(fd >= 0 and fstat(fd, &SegmentStat) == 0) {
+      if(uint64_t(SegmentStat.st_size) == header.fTotalLength) {
+        addr = mmap(NULL, header.fTotalLength, PROT_READ, MAP_SHARED, fd, 0);
+      }
+      else if(SegmentStat.st_size != 0) {
+        std::cout<<"Shared-memory noise store "<<fSharedMemoryName<<" does not match; replacing it."<<std::endl;
+        Remove = true;
+      }
+    }
+    const NoiseStoreHeader* Shared = (const NoiseStoreHeader*)addr;
+    bool Retry = (addr == MAP_FAILED);
+    bool TimedOut = false;
+    while(not Retry) {
+      __sync_synchronize();
+      if(std::memcmp(Shared->fMagic, NoiseStoreMagic, sizeof(NoiseStoreMagic)) == 0) {
+        // Complete.  Become a user; then make sure its last user didn't remove it while we weren't one yet.
+        flock(fd, LOCK_SH);
+        if(not IsNamedSharedMemory(fSharedMemoryName, fd)) Retry = true;
+        else if(AttachMapping(addr, header.fTotalLength, header)) fSharedMemoryFd = fd;
+        else {
+          // Some other store under our name (maybe left by an older version).  Its users keep their mappings.
+          std::cout<<"Shared-memory noise store "<<fSharedMemoryName<<" does not match; replacing it."<<std::endl;
+          Remove = Retry = true;
+        }
+        break;
+      }
+      if(flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        // Nobody holds the lock, so the creator is gone -- either it just finished, or it died part-way.
+        __sync_synchronize();
+        if(std::memcmp(Shared->fMagic, NoiseStoreMagic, sizeof(NoiseStoreMagic)) == 0) {
+          flock(fd, LOCK_UN);
+          continue;
+        }
+        std::cout<<"Shared-memory noise store "<<fSharedMemoryName<<" was abandoned; removing it."<<std::endl;
+        Remove = Retry = true;
+        break;
+      }
+      if(Waited_ms >= 1000*SharedStoreTimeout_sec) {
+        TimedOut = true;
+        break;
+      }
+      usleep(10000);
+      Waited_ms += 10;
+    }
+    if(fMapping) break;
+
+    if(Retry and Waited_ms >= 1000*SharedStoreTimeout_sec) TimedOut = true;
+    if(TimedOut) {
+      // Don't leave the segment for later runs to wait on as well.
+      std::cout<<"Shared-memory noise store "<<fSharedMemoryName<<" was not completed in time."<<std::endl;
+      if(fd >= 0) UnlinkSharedMemory(fSharedMemoryName, fd);
+      std::exit(1);
+    }
+    if(Remove) UnlinkSharedMemory(fSharedMemoryName, fd);
+    if(addr != MAP_FAILED) munmap(addr, header.fTotalLength);
+    if(fd >= 0) close(fd);
+    usleep(10000);
+    Waited_ms += 10;
+  }
+
+  // Protect the store from stray writes.
+  mprotect(fMapping, header.fTotalLength, PROT_READ);
+}
+
+uint32_t NoiseStore::CompressBlock(const std::vector<double>& block, size_t BlockSize,
+                                   size_t MaxRank, double* dest) const
+{
+  // Approximate a preconditioned block (which is the identity plus correlations) by
+  // diag(d) + U diag(s) trans(U), keeping the eigenmodes which stray furthest from 1.
+  // We keep the fewest modes such that the discarded ones hold no more than a fraction
+  // fLowRankTolerance of the Frobenius norm of (block - identity), up to MaxRank modes.
+  // d is then chosen to make the diagonal exact.  Write [d][s][U] to dest; return the rank.
+  std::vector<double> Eigenvectors = block;
+  std::vector<double> Eigenvalues(BlockSize);
+  lapack_int ret = LinAlg::syev('V', 'U', BlockSize, &Eigenvectors[0], BlockSize, &Eigenvalues[0]);
+  if(ret != 0) {
+    std::cout<<"Eigendecomposition of a noise block failed with ret = "<<ret<<std::endl;
+    std::exit(1);
+  }
+
+  // Order the modes by how much they contribute to (block - identity).
+  std::vector<std::pair<double, size_t> > Modes(BlockSize);
+  double TotalNorm2 = 0;
+  for(size_t i = 0; i < BlockSize; i++) {
+    double shift = Eigenvalues[i] - 1;
+    Modes[i] = std::make_pair(-std::fabs(shift), i);
+    TotalNorm2 += shift*shift;
+  }
+  std::sort(Modes.begin(), Modes.end());
+  size_t Rank = 0;
+  double DiscardedNorm2 = TotalNorm2;
+  while(Rank < MaxRank and DiscardedNorm2 > fLowRankTolerance*fLowRankTolerance*TotalNorm2) {
+    DiscardedNorm2 -= Modes[Rank].first*Modes[Rank].first;
+    Rank++;
+  }
+
+  double* d = dest;
+  double* sv = dest + BlockSize;
+  double* U = dest + BlockSize + MaxRank;
+  std::fill(dest, dest + BlockSize + MaxRank*(BlockSize + 1), 0);
+  for(size_t i = 0; i < BlockSize; i++) d[i] = block[i + BlockSize*i];
+  for(size_t mode = 0; mode < Rank; mode++) {
+    size_t index = Modes[mode].second;
+    sv[mode] = Eigenvalues[index] - 1;
+    for(size_t row = 0; row < BlockSize; row++) {
+      double u = Eigenvectors[row + BlockSize*index];
+      U[row + BlockSize*mode] = u;
+      d[row] -= sv[mode]*u*u;
+    }
+  }
+  return Rank;
+}
+
+double NoiseStore::MeasureBlockError(size_t f,
+                                     const std::vector<double>& block,
+                                     const char* Stored,
+                                     uint32_t Rank) const
+{
+  // The relative error of multiplying with the stored block at frequency index f (Rank modes, for kLowRank)
+  // instead of the double block it was made from, over a few pseudo-random vectors.  (Fixed seed, so rebuilding
+  // a store reproduces the same number.)  Exact layouts don't lose anything, so aren't checked.
+  if(fPrecision != kSingle and fLayout != kLowRank and fLayout != kHermitian) return 0;
+  const size_t BlockSize = GetBlockSize(f);
+  const size_t NumTestVectors = 4;
+  std::vector<double> x(BlockSize*NumTestVectors), Exact(BlockSize*NumTestVectors), Approx(x.size());
+  std::vector<float> xSingle(x.size()), ApproxSingle(x.size());
+  uint32_t seed = 12345 + MIN_F + f;
+  for(size_t i = 0; i < x.size(); i++) {
+    seed = 1664525*seed + 1013904223;
+    x[i] = double(seed)/4294967296.0 - 0.5;
+    xSingle[i] = float(x[i]);
+  }
+  LinAlg::gemm('N', 'N', BlockSize, NumTestVectors, BlockSize,
+               1, &block[0], BlockSize, &x[0], BlockSize, 0, &Exact[0], BlockSize);
+  if(fPrecision == kSingle) {
+    MultiplyStoredBlock((const float*)Stored, BlockSize, fLayout == kTiledUpper, GetTileSize(BlockSize),
+                        &xSingle[0], &ApproxSingle[0], NumTestVectors, BlockSize);
+    std::copy(ApproxSingle.begin(), ApproxSingle.end(), Approx.begin());
+  }
+  else if(fLayout == kLowRank) {
+    MultiplyLowRankBlock((const double*)Stored, BlockSize, GetMaxRank(f), Rank,
+                         &x[0], &Approx[0], NumTestVectors, BlockSize);
+  }
+  else {
+    MultiplyHermitianBlock((const double*)Stored, BlockSize, fChannels.size(),
+                           &x[0], &Approx[0], NumTestVectors, BlockSize);
+  }
+  double ErrNorm2 = 0, ExactNorm2 = 0;
+  for(size_t i = 0; i < x.size(); i++) {
+    ErrNorm2 += (Approx[i] - Exact[i])*(Approx[i] - Exact[i]);
+    ExactNorm2 += Exact[i]*Exact[i];
+  }
+  return std::sqrt(ErrNorm2/ExactNorm2);
+}
+
+void NoiseStore::FillStore(const std::string& NoiseFilename,
+                           const NoiseStoreHeader& header,
+                           char* dest) const
+{
+  // Read the raw noise file (written by MakeNoiseFile), reorder it for fChannels, and precondition it.
+  // dest must point to header.fTotalLength writable bytes.
+  NoiseFileReader NoiseFile(NoiseFilename);
+  if(NoiseFile.GetMinF() != MIN_F or NoiseFile.GetMaxF() < fMaxF) {
+    std::cout<<"Noise file "<<NoiseFilename<<" covers f = "<<NoiseFile.GetMinF()<<"..."<<NoiseFile.GetMaxF()
+             <<", but we need "<<MIN_F<<"..."<<fMaxF<<std::endl;
+    std::exit(1);
+  }
+  if(not NoiseFile.IsLegacy()) {
+    std::cout<<"Noise file "<<NoiseFilename<<" was made from "<<NoiseFile.GetNumEvents()<<" events."<<std::endl;
+  }
+
+  std::copy(fChannels.begin(), fChannels.end(), dest + sizeof(NoiseStoreHeader));
+  double* Diag = (double*)(dest + header.fDiagOffset);
+  char* StoredBlocks = dest + header.fBlocksOffset;
+  uint32_t* Ranks = (uint32_t*)(dest + GetRanksOffset()); // Only for kLowRank.
+  double ApproximationError = 0;
+  for(size_t f = MIN_F; f <= fMaxF; f++) {
+    size_t BlockSize = GetBlockSize(f-MIN_F);
+
+    // Fetch just the rows and columns for our channels.  Block index c refers to channel index
+    // (c % NumChannels), real part if c < NumChannels and imaginary part otherwise.
+    std::vector<double> block;
+    NoiseFile.ReadBlock(f, fChannels, block);
+    if(block.size() != BlockSize*BlockSize) {
+      std::cout<<"Noise file "<<NoiseFilename<<" has no imaginary part at f = "<<f<<", which we need."<<std::endl;
+      std::exit(1);
+    }
+#ifdef ENABLE_CHARGE
+    if(not fUseWireAPDCorrelations) {
+      const size_t NumChannels = fChannels.size();
+      for(size_t col = 0; col < BlockSize; col++) {
+        for(size_t row = 0; row < BlockSize; row++) {
+          if(EXOMiscUtil::TypeOfChannel(fChannels[col % NumChannels]) !=
+             EXOMiscUtil::TypeOfChannel(fChannels[row % NumChannels])) {
+            block[row + BlockSize*col] = 0;
+          }
+        }
+      }
+    }
+#endif
+
+    // Extract the diagonal entries, for the purpose of preconditioning.
+    // Then precondition the block.  This should improve the accuracy of multiplications.
+    // So, N -> D^(-1/2) N D^(-1/2).
+    std::vector<double> InvSqrtDiag(BlockSize);
+    for(size_t i = 0; i < BlockSize; i++) {
+      *Diag++ = block[i + BlockSize*i];
+      InvSqrtDiag[i] = double(1)/std::sqrt(block[i + BlockSize*i]);
+    }
+    if(not OwnsFreq(f-MIN_F)) continue; // We only needed it for the diagonal.
+    for(size_t col = 0; col < BlockSize; col++) {
+      for(size_t row = 0; row < BlockSize; row++) {
+        block[row + BlockSize*col] *= InvSqrtDiag[row]*InvSqrtDiag[col];
+      }
+    }
+
+    // Only one triangle is kept in the tiled layout, so make sure we aren't throwing anything away.
+    // MakeNoiseFile writes both triangles from the same accumulated value, so this should be exact.
+    // (The low-rank layout relies on it too, since it diagonalizes the block.)
+    if(fLayout != kFull) {
+      for(size_t col = 0; col < BlockSize; col++) {
+        for(size_t row = 0; row < col; row++) {
+          if(block[row + BlockSize*col] != block[col + BlockSize*row]) {
+            std::cout<<"Noise block for f = "<<f<<" is not symmetric; can't use a packed layout."<<std::endl;
+            std::exit(1);
+          }
+        }
+      }
+    }
+
+    // Copy into the store, in the order described at the top of this file.
+    char* BlockPos = StoredBlocks;
+    if(fLayout == kLowRank) Ranks[f-MIN_F] = CompressBlock(block, BlockSize, GetMaxRank(f-MIN_F), (double*)BlockPos);
+    else PackBlock(f-MIN_F, block, BlockPos);
+    StoredBlocks += GetStoredBlockLength(f-MIN_F)*GetElementSize();
+
+    // Check how much we lose by approximating the block.
+    uint32_t Rank = (fLayout == kLowRank ? Ranks[f-MIN_F] : 0);
+    ApproximationError = std::max(ApproximationError, MeasureBlockError(f-MIN_F, block, BlockPos, Rank));
+  }
+  assert(StoredBlocks == dest + header.fDiagOffset);
+  assert((char*)Diag == dest + header.fTotalLength);
+
+  // Publish the header, with the magic last.
+  std::memcpy(dest, &header, sizeof(header));
+  ((NoiseStoreHeader*)dest)->fApproximationError = ApproximationError;
+  __sync_synchronize();
+  std::memcpy(dest, NoiseStoreMagic, sizeof(NoiseStoreMagic));
+}
+
+void NoiseStore::DeriveStore(const NoiseStore& Source,
+                             const std::string& NoiseFilename,
+                             const NoiseStoreHeader& header,
+                             char* dest) const
+{
+  // Fill dest like FillStore would, but starting from Source, a store for a different channel set.
+  // Preconditioning is just a rescaling of each entry, so the rows and columns we share with Source
+  // can be copied across as they are (that is what makes dropping a channel cheap).  Only the rows and
+  // columns of channels which Source lacks are read from the raw noise file -- one column per channel
+  // (two below MAX_F), since the other half follows by symmetry.
+  const size_t NumChannels = fChannels.size();
+  const size_t SourceNumChannels = Source.fChannels.size();
+  std::vector<int> SourceIndex(NumChannels, -1);
+  bool HaveAllChannels = true;
+  for(size_t i = 0; i < NumChannels; i++) {
+    std::vector<unsigned char>::const_iterator it =
+      std::find(Source.fChannels.begin(), Source.fChannels.end(), fChannels[i]);
+    if(it != Source.fChannels.end()) SourceIndex[i] = it - Source.fChannels.begin();
+    else HaveAllChannels = false;
+  }
+  NoiseFileReader* NoiseFile = NULL;
+  if(not HaveAllChannels) {
+    NoiseFile = new NoiseFileReader(NoiseFilename);
+    if(NoiseFile->GetMinF() != MIN_F or NoiseFile->GetMaxF() < fMaxF) {
+      std::cout<<"Noise file "<<NoiseFilename<<" no longer covers f = "<<MIN_F<<"..."<<fMaxF<<std::endl;
+      std::exit(1);
+    }
+  }
+
+  std::copy(fChannels.begin(), fChannels.end(), dest + sizeof(NoiseStoreHeader));
+  double* Diag = (double*)(dest + header.fDiagOffset);
+  const double* SourceDiag = &Source.fNoiseDiag[0];
+  char* StoredBlocks = dest + header.fBlocksOffset;
+  uint32_t* Ranks = (uint32_t*)(dest + GetRanksOffset()); // Only for kLowRank.
+  std::vector<double> SourceBlock, block, NewColumns;
+  double ApproximationError = 0;
+  for(size_t f = 0; f < GetNumFreqs(); f++) {
+    size_t BlockSize = GetBlockSize(f);
+    size_t SourceBlockSize = Source.GetBlockSize(f);
+
+    // Where each block index is in the source block, or -1 if it isn't.
+    std::vector<long> SourceRow(BlockSize);
+    std::vector<size_t> NewIndices;
+    for(size_t i = 0; i < BlockSize; i++) {
+      int index = SourceIndex[i % NumChannels];
+      SourceRow[i] = (index < 0 ? -1 : index + (i < NumChannels ? 0 : SourceNumChannels));
+      if(index < 0) NewIndices.push_back(i);
+    }
+    for(size_t i = 0; i < BlockSize; i++) if(SourceRow[i] >= 0) Diag[i] = SourceDiag[SourceRow[i]];
+
+    // Read the new columns, and take their diagonal entries -- which we need even for blocks outside our share.
+    if(not NewIndices.empty()) {
+      NoiseFile->ReadColumns(f + MIN_F, fChannels, NewIndices, NewColumns);
+      if(NewColumns.size() != BlockSize*NewIndices.size()) {
+        std::cout<<"Noise file "<<NoiseFilename<<" has no imaginary part at f = "<<f + MIN_F<<", which we need."
+                 <<std::endl;
+        std::exit(1);
+      }
+      for(size_t k = 0; k < NewIndices.size(); k++) {
+        Diag[NewIndices[k]] = NewColumns[NewIndices[k] + BlockSize*k];
+      }
+    }
+
+    if(OwnsFreq(f)) {
+      // Our block as it would be in Source, apart from the columns Source lacks.
+      Source.UnpackBlock(f, SourceBlock);
+      block.assign(BlockSize*BlockSize, 0);
+      for(size_t col = 0; col < BlockSize; col++) {
+        if(SourceRow[col] < 0) continue;
+        for(size_t row = 0; row < BlockSize; row++) {
+          if(SourceRow[row] < 0) continue;
+          block[row + BlockSize*col] = SourceBlock[SourceRow[row] + SourceBlockSize*SourceRow[col]];
+        }
+      }
+    }
+
+    if(not OwnsFreq(f)) {
+      // Nothing is stored for this block.
+    }
+    else if(fLayout == kLowRank) {
+      // diag(d) + U diag(s) trans(U), restricted to our rows and columns, is just as accurate for them;
+      // the modes and their weights stay, and we keep the rows of d and U we need.
+      size_t MaxRank = GetMaxRank(f), SourceMaxRank = Source.GetMaxRank(f);
+      const double* SourceStored = (const double*)Source.fBlocks[f];
+      double* Stored = (double*)StoredBlocks;
+      std::fill(Stored, Stored + GetStoredBlockLength(f), 0);
+      Ranks[f] = Source.fRanks[f];
+      for(size_t i = 0; i < BlockSize; i++) Stored[i] = SourceStored[SourceRow[i]];
+      for(size_t mode = 0; mode < Ranks[f]; mode++) {
+        Stored[BlockSize + mode] = SourceStored[SourceBlockSize + mode];
+        for(size_t row = 0; row < BlockSize; row++) {
+          Stored[BlockSize + MaxRank + row + BlockSize*mode] =
+            SourceStored[SourceBlockSize + SourceMaxRank + SourceRow[row] + SourceBlockSize*mode];
+        }
+      }
+    }
+    else {
+      // Precondition the new columns like FillStore does.
+      for(size_t k = 0; k < NewIndices.size(); k++) {
+        size_t col = NewIndices[k];
+        for(size_t row = 0; row < BlockSize; row++) {
+          double value = NewColumns[row + BlockSize*k]/std::sqrt(Diag[row]*Diag[col]);
+#ifdef ENABLE_CHARGE
+          if(not fUseWireAPDCorrelations and
+             EXOMiscUtil::TypeOfChannel(fChannels[col % NumChannels]) !=
+             EXOMiscUtil::TypeOfChannel(fChannels[row % NumChannels])) {
+            value = 0;
+          }
+#endif
+          block[row + BlockSize*col] = value;
+          block[col + BlockSize*row] = value;
+        }
+      }
+
+      PackBlock(f, block, StoredBlocks);
+    }
+    if(OwnsFreq(f)) {
+      uint32_t Rank = (fLayout == kLowRank ? Ranks[f] : 0);
+      ApproximationError = std::max(ApproximationError, MeasureBlockError(f, block, StoredBlocks, Rank));
+    }
+    StoredBlocks += GetStoredBlockLength(f)*GetElementSize();
+    Diag += BlockSize;
+    SourceDiag += SourceBlockSize;
+  }
+  assert(StoredBlocks == dest + header.fDiagOffset);
+  assert((char*)Diag == dest + header.fTotalLength);
+  delete NoiseFile;
+
+  // Our blocks were measured against the blocks they were made from, but the entries shared with Source
+  // already carry Source's approximation (and we don't have the exact ones without reading them all again);
+  // so report the sum, which bounds the error versus the exact blocks.
+  std::memcpy(dest, &header, sizeof(header));
+  ((NoiseStoreHeader*)dest)->fApproximationError = ApproximationError + Source.fApproximationError;
+  __sync_synchronize();
+  std::memcpy(dest, NoiseStoreMagic, sizeof(NoiseStoreMagic));
+}
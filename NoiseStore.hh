@@ -0,0 +1,244 @@
+#ifndef NoiseStore_hh
+#define NoiseStore_hh
+/*
+A NoiseStore holds the noise correlation blocks for one particular set of channels.
+The blocks are already reordered to match that channel set, and already preconditioned
+(N -> D^(-1/2) N D^(-1/2)), so they can be handed directly to GEMM.
+
+Reordering the raw noise file is expensive, and the result is ~720 MB per channel set.
+So, the first time a channel set is encountered we write the reordered blocks to a
+"store file" next to the raw noise file (or in a directory of the caller's choosing),
+keyed by the channel set.  Every later use just mmaps that file read-only.  This makes
+startup nearly instant, and processes on the same node share the pages through the
+page cache instead of each holding a private copy on the heap.
+
+Store files carry enough of a header to detect a stale or mismatched file;
+if anything doesn't match, we rebuild it.
+
+Alternatively, the store can be backed by a node-wide POSIX shared-memory segment
+(kSharedMemory).  Then the first process on the node to ask for a channel set fills
+the segment from the raw noise file, and every other process maps the same pages.
+This needs no writable filesystem, and the segment goes away when its last user does.
+Users are tracked with flock, so one that is killed doesn't keep the segment alive; but if the last user
+dies (or leaves through std::exit without destroying its stores), nobody removes it.  A later run with the
+same store just uses it.  Otherwise, leftovers can be removed with "rm /dev/shm/RefitterNoise.*" once no
+refitter is running on the node.
+
+Each block is a symmetric matrix (it is the covariance of the real and imaginary parts of the
+noise at one frequency), so we needn't store all of it.  With the kTiledUpper layout, a block is
+cut into an NxN grid of tiles and only the tiles on or above the diagonal are kept, each one
+contiguous and column-major.  MultiplyBlock then applies each off-diagonal tile twice (once
+transposed) with GEMM, and the diagonal tiles with SYMM, while the tile is hot in cache.
+That is roughly half of the memory and memory bandwidth of the kFull layout.
+
+With kSingle precision the blocks are stored as floats, halving memory and bandwidth again;
+the caller then multiplies float vectors, and must refine its result in double precision.
+When such a store is built we compare a few float multiplications against double ones and
+record the worst relative error, so the caller can tell whether the approximation is sane.
+
+The kLowRank layout goes further: after preconditioning, each block is the identity plus correlations
+which mostly come from a few coherent noise modes.  So we eigendecompose each block when the store is
+built, and keep only the modes that matter (up to a tolerance and a maximum rank), plus a diagonal.
+A multiplication then costs O(C k) per vector instead of O(C^2).  The same error check is recorded.
+
+With kHermitian, we use the fact that each block is really complex:  the real and imaginary parts of the
+noise at one frequency.  If the noise is circularly symmetric (its pseudo-covariance E[z z^T] vanishes, as it
+should for stationary noise), the real 2Cx2C block is [[A B] [-B A]], which is just the CxC Hermitian matrix
+K = A - iB acting on x + iy.  So we keep K alone -- half the memory of kFull -- and multiply by it with a complex
+GEMM (the 3M variant where the BLAS has it, which does three real multiplications instead of four, saving a
+quarter of the FLOPs).
+The pseudo-covariance is dropped, so this is an approximation, checked like the others; if it's worse than
+fHermitianTolerance, the noise isn't circular enough, and we refuse.  Double precision only.
+
+The refit may be band-limited to MIN_F...fMaxF (fMaxF <= MAX_F), in which case the store only holds the
+blocks for those frequencies.  The top one keeps its imaginary part (only the block at MAX_F, whose imaginary part
+vanishes, has one row and column per channel), so band-limiting drops whole frequencies and nothing else.
+
+Several processes may also split the multiplication between them by frequency (a "noise group"; see
+EXORefitSignals::SetNoiseGroup).  Then each one's store is limited to its own share of the frequencies
+(Options::fNumShares), and only holds the blocks for that share -- though it still keeps the whole diagonal,
+which is small and needed for every row.
+
+When the channel set changes by a channel or two, a store for the new set can also be derived in memory
+from the store for the old one (see the second constructor), instead of going back to the noise file.
+*/
+
+#include <cstddef>
+#include "Constants.hh"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct NoiseStoreHeader;
+class WorkerPool;
+
+class NoiseStore
+{
+ public:
+  enum Backing {
+    kStoreFile,   // A file on disk, built once and mapped thereafter.
+    kSharedMemory // A POSIX shared-memory segment, filled by the first process on the node.
+  };
+  enum Layout {
+    kFull,       // Every block stored whole, column-major.
+    kTiledUpper, // Only the upper-triangular tiles of each block are stored.
+    kLowRank,    // Each block is approximated by a diagonal plus a few eigenmodes.  Double precision only.
+    kHermitian   // Each block is kept as a complex Hermitian matrix, dropping the pseudo-covariance.  Double only.
+  };
+  enum Precision {
+    kDouble,
+    kSingle
+  };
+
+  struct Options {
+    Options()
+    : fBacking(kStoreFile), fLayout(kFull), fPrecision(kDouble), fLowRankTolerance(1e-3), fLowRankMaxRank(64),
+      fHermitianTolerance(1e-2), fMaxF(MAX_F), fShareIndex(0), fNumShares(1) {}
+    std::string fStoreDirectory; // If empty, store files go alongside the raw noise file.
+    Backing fBacking;
+    Layout fLayout;
+    Precision fPrecision;
+    // For kLowRank: discarded modes may hold at most this fraction of the Frobenius norm of (block - identity),
+    // but no more than fLowRankMaxRank modes are kept per block regardless.
+    double fLowRankTolerance;
+    size_t fLowRankMaxRank;
+    // For kHermitian: the largest relative multiplication error we accept from dropping the pseudo-covariance.
+    double fHermitianTolerance;
+    // The highest frequency kept, between MIN_F and MAX_F.
+    size_t fMaxF;
+    // Keep only the blocks for share fShareIndex of fNumShares of the frequencies (see GetFreqShare).
+    size_t fShareIndex;
+    size_t fNumShares;
+  };
+
+  // Open the store for this channel set, creating it from the raw noise file if needed.
+  NoiseStore(const std::string& NoiseFilename,
+             const std::vector<unsigned char>& Channels,
+             bool UseWireAPDCorrelations,
+             const Options& options);
+  // Derive a store for Channels from Source, a store for a different channel set, in (anonymous) memory.
+  // Rows and columns for channels in both sets are copied from Source; only those for channels Source
+  // lacks are read from the raw noise file.  So when a channel drops out (or comes back), this takes
+  // a fraction of a second rather than a full read of the noise file.  Check CanDerive first.
+  NoiseStore(const NoiseStore& Source,
+             const std::string& NoiseFilename,
+             const std::vector<unsigned char>& Channels);
+  ~NoiseStore();
+
+  // Whether a store for Channels can be derived from this one.  (Low-rank stores can only lose channels.)
+  bool CanDerive(const std::vector<unsigned char>& Channels) const;
+
+  // Block for frequency index f (f = freq - MIN_F), in column-major order.
+  // Within a block, entries are ordered like:
+  // <N^R_0 N^R_0> <N^I_0 N^R_0> <N^R_1 N^R_0> ... <N^R_0 N^I_0> ...
+  // The number corresponds to the *index* of the various channels, of course.
+  // Only meaningful for the kFull layout in kDouble precision; otherwise, use MultiplyBlock.
+  const double* GetBlock(size_t f) const { return (const double*)fBlocks[f]; }
+
+  // Number of rows (equal to the number of columns) of the block at frequency index f.
+  size_t GetBlockSize(size_t f) const { return fChannels.size() * (f + MIN_F < MAX_F ? 2 : 1); }
+
+  // Frequencies MIN_F...GetMaxF() are kept, with indices 0...GetNumFreqs()-1.
+  size_t GetMaxF() const { return fMaxF; }
+  size_t GetNumFreqs() const { return fMaxF - MIN_F + 1; }
+
+  // Share ShareIndex [Begin, End) of NumFreqs frequency indices, split into NumShares contiguous, nearly equal ranges.
+  static void GetFreqShare(size_t NumFreqs, size_t ShareIndex, size_t NumShares, size_t& Begin, size_t& End) {
+    Begin = (NumFreqs*ShareIndex)/NumShares;
+    End = (NumFreqs*(ShareIndex+1))/NumShares;
+  }
+  // The frequency indices [GetFirstOwnedFreq(), GetEndOwnedFreq()) whose blocks we keep; all of them, unless
+  // the store was limited to a share.  Only these can be multiplied (or fetched with GetBlock).
+  size_t GetFirstOwnedFreq() const { return fFirstOwnedF; }
+  size_t GetEndOwnedFreq() const { return fEndOwnedF; }
+  bool OwnsFreq(size_t f) const { return f >= fFirstOwnedF and f < fEndOwnedF; }
+
+  // out = Block(f) * in, for NumVectors columns.  in and out point to the first row of this
+  // block's portion of the columns, and consecutive columns are separated by ld.
+  // The double version is for kDouble stores, the float version for kSingle stores.
+  void MultiplyBlock(size_t f, const double* in, double* out, size_t NumVectors, size_t ld) const;
+  void MultiplyBlock(size_t f, const float* in, float* out, size_t NumVectors, size_t ld) const;
+  // Floating-point operations MultiplyBlock does per vector, summed over the frequencies we own (for reporting throughput).
+  double GetFlopsPerVector() const;
+  // The whole block at frequency index f, column-major, in double precision -- as the store represents it,
+  // so including any approximation.  Only for frequencies we own.
+  void UnpackBlock(size_t f, std::vector<double>& block) const;
+
+  Precision GetPrecision() const { return fPrecision; }
+  Layout GetLayout() const { return fLayout; }
+
+  // For kLowRank stores, the number of modes kept for the block at frequency index f.
+  size_t GetRank(size_t f) const { return fRanks[f]; }
+
+  // For kSingle or kLowRank stores, the worst relative error (Frobenius norm) we measured for a block
+  // multiplication, compared to multiplying by the exact block in double precision.  Zero otherwise.
+  double GetApproximationError() const { return fApproximationError; }
+
+  // The diagonal of the un-preconditioned noise matrix, with the same indexing as noise columns.
+  const std::vector<double>& GetNoiseDiag() const { return fNoiseDiag; }
+
+  const std::vector<unsigned char>& GetChannels() const { return fChannels; }
+  const std::string& GetStoreFilename() const { return fStoreFilename; }
+  const std::string& GetSharedMemoryName() const { return fSharedMemoryName; }
+  size_t GetMappingLength() const { return fMappingLength; }
+
+  // Move the blocks into private memory, with each thread of Pool copying (and so first-touching) the blocks
+  // it gets from Pool.GetShare of the frequencies we own, so that they sit on its own NUMA node.
+  // This gives up any sharing with other processes; the store file, if any, is left as it is.
+  void Localize(WorkerPool& Pool);
+
+ private:
+  std::vector<unsigned char> fChannels;
+  bool fUseWireAPDCorrelations;
+  Layout fLayout;
+  Precision fPrecision;
+  double fLowRankTolerance;
+  size_t fLowRankMaxRank;
+  double fHermitianTolerance;
+  size_t fMaxF;
+  size_t fShareIndex;
+  size_t fNumShares;
+  size_t fFirstOwnedF;
+  size_t fEndOwnedF;
+  double fApproximationError;
+  std::string fStoreFilename;
+  std::string fSharedMemoryName;
+
+  std::vector<double> fNoiseDiag;
+  std::vector<const char*> fBlocks; // Each points to doubles or floats, according to fPrecision.
+  std::vector<size_t> fRanks; // For kLowRank only.
+
+  // The mapped store file or shared-memory segment.
+  void* fMapping;
+  size_t fMappingLength;
+  int fSharedMemoryFd; // Shared-memory stores only; holds our (shared) lock on the segment while we use it.
+
+  uint64_t ComputeKey(const std::string& NoiseFilename, bool IncludeSource) const;
+  std::string ChooseStoreFilename(const std::string& NoiseFilename,
+                                  const std::string& StoreDirectory) const;
+  size_t GetTileSize(size_t BlockSize) const;
+  size_t GetMaxRank(size_t f) const;
+  size_t GetRanksOffset() const;
+  size_t GetStoredBlockLength(size_t f) const;
+  size_t GetElementSize() const { return fPrecision == kSingle ? sizeof(float) : sizeof(double); }
+  void ComputeLayout(const std::string& NoiseFilename, NoiseStoreHeader& header) const;
+  bool AttachMapping(void* addr, size_t length, const NoiseStoreHeader& expected);
+  void ReleaseMapping();
+  void CopyOwnBlocks(const WorkerPool& Pool, char* Local) const;
+  bool MapStoreFile(const std::string& NoiseFilename);
+  void BuildStoreFile(const std::string& NoiseFilename) const;
+  void OpenSharedMemory(const std::string& NoiseFilename);
+  uint32_t CompressBlock(const std::vector<double>& block, size_t BlockSize, size_t MaxRank, double* dest) const;
+  void PackBlock(size_t f, const std::vector<double>& block, char* dest) const;
+  double MeasureBlockError(size_t f, const std::vector<double>& block, const char* Stored, uint32_t Rank) const;
+  void FillStore(const std::string& NoiseFilename, const NoiseStoreHeader& header, char* dest) const;
+  void DeriveStore(const NoiseStore& Source,
+                   const std::string& NoiseFilename,
+                   const NoiseStoreHeader& header,
+                   char* dest) const;
+
+  // No copying -- we own a mapping.
+  NoiseStore(const NoiseStore&);
+  NoiseStore& operator=(const NoiseStore&);
+};
+#endif
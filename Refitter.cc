@@ -31,6 +31,7 @@ Should be called like:
 #endif
 
 #include <sstream>
+#include <cstdlib>
 
 #include <fstream>
 #include <iomanip>
@@ -94,6 +95,97 @@ int main(int argc, char** argv)
              >> NumEntries
              >> Threshold
              >> GainCorrectionFactor;
+
+  // Optional settings may follow the fixed fields, one "Name Value" pair per line.
+  NoiseStore::Options NoiseStoreOptions;
+  size_t NoiseCacheBudget_MB = 0;
+  bool IncrementalNoiseUpdate = true;
+  std::string NextNoiseFileName;
+  bool PinThreads = true;
+  bool NUMALocalNoise = false;
+  bool PipelinePasses = false;
+  bool AutotuneBatchSize = false;
+  bool BlockPrecon = false;
+  bool PreconPoissonDiagonal = false;
+  size_t RecycleSize = 0;
+  size_t RecycleHarvests = 4;
+  bool FreezeConvergedColumns = false;
+  EXORefitSignals::Solver Solver = EXORefitSignals::kBlBiCGSTAB;
+  size_t MaxBatchMemory_MB = 1024;
+  size_t NoiseMulTileColumns = 32;
+  size_t MaxFrequency = MAX_F;
+  double AutoBandLimit = 0;
+  size_t NoiseGroupSize = 1;
+  std::string OptionName;
+  while(OptionFile >> OptionName) {
+    if(OptionName == "SharedNoiseStore") {
+      bool UseSharedNoiseStore;
+      OptionFile >> UseSharedNoiseStore;
+      if(UseSharedNoiseStore) NoiseStoreOptions.fBacking = NoiseStore::kSharedMemory;
+    }
+    else if(OptionName == "NoiseStoreDirectory") OptionFile >> NoiseStoreOptions.fStoreDirectory;
+    else if(OptionName == "PackedNoise") {
+      bool UsePackedNoise;
+      OptionFile >> UsePackedNoise;
+      if(UsePackedNoise) NoiseStoreOptions.fLayout = NoiseStore::kTiledUpper;
+    }
+    else if(OptionName == "LowRankNoise") {
+      // Value is the truncation tolerance; zero leaves the blocks dense.
+      double Tolerance;
+      OptionFile >> Tolerance;
+      if(Tolerance > 0) {
+        NoiseStoreOptions.fLayout = NoiseStore::kLowRank;
+        NoiseStoreOptions.fLowRankTolerance = Tolerance;
+      }
+    }
+    else if(OptionName == "HermitianNoise") {
+      // Value is the largest relative error we'll accept from dropping the pseudo-covariance; zero leaves the blocks real.
+      double Tolerance;
+      OptionFile >> Tolerance;
+      if(Tolerance > 0) {
+        NoiseStoreOptions.fLayout = NoiseStore::kHermitian;
+        NoiseStoreOptions.fHermitianTolerance = Tolerance;
+      }
+    }
+    else if(OptionName == "NoiseCacheBudgetMB") OptionFile >> NoiseCacheBudget_MB;
+    else if(OptionName == "IncrementalNoiseUpdate") OptionFile >> IncrementalNoiseUpdate;
+    else if(OptionName == "NextNoiseFile") OptionFile >> NextNoiseFileName;
+    else if(OptionName == "PinThreads") OptionFile >> PinThreads;
+    else if(OptionName == "NUMALocalNoise") OptionFile >> NUMALocalNoise;
+    else if(OptionName == "PipelinePasses") OptionFile >> PipelinePasses;
+    else if(OptionName == "AutotuneBatchSize") OptionFile >> AutotuneBatchSize;
+    else if(OptionName == "BlockPrecon") OptionFile >> BlockPrecon;
+    else if(OptionName == "PreconPoissonDiagonal") OptionFile >> PreconPoissonDiagonal;
+    else if(OptionName == "RecycleSize") OptionFile >> RecycleSize;
+    else if(OptionName == "RecycleHarvests") OptionFile >> RecycleHarvests;
+    else if(OptionName == "FreezeConvergedColumns") OptionFile >> FreezeConvergedColumns;
+    else if(OptionName == "Solver") {
+      std::string SolverName;
+      OptionFile >> SolverName;
+      if(SolverName == "BiCGSTAB") Solver = EXORefitSignals::kBlBiCGSTAB;
+      else if(SolverName == "MINRES") Solver = EXORefitSignals::kBlMINRES;
+      else if(SolverName == "Direct") Solver = EXORefitSignals::kDirect;
+      else {
+        std::cout<<"Unrecognized solver "<<SolverName<<" (expected BiCGSTAB, MINRES or Direct)."<<std::endl;
+        std::exit(1);
+      }
+    }
+    else if(OptionName == "MaxBatchMemoryMB") OptionFile >> MaxBatchMemory_MB;
+    else if(OptionName == "NoiseMulTileColumns") OptionFile >> NoiseMulTileColumns;
+    else if(OptionName == "MaxFrequency") OptionFile >> MaxFrequency;
+    else if(OptionName == "AutoBandLimit") OptionFile >> AutoBandLimit; // Fraction of the light model's energy we may lose.
+    else if(OptionName == "NoiseGroupSize") OptionFile >> NoiseGroupSize; // Must be the same in every infile.
+    else if(OptionName == "LowRankMaxRank") OptionFile >> NoiseStoreOptions.fLowRankMaxRank;
+    else if(OptionName == "SinglePrecisionNoise") {
+      bool UseSinglePrecisionNoise;
+      OptionFile >> UseSinglePrecisionNoise;
+      if(UseSinglePrecisionNoise) NoiseStoreOptions.fPrecision = NoiseStore::kSingle;
+    }
+    else {
+      std::cout<<"Unrecognized option "<<OptionName<<" in the input file."<<std::endl;
+      std::exit(1);
+    }
+  }
   // On NERSC, we always use xrootd.  Need the IP address of the MOM node.
   assert(argc == 3);
   std::string mom_ip = argv[2]; // Should also include port number used.
@@ -104,9 +196,35 @@ int main(int argc, char** argv)
   std::cout<<"Input raw file: "<<RawFileName<<std::endl;
   std::cout<<"Output file: "<<OutFileName<<std::endl;
   std::cout<<"Noise file: "<<NoiseFileName<<std::endl;
+  if(not NextNoiseFileName.empty()) std::cout<<"Next noise file (prefetched): "<<NextNoiseFileName<<std::endl;
   std::cout<<"Starting at entry "<<StartEntry<<std::endl;
   std::cout<<"Handle "<<NumEntries<<" entries."<<std::endl;
   std::cout<<"Gain correction factor: "<<GainCorrectionFactor<<std::endl;
+  if(NoiseStoreOptions.fBacking == NoiseStore::kSharedMemory) {
+    std::cout<<"Noise will be held in node-wide shared memory."<<std::endl;
+  }
+  if(NoiseStoreOptions.fLayout == NoiseStore::kTiledUpper) {
+    std::cout<<"Noise blocks will be stored as upper-triangular tiles."<<std::endl;
+  }
+  if(NoiseStoreOptions.fLayout == NoiseStore::kLowRank) {
+    std::cout<<"Noise blocks will be compressed to low rank plus diagonal, with tolerance "
+             <<NoiseStoreOptions.fLowRankTolerance<<" and at most "
+             <<NoiseStoreOptions.fLowRankMaxRank<<" modes."<<std::endl;
+  }
+  if(NoiseStoreOptions.fPrecision == NoiseStore::kSingle) {
+    std::cout<<"Noise blocks will be stored in single precision."<<std::endl;
+  }
+
+  // Compute processes may split the noise blocks by frequency in groups of NoiseGroupSize consecutive ones.
+  // Making the group communicators takes every process, io ones too (which each get a group of their own).
+  boost::mpi::communicator NoiseGroup;
+  if(NoiseGroupSize > 1) {
+    int Color = (mpi.rank % 2 == 1 ? mpi.comm.size() + mpi.rank : mpi.numa_rank/NoiseGroupSize);
+    NoiseGroup = mpi.comm.split(Color);
+    if(mpi.rank % 2 == 0) {
+      std::cout<<"Noise blocks will be split by frequency among "<<NoiseGroup.size()<<" compute processes."<<std::endl;
+    }
+  }
 
   EXOTreeInputModule InputModule;
   std::cout<<"About to set filename."<<std::endl;
@@ -126,10 +244,29 @@ int main(int argc, char** argv)
     EXORefitSignals RefitSig;
     EXOCalibManager::GetCalibManager().SetMetadataAccessType("text");
     RefitSig.SetNoiseFilename(NoiseFileName);
+    RefitSig.fNoiseStoreOptions = NoiseStoreOptions;
+    RefitSig.fNoiseCacheBudget_MB = NoiseCacheBudget_MB;
+    RefitSig.fIncrementalNoiseUpdate = IncrementalNoiseUpdate;
+    RefitSig.fPinThreads = PinThreads;
+    RefitSig.fNUMALocalNoise = NUMALocalNoise;
+    RefitSig.fPipelinePasses = PipelinePasses;
+    RefitSig.fAutotuneBatchSize = AutotuneBatchSize;
+    RefitSig.fSolver = Solver;
+    RefitSig.fBlockPrecon = BlockPrecon;
+    RefitSig.fPreconPoissonDiagonal = PreconPoissonDiagonal;
+    RefitSig.fRecycleSize = RecycleSize;
+    RefitSig.fRecycleHarvests = RecycleHarvests;
+    RefitSig.fFreezeConvergedColumns = FreezeConvergedColumns;
+    RefitSig.fMaxBatchMemory_MB = MaxBatchMemory_MB;
+    RefitSig.fNoiseMulTileColumns = std::max<size_t>(1, NoiseMulTileColumns);
+    RefitSig.fMaxF = MaxFrequency;
+    RefitSig.fBandLimitEnergyFraction = AutoBandLimit;
+    if(NoiseGroupSize > 1) RefitSig.SetNoiseGroup(NoiseGroup);
     RefitSig.SetRThreshold(Threshold);
     RefitSig.fVerbose = true;
     RefitSig.fGainCorrectionFactor = GainCorrectionFactor;
     RefitSig.Initialize();
+    if(not NextNoiseFileName.empty()) RefitSig.PrefetchNoiseFile(NextNoiseFileName);
 
 #ifdef USE_THREADS
     std::cout<<"Using "<<NUM_THREADS<<" threads."<<std::endl;
@@ -0,0 +1,174 @@
+#include "WorkerPool.hh"
+#include <boost/bind.hpp>
+#include <boost/thread/tss.hpp>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <iostream>
+#include <cassert>
+
+// Set in each worker, so that tasks can tell which share of the work is theirs.
+static boost::thread_specific_ptr<size_t> gThreadIndex;
+
+WorkerPool::WorkerPool(size_t NumWorkers, bool PinThreads)
+: fNumWorkers(NumWorkers),
+  fGeneration(0),
+  fNumBusy(0),
+  fShutdown(false)
+{
+  if(PinThreads) {
+    // Pin within whatever CPUs we were given (eg. by aprun or mpirun), rather than assuming the whole node.
+    cpu_set_t Allowed;
+    CPU_ZERO(&Allowed);
+    if(sched_getaffinity(0, sizeof(Allowed), &Allowed) == 0) {
+      for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) if(CPU_ISSET(cpu, &Allowed)) fCPUs.push_back(cpu);
+    }
+    if(fCPUs.size() < GetNumThreads()) {
+      std::cout<<"Only "<<fCPUs.size()<<" CPUs available for "<<GetNumThreads()<<" threads; "
+               <<"some will share."<<std::endl;
+    }
+    PinToCPU(0);
+  }
+
+  for(size_t i = 0; i < fNumWorkers; i++) {
+    fThreads.create_thread(boost::bind(&WorkerPool::WorkerLoop, this, i+1));
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    boost::mutex::scoped_lock sL(fMutex);
+    fShutdown = true;
+  }
+  fWorkReady.notify_all();
+  fThreads.join_all();
+}
+
+void WorkerPool::RunOnAll(const boost::function<void()>& task)
+{
+  {
+    boost::mutex::scoped_lock sL(fMutex);
+    fTask = task;
+    fNumBusy = fNumWorkers;
+    fGeneration++;
+  }
+  fWorkReady.notify_all();
+
+  // This thread should do work too.
+  task();
+
+  // We reached this point because there was no more work for this thread to grab.
+  // Other threads should be done shortly.
+  boost::mutex::scoped_lock sL(fMutex);
+  while(fNumBusy > 0) fWorkDone.wait(sL);
+  fTask.clear();
+}
+
+size_t WorkerPool::GetThreadIndex()
+{
+  size_t* index = gThreadIndex.get();
+  return index ? *index : 0;
+}
+
+void WorkerPool::GetShare(size_t NumItems, size_t& Begin, size_t& End) const
+{
+  size_t index = GetThreadIndex();
+  assert(index < GetNumThreads());
+  Begin = (NumItems*index)/GetNumThreads();
+  End = (NumItems*(index+1))/GetNumThreads();
+}
+
+void WorkerPool::TouchLocally(void* ptr, size_t length)
+{
+  static const size_t PageSize = sysconf(_SC_PAGESIZE);
+  uintptr_t Begin = ((uintptr_t)ptr + PageSize - 1)/PageSize*PageSize;
+  uintptr_t End = ((uintptr_t)ptr + length)/PageSize*PageSize;
+  if(End <= Begin) return;
+  madvise((void*)Begin, End - Begin, MADV_DONTNEED);
+  for(uintptr_t page = Begin; page < End; page += PageSize) *(volatile char*)page = 0;
+}
+
+void WorkerPool::WorkerLoop(size_t index)
+{
+  gThreadIndex.reset(new size_t(index));
+  PinToCPU(index);
+  size_t LastGeneration = 0;
+  while(true) {
+    boost::function<void()> task;
+    {
+      boost::mutex::scoped_lock sL(fMutex);
+      while(not fShutdown and fGeneration == LastGeneration) fWorkReady.wait(sL);
+      if(fShutdown) return;
+      LastGeneration = fGeneration;
+      task = fTask;
+    }
+    task();
+    boost::mutex::scoped_lock sL(fMutex);
+    if(--fNumBusy == 0) fWorkDone.notify_one();
+  }
+}
+
+void WorkerPool::PinToCPU(size_t index) const
+{
+  // Pin the calling thread to the index-th of our CPUs (wrapping around if there aren't enough).
+  if(fCPUs.empty()) return;
+  cpu_set_t CPU;
+  CPU_ZERO(&CPU);
+  CPU_SET(fCPUs[index % fCPUs.size()], &CPU);
+  if(pthread_setaffinity_np(pthread_self(), sizeof(CPU), &CPU) != 0) {
+    std::cout<<"Failed to pin thread "<<index<<" to CPU "<<fCPUs[index % fCPUs.size()]<<std::endl;
+  }
+}
+
+WorkStealingRanges::WorkStealingRanges(size_t NumThreads)
+: fNumThreads(NumThreads),
+  fRanges(new Range[NumThreads])
+{
+  assert(fRanges[0].fPacked.is_lock_free());
+  Reset(0);
+}
+
+WorkStealingRanges::~WorkStealingRanges()
+{
+  delete [] fRanges;
+}
+
+void WorkStealingRanges::Reset(size_t NumItems)
+{
+  assert(NumItems <= 0xffffffff);
+  for(size_t i = 0; i < fNumThreads; i++) {
+    fRanges[i].fPacked.store(Pack((NumItems*i)/fNumThreads, (NumItems*(i+1))/fNumThreads), boost::memory_order_relaxed);
+  }
+}
+
+bool WorkStealingRanges::Pop(size_t ThreadIndex, size_t& item)
+{
+  assert(ThreadIndex < fNumThreads);
+  boost::atomic<uint64_t>& Own = fRanges[ThreadIndex].fPacked;
+  uint64_t Packed = Own.load(boost::memory_order_relaxed);
+  while(GetBegin(Packed) < GetEnd(Packed)) {
+    if(Own.compare_exchange_weak(Packed, Pack(GetBegin(Packed) + 1, GetEnd(Packed)), boost::memory_order_relaxed)) {
+      item = GetBegin(Packed);
+      return true;
+    }
+  }
+
+  // Our own range is empty, so nobody else will touch it; look for a victim, starting with our neighbour.
+  for(size_t i = 1; i < fNumThreads; i++) {
+    boost::atomic<uint64_t>& Victim = fRanges[(ThreadIndex + i) % fNumThreads].fPacked;
+    Packed = Victim.load(boost::memory_order_relaxed);
+    while(GetBegin(Packed) < GetEnd(Packed)) {
+      // Leave the victim [Begin, Middle), and take [Middle, End) -- at least one item.
+      size_t Middle = GetBegin(Packed) + (GetEnd(Packed) - GetBegin(Packed))/2;
+      if(Victim.compare_exchange_weak(Packed, Pack(GetBegin(Packed), Middle), boost::memory_order_relaxed)) {
+        item = Middle;
+        Own.store(Pack(Middle + 1, GetEnd(Packed)), boost::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+  return false;
+}
@@ -0,0 +1,113 @@
+#ifndef WorkerPool_hh
+#define WorkerPool_hh
+/*
+A fixed set of worker threads, created once and kept for the life of the process.
+
+Both phases of a pass (noise multiplication, then BiCGSTAB on each event) are written as
+"keep grabbing work off a lock-free queue until it is empty", to be run by every thread at once.
+So the only operation we need is RunOnAll(task):  every worker, and the calling thread too,
+runs task; RunOnAll returns when they all have.  Passes used to create and join a fresh
+thread_group for this, thousands of times per file; now the workers just sleep in between.
+
+Each worker may be pinned to its own CPU (taken in order from the CPUs this process is allowed
+to run on, with the calling thread on the first), so that whatever a thread leaves in cache or
+in thread-local scratch is still there next pass.
+
+Pinned threads also make it worthwhile to give each thread a fixed share of the work (GetShare),
+and to place the memory for that share on the thread's own NUMA node, by letting the thread
+be the first to touch it (TouchLocally).  Linux puts a page on the node of whoever faults it in.
+
+When work items are uneven, or some threads start on them late, a fixed share leaves the others idle at the end;
+WorkStealingRanges deals the items out in contiguous shares too, but lets a thread which runs out take the back
+half of somebody else's remaining share.
+*/
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/function.hpp>
+#include <boost/atomic.hpp>
+#include <stdint.h>
+#include <vector>
+#include <cstddef>
+
+class WorkerPool
+{
+ public:
+  // NumWorkers threads in addition to the calling thread (which must be the one calling RunOnAll).
+  WorkerPool(size_t NumWorkers, bool PinThreads);
+  ~WorkerPool();
+
+  // Run task on every thread, including this one; return once all are finished.
+  void RunOnAll(const boost::function<void()>& task);
+
+  // Number of threads which run each task, counting the calling thread.
+  size_t GetNumThreads() const { return fNumWorkers + 1; }
+
+  // Index of the calling thread within its pool: 0 for the thread which made the pool (or any
+  // thread outside a pool), 1...NumWorkers for the workers.
+  static size_t GetThreadIndex();
+
+  // The calling thread's share [Begin, End) of NumItems items, split into contiguous, nearly equal ranges.
+  // Every call from the same thread gets the same share, so it can own that part of the work.
+  void GetShare(size_t NumItems, size_t& Begin, size_t& End) const;
+
+  // Discard the whole pages within [ptr, ptr + length), and fault them in again from this thread,
+  // so they are placed on this thread's NUMA node.  Those pages come back zeroed, so only use this
+  // on anonymous memory whose contents don't matter yet.
+  static void TouchLocally(void* ptr, size_t length);
+
+ private:
+  size_t fNumWorkers;
+  boost::thread_group fThreads;
+  std::vector<int> fCPUs; // CPUs to pin to, in order; empty if we don't pin.
+
+  boost::mutex fMutex;
+  boost::condition_variable fWorkReady;
+  boost::condition_variable fWorkDone;
+  boost::function<void()> fTask;
+  size_t fGeneration; // Incremented with every task, so workers can tell a new one from the last.
+  size_t fNumBusy; // Workers still running the current task.
+  bool fShutdown;
+
+  void WorkerLoop(size_t index);
+  void PinToCPU(size_t index) const;
+
+  // No copying -- we own threads.
+  WorkerPool(const WorkerPool&);
+  WorkerPool& operator=(const WorkerPool&);
+};
+
+class WorkStealingRanges
+{
+ public:
+  explicit WorkStealingRanges(size_t NumThreads);
+  ~WorkStealingRanges();
+
+  // Deal out items [0, NumItems) as contiguous, nearly equal ranges, one per thread.
+  // Only call this while no thread is popping.
+  void Reset(size_t NumItems);
+
+  // Take the next item from the front of this thread's range; once that's empty, steal the back half of
+  // another thread's.  Neighbouring items therefore mostly go to the same thread, in order.
+  // Returns false once there's nothing left anywhere (though items taken by other threads may still be running).
+  bool Pop(size_t ThreadIndex, size_t& item);
+
+ private:
+  // Each range is [Begin, End), packed into one word so that the owner (advancing Begin) and thieves
+  // (pulling in End) can both update it with a compare-and-swap.  Padded to keep ranges on separate cache lines.
+  struct Range {
+    boost::atomic<uint64_t> fPacked;
+    char fPadding[64 - sizeof(boost::atomic<uint64_t>)];
+  };
+  static uint64_t Pack(uint64_t Begin, uint64_t End) { return (Begin << 32) | End; }
+  static size_t GetBegin(uint64_t Packed) { return Packed >> 32; }
+  static size_t GetEnd(uint64_t Packed) { return Packed & 0xffffffff; }
+  size_t fNumThreads;
+  Range* fRanges;
+
+  // No copying.
+  WorkStealingRanges(const WorkStealingRanges&);
+  WorkStealingRanges& operator=(const WorkStealingRanges&);
+};
+#endif